@@ -0,0 +1,258 @@
+/*
+ * cache.c.  Node response cache.
+ *
+ * Node commands which read slowly changing data, a node's ID or a
+ * temperature, can be answered from an earlier response instead of going
+ * out on the bus again. Each command code has its own time to live, set in
+ * the [cache] section of the config file, and commands without one are
+ * never cached. Responses are kept by node, command and parameters.
+ *
+ * Anything else sent to a node may change what it would say, so its
+ * completion throws away everything held for the node, as does an interrupt
+ * from it. Rather than search for them, each node has a generation count
+ * which is stamped on its responses, and bumping it makes them all stale
+ * at once.
+ *
+ * Only the network loop uses the cache. Bus transactions complete in the
+ * order they went out on the bus, so a response is never stored after a
+ * later command has invalidated it.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "tnd.h"
+#include "options.h"
+#include "han.h"
+#include "cache.h"
+
+/* Typedefs */
+
+typedef struct cache_entry Cache_Entry;
+
+/* One cached response */
+
+struct cache_entry {
+	uint64_t expires;			// msec, 0 if the entry is free
+	uint32_t gen;				// Node generation when stored
+	uint8_t addr;
+	uint8_t cmd;
+	uint8_t nparams;
+	uint8_t params[MAX_NODE_PARAMS];
+	uint8_t status[MAX_NODE_PARAMS];
+};
+
+/* Locals */
+
+static unsigned cache_ttl[256];			// msec by command code, 0 for not cached
+static uint32_t cache_gen[256];			// Generation by node address
+static Cache_Entry cache_table[CACHE_ENTRIES];
+static Han_Cachestats cache_stats;
+
+
+/*
+* Set the time to live for each command code from a table of 256 msec
+* values, 0 for commands which aren't to be cached. Empties the cache.
+*/
+
+void cache_config(const unsigned *ttl)
+{
+	memcpy(cache_ttl, ttl, sizeof(cache_ttl));
+	memset(cache_table, 0, sizeof(cache_table));
+}
+
+
+/*
+* Return the first entry of the set a request belongs in
+*/
+
+static Cache_Entry *cache_set(const Han_Packet *pkt)
+{
+	uint32_t h = 2166136261U;
+	unsigned i;
+
+	h = (h ^ pkt->nodeaddress) * 16777619U;
+	h = (h ^ pkt->nodecommand) * 16777619U;
+	for(i = 0; i < pkt->numnodeparams; i++)
+		h = (h ^ pkt->nodeparams[i]) * 16777619U;
+	return &cache_table[(h & (CACHE_ENTRIES - 1)) & ~(CACHE_WAYS - 1)];
+}
+
+
+/*
+* Return TRUE if an entry is still good
+*/
+
+static int cache_live(const Cache_Entry *e, uint64_t now)
+{
+	return (e->expires > now) && (e->gen == cache_gen[e->addr]);
+}
+
+
+/*
+* Return TRUE if an entry holds the response to a request
+*/
+
+static int cache_match(const Cache_Entry *e, const Han_Packet *pkt)
+{
+	return (e->addr == pkt->nodeaddress) && (e->cmd == pkt->nodecommand) &&
+		(e->nparams == pkt->numnodeparams) && !memcmp(e->params, pkt->nodeparams, e->nparams);
+}
+
+
+/*
+* Return TRUE if responses to a packet can be cached
+*/
+
+static int cache_wanted(const Han_Packet *pkt)
+{
+	return cache_ttl[pkt->nodecommand] && (pkt->nodeaddress != CACHE_ALL_NODES) &&
+		(pkt->numnodeparams <= MAX_NODE_PARAMS);
+}
+
+
+/*
+* Look for the response to a node command packet. Returns TRUE with the
+* status filled in if there is a live one, else FALSE.
+*/
+
+int cache_lookup(Han_Packet *pkt, uint64_t now)
+{
+	Cache_Entry *e;
+	unsigned i;
+
+	if(!cache_wanted(pkt))
+		return FALSE;
+
+	e = cache_set(pkt);
+	for(i = 0; i < CACHE_WAYS; i++, e++){
+		if(cache_live(e, now) && cache_match(e, pkt)){
+			memcpy(pkt->nodestatus, e->status, e->nparams);
+			cache_stats.hits++;
+			return TRUE;
+		}
+	}
+	cache_stats.misses++;
+	return FALSE;
+}
+
+
+/*
+* Keep a node's response to a command
+*/
+
+static void cache_store(const Han_Packet *pkt, uint64_t now)
+{
+	Cache_Entry *set, *e, *victim = NULL;
+	unsigned i;
+
+	set = cache_set(pkt);
+
+	/* Use the entry already holding it, else a dead one, else the one which would expire first */
+
+	for(i = 0, e = set; i < CACHE_WAYS; i++, e++){
+		if(cache_match(e, pkt) || !cache_live(e, now)){
+			victim = e;
+			break;
+		}
+		if(!victim || (e->expires < victim->expires))
+			victim = e;
+	}
+	if(i == CACHE_WAYS)
+		cache_stats.evictions++;
+
+	victim->expires = now + cache_ttl[pkt->nodecommand];
+	victim->gen = cache_gen[pkt->nodeaddress];
+	victim->addr = pkt->nodeaddress;
+	victim->cmd = pkt->nodecommand;
+	victim->nparams = pkt->numnodeparams;
+	memcpy(victim->params, pkt->nodeparams, pkt->numnodeparams);
+	memcpy(victim->status, pkt->nodestatus, pkt->numnodeparams);
+	cache_stats.stores++;
+}
+
+
+/*
+* A request has come back from the bus. Keep the response if it can be
+* cached, otherwise throw away whatever the command may have made stale.
+*/
+
+void cache_result(const Client_Command *cc, uint64_t now)
+{
+	const Han_Packet *pkt = &cc->cmd.pkt;
+
+	switch(cc->request){
+		case HAN_CCMD_SENDPKT:
+			if(!cache_wanted(pkt))
+				cache_invalidate(pkt->nodeaddress);
+			else if(cc->commstatus == HAN_CSTS_OK)
+				cache_store(pkt, now);
+			break;
+
+		case HAN_CCMD_RAW_PACKET:
+
+			/* No telling which node it was for */
+
+			cache_invalidate(CACHE_ALL_NODES);
+			break;
+
+		default:
+			break;
+	}
+}
+
+
+/*
+* Throw away the responses held for a node, or for every node if addr is
+* CACHE_ALL_NODES
+*/
+
+void cache_invalidate(unsigned addr)
+{
+	unsigned i;
+
+	cache_stats.invalidations++;
+	if(addr != CACHE_ALL_NODES){
+		cache_gen[addr & 0xFF]++;
+		return;
+	}
+	for(i = 0; i < 256; i++)
+		cache_gen[i]++;
+}
+
+
+/*
+* Copy out the cache statistics
+*/
+
+void cache_get(Han_Cachestats *cs, uint64_t now)
+{
+	unsigned i;
+
+	*cs = cache_stats;
+	cs->entries = 0;
+	for(i = 0; i < CACHE_ENTRIES; i++){
+		if(cache_live(&cache_table[i], now))
+			cs->entries++;
+	}
+}
@@ -0,0 +1,50 @@
+/*
+ * cache.h.  Node response cache.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+
+/* Number of responses which can be held. Must be a power of 2. */
+
+#define CACHE_ENTRIES		256
+
+/* Responses with the same hash compete for this many entries */
+
+#define CACHE_WAYS		4
+
+/* Address which stands for every node */
+
+#define CACHE_ALL_NODES		0xFF
+
+/* Prototypes */
+
+void cache_config(const unsigned *ttl);
+int cache_lookup(Han_Packet *pkt, uint64_t now);
+void cache_result(const Client_Command *cc, uint64_t now);
+void cache_invalidate(unsigned addr);
+void cache_get(Han_Cachestats *cs, uint64_t now);
+
+#endif
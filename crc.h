@@ -0,0 +1,48 @@
+/*
+ * crc.h.  Table driven CRC routines for the han packet protocol.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#ifndef CRC_H
+#define CRC_H
+
+#include <stdint.h>
+
+/*
+* Running CRC updates. Start with a crc of 0 and feed the buffer in
+* as many pieces as needed.
+*/
+
+uint8_t crc8_update(uint8_t crc, const void *buf, int len);
+uint8_t crc8_update_slice4(uint8_t crc, const void *buf, int len);
+uint16_t crc16_update(uint16_t crc, const void *buf, int len);
+uint16_t crc16_update_slice4(uint16_t crc, const void *buf, int len);
+
+/*
+* Whole buffer CRC's as used on the wire. A zero length buffer returns FAIL
+* cast to the CRC width, just like the original bitwise routines did.
+*/
+
+uint8_t crc8(const void *buf, int len);
+uint16_t crc16(const void *buf, int len);
+
+#endif
@@ -0,0 +1,225 @@
+/*
+ * crcbench.c.  Check and time the table driven CRC routines against the
+ * original bitwise versions.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include "tnd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "crc.h"
+
+/* Local Defines */
+
+#define CHECK_MAX_LEN	300		// Longest buffer used in the equivalence check
+#define CHECK_PASSES	2000		// Random buffers per length
+#define FRAME_LEN	6		// Typical TX frame: HDC, addr, cmd, 3 params
+#define BULK_LEN	(16 << 10)	// Bulk buffer, ref_crc8() has a 16 bit loop counter
+#define BENCH_BYTES	(64 << 20)	// Bytes to push through each routine
+
+/* Typedefs */
+
+typedef uint32_t (*crcfunc)(const void *buf, int len);
+
+
+/*
+* The bitwise routines exactly as they were in hand.c
+*/
+
+static uint8_t ref_crc8(void *buf, int len){
+	uint8_t theBits, fb, crcReg = 0;
+	uint8_t *p = (uint8_t *) buf;
+	uint16_t i, j;
+	
+	if(!len)
+		return FAIL;
+	
+	for(i = 0 ; i < len ; i++)
+	{
+		theBits = *p++;
+		for(j = 0 ; j < 8 ; j++)
+		{
+			fb = (theBits ^ crcReg) & 1;
+			crcReg >>= 1;
+			if(fb)
+				crcReg ^= 0x8C;
+			theBits >>= 1;
+		}
+	}
+	return crcReg;
+}
+
+static uint16_t ref_crc16(void *buf, int len)
+{
+	uint8_t i;
+	uint16_t crc = 0;
+	uint8_t *b = (uint8_t *) buf;
+	
+	if(!len)
+		return FAIL;
+
+	while(len--){
+		crc ^= (((uint16_t) *b++) << 8);
+		for ( i = 0 ; i < 8 ; ++i ){
+			if (crc & 0x8000)
+				crc = (crc << 1) ^ 0x1021;
+			else
+				crc <<= 1;
+          	}
+	}
+	return crc;
+}
+
+
+/*
+* Wrappers so every routine can be timed through the same pointer type
+*/
+
+static uint32_t w_ref_crc8(const void *buf, int len) { return ref_crc8((void *) buf, len); }
+static uint32_t w_crc8(const void *buf, int len) { return crc8_update(0, buf, len); }
+static uint32_t w_crc8_s4(const void *buf, int len) { return crc8_update_slice4(0, buf, len); }
+static uint32_t w_ref_crc16(const void *buf, int len) { return ref_crc16((void *) buf, len); }
+static uint32_t w_crc16(const void *buf, int len) { return crc16_update(0, buf, len); }
+static uint32_t w_crc16_s4(const void *buf, int len) { return crc16_update_slice4(0, buf, len); }
+
+
+/*
+* Return a monotonic time stamp in nanoseconds
+*/
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/*
+* Check every routine against the reference. Returns the number of mismatches.
+*/
+
+static int check(uint8_t *buf)
+{
+	int len, pass, i, errs = 0;
+	uint8_t c8;
+	uint16_t c16;
+
+	for(len = 0; len <= CHECK_MAX_LEN; len++){
+		for(pass = 0; pass < CHECK_PASSES; pass++){
+			for(i = 0; i < len; i++)
+				buf[i] = (uint8_t) rand();
+
+			c8 = ref_crc8(buf, len);
+			c16 = ref_crc16(buf, len);
+
+			if((crc8(buf, len) != c8) || (crc16(buf, len) != c16))
+				errs++;
+			if(!len)
+				continue;
+			if((crc8_update(0, buf, len) != c8) || (crc8_update_slice4(0, buf, len) != c8))
+				errs++;
+			if((crc16_update(0, buf, len) != c16) || (crc16_update_slice4(0, buf, len) != c16))
+				errs++;
+
+			/* Running updates split at an arbitrary point must agree too */
+
+			i = rand() % len;
+			if(crc8_update_slice4(crc8_update(0, buf, i), buf + i, len - i) != c8)
+				errs++;
+			if(crc16_update_slice4(crc16_update(0, buf, i), buf + i, len - i) != c16)
+				errs++;
+		}
+	}
+	return errs;
+}
+
+
+/*
+* Time a routine over BENCH_BYTES in chunks of len. Returns ns per byte.
+*/
+
+static double time_crc(crcfunc f, const uint8_t *buf, int len)
+{
+	long iters = BENCH_BYTES / len;
+	long n;
+	volatile uint32_t sink = 0;
+	double start;
+
+	start = now_ns();
+	for(n = 0; n < iters; n++)
+		sink ^= f(buf + (n & 0x3F), len);
+	return (now_ns() - start) / ((double) iters * len);
+}
+
+
+/*
+* Time one CRC width at one buffer size and print a line of results
+*/
+
+static void bench(char *name, int len, crcfunc ref, crcfunc table, crcfunc slice4, const uint8_t *buf)
+{
+	double tr, tt, ts;
+
+	tr = time_crc(ref, buf, len);
+	tt = time_crc(table, buf, len);
+	ts = time_crc(slice4, buf, len);
+
+	printf("%-6s %8d %10.3f %10.3f %10.3f %9.1fx %9.1fx\n",
+		name, len, tr, tt, ts, tr / tt, tr / ts);
+}
+
+
+int main(int argc, char *argv[])
+{
+	uint8_t *buf;
+	int i, errs;
+
+	if((buf = malloc(BULK_LEN + 64)) == NULL){
+		fprintf(stderr, "crcbench: out of memory\n");
+		exit(1);
+	}
+
+	srand(1);
+	errs = check(buf);
+	printf("Equivalence check, lengths 0-%d: %s (%d mismatches)\n\n",
+		CHECK_MAX_LEN, errs ? "FAILED" : "passed", errs);
+	if(errs)
+		exit(1);
+
+	for(i = 0; i < BULK_LEN + 64; i++)
+		buf[i] = (uint8_t) rand();
+
+	printf("%-6s %8s %10s %10s %10s %10s %10s\n",
+		"crc", "bytes", "bit ns/B", "tbl ns/B", "s4 ns/B", "tbl gain", "s4 gain");
+	bench("crc8", FRAME_LEN, w_ref_crc8, w_crc8, w_crc8_s4, buf);
+	bench("crc8", BULK_LEN, w_ref_crc8, w_crc8, w_crc8_s4, buf);
+	bench("crc16", FRAME_LEN, w_ref_crc16, w_crc16, w_crc16_s4, buf);
+	bench("crc16", BULK_LEN, w_ref_crc16, w_crc16, w_crc16_s4, buf);
+
+	free(buf);
+	exit(0);
+}
@@ -152,7 +152,7 @@ void debug(int level, char *message, ...) {
 	/* We only do this code if we are at or above the debug level. */
 	if(debuglvl >= level) {
     t = time(NULL);
-    strncpy(timenow,ctime(&t), 31);
+    ctime_r(&t, timenow); // The bus thread logs too
     timenow[31] = 0;
     l = strlen(timenow);
     if(l)
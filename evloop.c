@@ -0,0 +1,324 @@
+/*
+ * evloop.c.  epoll based event loop.
+ *
+ * Each fd is watched through an Ev_Handler which carries its own callback,
+ * so there is no table to search when an event comes in and no limit on
+ * the number of fds. One shot timers are kept in a binary min-heap ordered
+ * by expiry time, and bound how long each epoll_wait() may sleep.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include "tnd.h"
+#include "error.h"
+#include "evloop.h"
+
+/* Locals */
+
+static int epfd = -1;
+static struct epoll_event ready[EVLOOP_MAX_EVENTS];
+static int num_ready = 0;		// Events from the current wakeup still to dispatch
+static int next_ready = 0;
+static Ev_Timer **timers = NULL;	// Min-heap on due time
+static int num_timers = 0;
+static int max_timers = 0;
+
+
+/*
+* Return the time in milliseconds from the monotonic clock
+*/
+
+uint64_t evloop_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/*
+* Put a timer in heap slot i, keeping its index up to date
+*/
+
+static void timer_place(Ev_Timer *t, int i)
+{
+	timers[i] = t;
+	t->index = i;
+}
+
+
+/*
+* Move the timer in slot i up or down until the heap is in order again
+*/
+
+static void timer_sift(int i)
+{
+	Ev_Timer *t = timers[i];
+	int parent, child;
+
+	while(i > 0){
+		parent = (i - 1) / 2;
+		if(timers[parent]->due <= t->due)
+			break;
+		timer_place(timers[parent], i);
+		i = parent;
+	}
+	for(;;){
+		child = 2 * i + 1;
+		if(child >= num_timers)
+			break;
+		if((child + 1 < num_timers) && (timers[child + 1]->due < timers[child]->due))
+			child++;
+		if(t->due <= timers[child]->due)
+			break;
+		timer_place(timers[child], i);
+		i = child;
+	}
+	timer_place(t, i);
+}
+
+
+/*
+* Start a timer which calls callback after msec milliseconds. A timer
+* which is already running is restarted.
+*/
+
+int evloop_timer_start(Ev_Timer *t, unsigned msec, Ev_Timer_Callback callback, void *ctx)
+{
+	Ev_Timer **p;
+
+	t->due = evloop_now() + msec;
+	t->callback = callback;
+	t->ctx = ctx;
+
+	if(t->active){
+		timer_sift(t->index);
+		return PASS;
+	}
+
+	if(num_timers == max_timers){
+		if((p = realloc(timers, (max_timers + EVLOOP_TIMER_CHUNK) * sizeof(Ev_Timer *))) == NULL){
+			debug(DEBUG_UNEXPECTED, "Out of memory starting timer");
+			return FAIL;
+		}
+		timers = p;
+		max_timers += EVLOOP_TIMER_CHUNK;
+	}
+	t->active = TRUE;
+	timer_place(t, num_timers++);
+	timer_sift(t->index);
+	return PASS;
+}
+
+
+/*
+* Stop a timer. Stopping one which isn't running does nothing.
+*/
+
+void evloop_timer_stop(Ev_Timer *t)
+{
+	int i;
+
+	if(!t->active)
+		return;
+	t->active = FALSE;
+	i = t->index;
+	t->index = -1;
+	if(i != --num_timers){
+		timer_place(timers[num_timers], i);
+		timer_sift(i);
+	}
+}
+
+
+/*
+* Run the callbacks of every timer which has expired
+*/
+
+static void timer_dispatch(void)
+{
+	Ev_Timer *t;
+	uint64_t now = evloop_now();
+
+	while(num_timers && (timers[0]->due <= now)){
+		t = timers[0];
+		evloop_timer_stop(t);
+		t->callback(t);
+	}
+}
+
+
+/*
+* Create the epoll instance
+*/
+
+int evloop_init(void)
+{
+	if(epfd != -1)
+		return PASS;
+	if((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1){
+		debug(DEBUG_UNEXPECTED, "epoll_create1 failed: %s", strerror(errno));
+		return FAIL;
+	}
+	return PASS;
+}
+
+
+/*
+* Close the epoll instance. Handlers still registered are forgotten.
+*/
+
+void evloop_close(void)
+{
+	if(epfd != -1)
+		close(epfd);
+	epfd = -1;
+	num_ready = next_ready = 0;
+}
+
+
+/*
+* Start watching fd for events, calling callback when any are ready
+*/
+
+int evloop_add(Ev_Handler *h, int fd, uint32_t events, Ev_Callback callback, void *ctx)
+{
+	struct epoll_event ev;
+
+	h->fd = fd;
+	h->events = events;
+	h->callback = callback;
+	h->ctx = ctx;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = h;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1){
+		debug(DEBUG_UNEXPECTED, "epoll_ctl add fd %d failed: %s", fd, strerror(errno));
+		h->active = FALSE;
+		return FAIL;
+	}
+	h->active = TRUE;
+	return PASS;
+}
+
+
+/*
+* Change the set of events watched for
+*/
+
+int evloop_modify(Ev_Handler *h, uint32_t events)
+{
+	struct epoll_event ev;
+
+	if(!h->active)
+		return FAIL;
+	if(h->events == events)
+		return PASS;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = h;
+	if(epoll_ctl(epfd, EPOLL_CTL_MOD, h->fd, &ev) == -1){
+		debug(DEBUG_UNEXPECTED, "epoll_ctl modify fd %d failed: %s", h->fd, strerror(errno));
+		return FAIL;
+	}
+	h->events = events;
+	return PASS;
+}
+
+
+/*
+* Stop watching a handler's fd. Must be called before the fd is closed.
+* Any of its events still waiting to be dispatched this wakeup are dropped,
+* so the handler's memory can be freed straight after.
+*/
+
+int evloop_remove(Ev_Handler *h)
+{
+	int i;
+
+	if(!h->active)
+		return PASS;
+	h->active = FALSE;
+
+	for(i = next_ready; i < num_ready; i++){
+		if(ready[i].data.ptr == h)
+			ready[i].data.ptr = NULL;
+	}
+
+	if(epoll_ctl(epfd, EPOLL_CTL_DEL, h->fd, NULL) == -1){
+		debug(DEBUG_UNEXPECTED, "epoll_ctl delete fd %d failed: %s", h->fd, strerror(errno));
+		return FAIL;
+	}
+	return PASS;
+}
+
+
+/*
+* Wait up to timeout milliseconds for events, or until the next timer is
+* due, and dispatch every event and timer which comes in. Returns the number
+* of fd events dispatched, or -1 with errno set if epoll_wait failed (EINTR
+* when a signal arrived).
+*/
+
+int evloop_run_once(int timeout)
+{
+	Ev_Handler *h;
+	uint32_t events;
+	uint64_t now;
+	int n;
+
+	if(num_timers){
+		now = evloop_now();
+		if(timers[0]->due <= now)
+			timeout = 0;
+		else if((timeout < 0) || (timers[0]->due - now < (uint64_t) timeout))
+			timeout = (int)(timers[0]->due - now);
+	}
+
+	n = epoll_wait(epfd, ready, EVLOOP_MAX_EVENTS, timeout);
+	if(n < 0){
+		if(errno == EINTR)
+			timer_dispatch();
+		return -1;
+	}
+
+	num_ready = n;
+	for(next_ready = 0; next_ready < num_ready;){
+		h = ready[next_ready].data.ptr;
+		events = ready[next_ready++].events;
+		if(h)
+			h->callback(h, events);
+	}
+	n = num_ready;
+	num_ready = next_ready = 0;
+
+	timer_dispatch();
+	return n;
+}
@@ -0,0 +1,87 @@
+/*
+ * evloop.h.  epoll based event loop.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+/* Most events taken from the kernel per wakeup. Any more are picked up next time round. */
+
+#define EVLOOP_MAX_EVENTS	64
+
+/* Timer heap grows in steps of this many entries */
+
+#define EVLOOP_TIMER_CHUNK	32
+
+/* Typedefs */
+
+typedef struct ev_handler Ev_Handler;
+typedef struct ev_timer Ev_Timer;
+
+/*
+* Called with the epoll events which are ready on the handler's fd.
+* The handler may remove itself, or any other handler, from inside the call.
+*/
+
+typedef void (*Ev_Callback)(Ev_Handler *h, uint32_t events);
+
+/* Called once when a timer expires. The timer may be restarted from inside the call. */
+
+typedef void (*Ev_Timer_Callback)(Ev_Timer *t);
+
+/* One of these per fd watched. Embed it in whatever owns the fd. */
+
+struct ev_handler {
+	int fd;
+	uint32_t events;
+	Ev_Callback callback;
+	void *ctx;
+	uint8_t active;
+};
+
+/* A one shot timer. Embed it in whatever owns it, and zero it before first use. */
+
+struct ev_timer {
+	uint64_t due;			// Expiry time in msec on the monotonic clock
+	int index;			// Position in the timer heap, -1 when stopped
+	Ev_Timer_Callback callback;
+	void *ctx;
+	uint8_t active;
+};
+
+/* Prototypes */
+
+int evloop_init(void);
+void evloop_close(void);
+int evloop_add(Ev_Handler *h, int fd, uint32_t events, Ev_Callback callback, void *ctx);
+int evloop_modify(Ev_Handler *h, uint32_t events);
+int evloop_remove(Ev_Handler *h);
+int evloop_run_once(int timeout);
+uint64_t evloop_now(void);
+int evloop_timer_start(Ev_Timer *t, unsigned msec, Ev_Timer_Callback callback, void *ctx);
+void evloop_timer_stop(Ev_Timer *t);
+
+#endif
@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# faultsweep.sh.  Run hand against hansim at a range of line error rates
+# and print the throughput and latency hanload achieves at each one.
+#
+# Usage: faultsweep.sh [RATE]...
+#
+# Environment: COUNT transactions per rate, SEED for hansim, BAUD and
+# LATENCY for hansim, PORT for the command port hand listens on.
+#
+# $Id$
+#
+
+RATES=${*:-"0 0.001 0.005 0.01 0.02 0.05 0.1"}
+COUNT=${COUNT:-1000}
+SEED=${SEED:-1}
+BAUD=${BAUD:-9600}
+LATENCY=${LATENCY:-2000}
+PORT=${PORT:-11528}
+
+DIR=$(mktemp -d /tmp/faultsweep.XXXXXX) || exit 1
+HAND_PID=
+SIM_PID=
+
+cleanup() {
+	[ -n "$HAND_PID" ] && kill $HAND_PID 2>/dev/null
+	[ -n "$SIM_PID" ] && kill $SIM_PID 2>/dev/null
+	wait 2>/dev/null
+	rm -rf $DIR
+}
+trap cleanup EXIT INT TERM
+
+cat > $DIR/han.conf <<EOF
+[global]
+service = $PORT
+host = localhost
+pid_file = $DIR/hand.pid
+
+[hand]
+tty = $DIR/tty
+retries = 2
+max_node_addr = 4
+EOF
+
+HEADER=-H
+for RATE in $RATES; do
+	./hansim -l $DIR/tty -N 2 -b $BAUD -L $LATENCY -s $SEED -e $RATE 2>$DIR/hansim.log >/dev/null &
+	SIM_PID=$!
+	while [ ! -e $DIR/tty ]; do sleep 0.1; done
+	./hand -n -c $DIR/han.conf 2>$DIR/hand.log &
+	HAND_PID=$!
+	sleep 0.5
+	./hanload -c $DIR/han.conf -a 2 -n $COUNT -l $RATE $HEADER || exit 1
+	HEADER=
+	kill $HAND_PID $SIM_PID
+	wait $HAND_PID $SIM_PID 2>/dev/null
+	HAND_PID=
+	SIM_PID=
+	rm -f $DIR/tty $DIR/hand.pid
+done
@@ -0,0 +1,158 @@
+/*
+ * frame.c.  Framing of packets on the RS-485 network.
+ *
+ * A frame is STX, the packet bytes, then ETX. Any packet byte with a value
+ * of SUBST or less is sent as SUBST followed by the byte, so an unstuffed
+ * STX or ETX can only ever be framing.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include "tnd.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "error.h"
+#include "frame.h"
+
+/* Enums */
+
+enum {FDS_WAIT_STX = 0, FDS_RCV};
+
+
+/*
+* Initialize a decoder
+*/
+
+void frame_decoder_init(Frame_Decoder *fd, Frame_Callback callback, void *ctx)
+{
+	memset(fd, 0, sizeof(Frame_Decoder));
+	fd->callback = callback;
+	fd->ctx = ctx;
+}
+
+
+/*
+* Throw away any partial frame and wait for the next STX
+*/
+
+void frame_decoder_reset(Frame_Decoder *fd)
+{
+	fd->state = FDS_WAIT_STX;
+	fd->subst = FALSE;
+	fd->len = 0;
+}
+
+
+/*
+* Feed received bytes to a decoder.
+*
+* Complete frames are passed to the callback. A frame which will not fit
+* in FRAME_MAX_LEN is dropped when its ETX arrives. An unstuffed STX in the
+* middle of a frame abandons the partial frame and starts a new one.
+*
+* Returns the number of bytes used. This is less than len only when the
+* callback asked to stop.
+*/
+
+int frame_decoder_feed(Frame_Decoder *fd, const uint8_t *buf, int len)
+{
+	int i;
+	uint8_t c;
+
+	for(i = 0; i < len; i++){
+		c = buf[i];
+
+		if(fd->state == FDS_WAIT_STX){
+			if(c == STX){
+				fd->state = FDS_RCV;
+				fd->subst = FALSE;
+				fd->len = 0;
+			}
+			else{
+				fd->garbage++;
+				debug(DEBUG_EXPECTED, "Garbage byte received: %02X", c);
+			}
+			continue;
+		}
+
+		if(fd->subst)
+			fd->subst = FALSE;
+		else if(c == ETX){
+			fd->state = FDS_WAIT_STX;
+			if(fd->len > FRAME_MAX_LEN)
+				continue; /* Overrun, already counted */
+			fd->frames++;
+			if((*fd->callback)(fd->ctx, fd->buf, fd->len))
+				return i + 1;
+			continue;
+		}
+		else if(c == SUBST){
+			fd->subst = TRUE;
+			continue;
+		}
+		else if(c == STX){
+			debug(DEBUG_EXPECTED, "STX received inside a frame, restarting");
+			fd->resyncs++;
+			fd->len = 0;
+			fd->state = FDS_RCV;
+			continue;
+		}
+
+		/* Store the byte if there is room. The first byte past the end marks the overrun. */
+
+		if(fd->len < FRAME_MAX_LEN)
+			fd->buf[fd->len++] = c;
+		else if(fd->len == FRAME_MAX_LEN){
+			debug(DEBUG_UNEXPECTED, "Frame longer than %d bytes dropped", FRAME_MAX_LEN);
+			fd->overruns++;
+			fd->len++;
+		}
+	}
+	return len;
+}
+
+
+/*
+* Stuff and frame len bytes from src into dest.
+* Returns the number of bytes in dest, or FAIL if dest is too small.
+*/
+
+int frame_encode(uint8_t *dest, int destlen, const uint8_t *src, int len)
+{
+	int i, n = 0;
+
+	if(destlen < 2)
+		return FAIL;
+
+	dest[n++] = STX;
+	for(i = 0; i < len; i++){
+		if(n + 3 > destlen)
+			return FAIL;
+		if(src[i] <= SUBST)
+			dest[n++] = SUBST;
+		dest[n++] = src[i];
+	}
+	if(n + 1 > destlen)
+		return FAIL;
+	dest[n++] = ETX;
+	return n;
+}
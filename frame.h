@@ -0,0 +1,89 @@
+/*
+ * frame.h.  Framing of packets on the RS-485 network.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+
+/* Packet protocol constants */
+
+#define STX		0x02			// Denotes start of frame
+#define ETX		0x03			// Denotes end of frame
+#define SUBST		0x04			// Substitute next character
+#define HDC		0x01			// Header control bits for cmd
+#define HDCINTRQ	0x02			// Header control bits for interrupt request from node
+#define HDCINTRQ16	0x03			// Header control bits for interrupt request from node CRC16
+#define HDC16		0x05			// Header control bits for cmd CRC16
+#define	HDC_ACK		0xC1			// ACK response
+#define	HDC_ACK16	0xC5			// ACK Response CRC16
+#define HDC_NAK		0x81			// NAK response
+#define	HDC_NAK16	0x85			// NAK response CRC16
+
+/* Largest unstuffed frame the decoder will accept */
+
+#define FRAME_MAX_LEN	64
+
+/* Largest stuffed frame frame_encode() can produce from FRAME_MAX_LEN bytes */
+
+#define FRAME_MAX_STUFFED_LEN	(FRAME_MAX_LEN * 2 + 2)
+
+/* Typedefs */
+
+typedef struct frame_decoder Frame_Decoder;
+
+/*
+* Called with each complete frame. The frame is only valid for the duration
+* of the call. Return non-zero to make frame_decoder_feed() return right
+* after this frame.
+*/
+
+typedef int (*Frame_Callback)(void *ctx, uint8_t *frame, int len);
+
+/* Decoder state. One of these per byte stream. */
+
+struct frame_decoder {
+	int state;
+	int subst;
+	int len;
+	Frame_Callback callback;
+	void *ctx;
+
+	/* Statistics */
+	unsigned frames;
+	unsigned garbage;
+	unsigned overruns;
+	unsigned resyncs;
+
+	uint8_t buf[FRAME_MAX_LEN];
+};
+
+/* Prototypes */
+
+void frame_decoder_init(Frame_Decoder *fd, Frame_Callback callback, void *ctx);
+void frame_decoder_reset(Frame_Decoder *fd);
+int frame_decoder_feed(Frame_Decoder *fd, const uint8_t *buf, int len);
+int frame_encode(uint8_t *dest, int destlen, const uint8_t *src, int len);
+
+#endif
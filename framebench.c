@@ -0,0 +1,140 @@
+/*
+ * framebench.c.  Check and time the frame decoder over a large stream of
+ * randomly generated packets.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include "tnd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "crc.h"
+#include "frame.h"
+
+/* Local Defines */
+
+#define NUM_FRAMES	2000000		// Frames in the test stream
+#define MAX_PAYLOAD	21		// HDC, addr, cmd, 16 params, CRC16
+#define MAX_CHUNK	512		// Largest piece of stream fed at once
+
+/* Typedefs */
+
+typedef struct bench_state Bench_State;
+
+/* What the callback checks each frame against */
+
+struct bench_state {
+	uint8_t *lens;		// Expected length of each frame
+	unsigned next;		// Index of the next expected frame
+	unsigned errors;
+};
+
+/* Globals needed by error.c */
+
+int debuglvl = 0;
+char *progname;
+
+
+/*
+* Return a monotonic time stamp in seconds
+*/
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+* Decoder callback. Every frame must be the right length and pass its CRC8.
+*/
+
+static int check_frame(void *ctx, uint8_t *frame, int len)
+{
+	Bench_State *bs = (Bench_State *) ctx;
+
+	if((len != bs->lens[bs->next]) || crc8(frame, len))
+		bs->errors++;
+	bs->next++;
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	uint8_t packet[MAX_PAYLOAD];
+	uint8_t *stream;
+	Bench_State bs;
+	Frame_Decoder fd;
+	size_t size, pos, n;
+	int i, len;
+	unsigned f;
+	double start, elapsed;
+
+	progname = argv[0];
+
+	stream = malloc((size_t) NUM_FRAMES * FRAME_MAX_STUFFED_LEN);
+	bs.lens = malloc(NUM_FRAMES);
+	if(!stream || !bs.lens){
+		fprintf(stderr, "framebench: out of memory\n");
+		exit(1);
+	}
+
+	/* Build a stream of frames, each a random packet with a CRC8 on the end */
+
+	srand(1);
+	for(f = 0, size = 0; f < NUM_FRAMES; f++){
+		len = 3 + rand() % (MAX_PAYLOAD - 3);
+		for(i = 0; i < len - 1; i++)
+			packet[i] = (uint8_t) rand();
+		packet[len - 1] = crc8(packet, len - 1);
+		bs.lens[f] = len;
+		size += frame_encode(stream + size, FRAME_MAX_STUFFED_LEN, packet, len);
+	}
+
+	/* Feed it in random sized chunks, as reads from a tty would arrive */
+
+	bs.next = bs.errors = 0;
+	frame_decoder_init(&fd, check_frame, &bs);
+	start = now();
+	for(pos = 0; pos < size; pos += n){
+		n = 1 + rand() % MAX_CHUNK;
+		if(n > size - pos)
+			n = size - pos;
+		frame_decoder_feed(&fd, stream + pos, n);
+	}
+	elapsed = now() - start;
+
+	printf("Decoded %u of %u frames, %u errors, %u garbage bytes, %u overruns\n",
+		bs.next, NUM_FRAMES, bs.errors, fd.garbage, fd.overruns);
+	printf("%lu bytes in %.3f s: %.1f MB/s, %.1f ns/frame\n",
+		(unsigned long) size, elapsed, size / elapsed / 1e6, elapsed * 1e9 / NUM_FRAMES);
+
+	free(stream);
+	free(bs.lens);
+	exit((bs.errors || (bs.next != NUM_FRAMES)) ? 1 : 0);
+}
@@ -27,16 +27,24 @@
 
 /* Typedefs. */
 typedef struct client_command Client_Command;
+typedef struct client_tagged_command Client_Tagged_Command;
 typedef struct han_packet Han_Packet;
 typedef struct han_netscan Han_Netscan;
 typedef struct han_watch_entry Han_Watch_Entry;
 typedef struct err_stats Err_Stats;
 typedef struct hand_info Hand_Info;
+typedef struct han_nodestats Han_Nodestats;
+typedef struct han_queuestats Han_Queuestats;
+typedef struct han_cachestats Han_Cachestats;
+typedef struct han_samples Han_Samples;
+typedef struct han_history Han_History;
+typedef struct han_textstats Han_Textstats;
 
 /* Generic node commands */
 #define HAN_CMD_NOOP	0	// No operation, 0-MAX parms reqd
 #define HAN_CMD_NODEID	1	// Return node id and other info, 4 parms reqd.
 #define HAN_CMD_GCST	2	// Return error information, 3 parms reqd.
+#define HAN_CMD_GIST	3	// Return interrupt status, 2 parms reqd.
 
 /* Relay node commands */
 
@@ -58,6 +66,15 @@ typedef struct hand_info Hand_Info;
 #define HAN_CCMD_NETSTATSCLR 3
 #define HAN_CCMD_DAEMON_INFO 4
 #define	HAN_CCMD_RAW_PACKET 5
+#define HAN_CCMD_SESSION 6		// Keep the connection open for tagged commands
+#define HAN_CCMD_NODESTATS 7		// Per node response times and health
+#define HAN_CCMD_QUEUESTATS 8		// Bus queue depths and waits by priority
+#define HAN_CCMD_CACHESTATS 9		// Response cache hits and misses
+#define HAN_CCMD_SAMPLES 10		// Values the daemon has sampled from the nodes
+#define HAN_CCMD_HISTORY 11		// Stored sample values over time
+#define HAN_CCMD_WATCH 12		// Be told when a node's response changes
+#define HAN_CCMD_UNWATCH 13		// Stop a watch
+#define HAN_CCMD_TEXTSTATS 14		// Text socket output queues and drops
 #define HAN_CCMD_PPOWER_COMMAND 0x1000
 
 /* Communication status codes */
@@ -76,6 +93,8 @@ typedef struct hand_info Hand_Info;
 #define HAN_CSTS_PPOWER_FORK_ERROR -11
 #define HAN_CSTS_INVPARM -14
 #define	HAN_CSTS_SERIAL_DISCONNECT -15
+#define HAN_CSTS_NODE_DOWN -16	// Node isn't answering, so the command wasn't sent
+#define HAN_CSTS_SCAN_CANCELED -17	// Network scan was stopped before it finished
 
 
 /* PPOWER definitions */
@@ -101,6 +120,10 @@ struct err_stats {
 	unsigned rx_timeouts;
 	unsigned tx_timeouts;
 	unsigned crc_errs;
+	unsigned rx_syscalls;
+	unsigned rx_bytes;
+	unsigned tx_syscalls;
+	unsigned tx_bytes;
 };
 
 struct hand_info {
@@ -110,19 +133,228 @@ struct hand_info {
 	short int	errstatssize;
 	short int	ppowersize;
 	short int	rawsize;
-	short int	pad[42];
+	short int	sessionsize;	// sizeof(Client_Tagged_Command) if sessions are supported, else 0
+	short int	wireversion;	// Highest wire format understood, 0 if only the fixed one
+	short int	pad[40];
 	char		version[32];
 
 };
 	
 
-/* Netscan structure. Used by the netscan command */
+/*
+* Netscan structure. Used by the netscan command. The daemon keeps the
+* result of the last scan, and answers with it unless a refresh is asked
+* for. flags are only looked at on session and v2 connections.
+*/
 
 struct  han_netscan {
 	unsigned char numnodesfound;
+	unsigned char flags;		// HAN_NETSCAN_xxx
+	unsigned char lastaddr;		// Response: highest address probed so far
 	struct node_info nodelist[256];
 };
 
+/* Netscan flags */
+
+#define HAN_NETSCAN_REFRESH 0x01	// Request: scan again even if there is a result
+#define HAN_NETSCAN_CANCEL 0x02		// Request: stop the scan in progress
+#define HAN_NETSCAN_PROGRESS 0x04	// Request: send a partial response as nodes are found
+#define HAN_NETSCAN_PARTIAL 0x80	// Response: the scan is still going
+
+/* Per node statistics. Times are in microseconds. */
+
+struct node_stats {
+	unsigned char addr;
+	unsigned char state;	// HAN_NODE_xxx
+	unsigned samples;	// Round trips measured
+	unsigned timeouts;	// Responses which never came
+	unsigned srtt;		// Smoothed round trip time
+	unsigned rttvar;	// Round trip time deviation
+	unsigned timeout;	// Response timeout now in use
+	unsigned downs;		// Times the node was taken as down
+	unsigned ups;		// Times it answered again afterwards
+	unsigned refused;	// Commands failed while it was down
+	unsigned crc_errs;	// Responses with a bad CRC
+	unsigned naks;		// Commands it refused
+	unsigned format_errs;	// Responses which made no sense
+	unsigned idle;		// Seconds since it last answered
+};
+
+/* Nodes in one nodestats response, as many as fit in a v2 message */
+
+#define HAN_NODESTATS_MAX 30
+
+/* Node states */
+
+#define HAN_NODE_UP 0
+#define HAN_NODE_DOWN 1
+
+/* Idle time of a node which has never answered */
+
+#define HAN_NODE_NEVER_SEEN 0xFFFFFFFF
+
+/*
+* Nodestats structure. Used by the nodestats command. Nodes are reported
+* in address order from first up. If more is set, ask again starting
+* above the last address returned.
+*/
+
+struct han_nodestats {
+	unsigned char first;
+	unsigned char numnodes;
+	unsigned char more;
+	struct node_stats nodelist[HAN_NODESTATS_MAX];
+};
+
+/*
+* Bus transaction priorities. Interrupt acknowledgements go first, then
+* interactive requests, then bulk ones. A request which has waited too long
+* goes ahead of everything.
+*/
+
+#define HAN_PRIO_INTERRUPT 0
+#define HAN_PRIO_INTERACTIVE 1
+#define HAN_PRIO_BULK 2
+#define HAN_PRIO_CLASSES 3
+
+/* Queue statistics for one priority. Times are in milliseconds. */
+
+struct queue_stats {
+	unsigned depth;		// Waiting now
+	unsigned maxdepth;	// Most ever waiting at once
+	unsigned served;	// Transactions carried out
+	unsigned promoted;	// Served early for having waited too long
+	unsigned waittotal;	// Time spent waiting by those served
+	unsigned waitmax;	// Longest wait
+	unsigned coalesced;	// Shared a transaction with an identical request
+};
+
+/* Queuestats structure. Used by the queuestats command. */
+
+struct han_queuestats {
+	struct queue_stats queue[HAN_PRIO_CLASSES];
+};
+
+/* Cachestats structure. Used by the cachestats command. */
+
+struct han_cachestats {
+	unsigned hits;		// Answered from the cache
+	unsigned misses;	// Cacheable, but had to go to the bus
+	unsigned stores;	// Responses kept
+	unsigned invalidations;	// Times a node's responses were thrown away
+	unsigned evictions;	// Live responses pushed out for room
+	unsigned entries;	// Live responses held now
+};
+
+/* Textstats structure. Used by the textstats command. */
+
+struct han_textstats {
+	unsigned sockets;	// Text sockets open
+	unsigned queued;	// Lines waiting to be written to them now
+	unsigned maxqueued;	// Most ever waiting for one socket
+	unsigned events;	// Event lines queued, once for each socket
+	unsigned dropped;	// Event lines dropped for sockets which weren't keeping up
+	unsigned disconnects;	// Sockets closed for not keeping up
+};
+
+/* One sample of a series. values has one byte per parameter of the series. */
+
+struct sample {
+	unsigned seq;		// Counts up from 1
+	unsigned age;		// Msec since it was taken
+	int status;		// HAN_CSTS_xxx
+	unsigned char values[MAX_NODE_PARAMS];
+};
+
+#define HAN_SAMPLES_MAX 48
+
+/*
+* Samples structure. Used by the samples command. Asks for the samples of
+* one series numbered since or later, and gets them oldest first along
+* with what the series samples. If more is set, ask again since the last
+* seq returned plus one. Series are numbered from 0 in the order they are
+* configured, and an unknown one gets HAN_CSTS_INVPARM with numseries set.
+*/
+
+struct han_samples {
+	unsigned char series;		// Which series
+	unsigned char numseries;	// Response: how many there are
+	unsigned char more;		// Response: there are newer samples
+	unsigned char addr;		// Response: node command sampled
+	unsigned char cmd;
+	unsigned char numparams;
+	unsigned char params[MAX_NODE_PARAMS];
+	unsigned char numsamples;	// Response: number in samples
+	unsigned interval;		// Response: msec between samples
+	unsigned last;			// Response: seq of the newest sample, 0 if none yet
+	unsigned since;			// Request: first seq wanted
+	struct sample samples[HAN_SAMPLES_MAX];
+};
+
+/* A summary of the stored values of a series over a period */
+
+struct history_point {
+	unsigned time;		// Start of the period, secs since the epoch
+	unsigned count;		// Values stored in it
+	int min;
+	int max;
+	int avg;		// Rounded to the nearest
+};
+
+#define HAN_HISTORY_MAX 64
+
+/*
+* History structure. Used by the history command. Asks for the values
+* stored for a series from from to to, in secs since the epoch, summarized
+* step seconds to a point, or 0 for a point per stored value. Periods with
+* nothing stored are left out. If more is set, ask again from from as
+* returned. A series which isn't stored gets HAN_CSTS_INVPARM.
+*/
+
+struct han_history {
+	unsigned char series;		// Which series, as for the samples command
+	unsigned char numpoints;	// Response: number in points
+	unsigned char more;		// Response: there are more points
+	unsigned from;			// Response: where to carry on from if more is set
+	unsigned to;
+	unsigned step;			// Response: secs per point used
+	unsigned slot;			// Response: secs per stored value
+	struct history_point points[HAN_HISTORY_MAX];
+};
+
+/*
+* Watch structure. Used by the watch and unwatch commands, on session and
+* v2 connections only. A watch has the daemon send a node command every
+* interval msec, and tell the client when the response changes. With a
+* type of B, I or U, as in the han.php format strings, only the value at
+* offset in the response is looked at, and it has to move by more than
+* deadband from the one last reported. With a type of 0, any change in the
+* response is reported.
+*
+* The response to a watch request has the watch's id. Each change is then
+* sent as another response with the tag of the request and event set,
+* starting with the first response the node gives. status is that of the
+* node command, so a node which stops answering is reported too. An
+* unwatch request only needs the id, and an unknown one gets
+* HAN_CSTS_NO_SUCH_WATCH. Watches end when the connection closes.
+*/
+
+struct han_watch_entry {
+	unsigned id;			// Response: the watch, or Request: the one to stop
+	unsigned char event;		// Response: a change, not the answer to the request
+	unsigned char addr;		// Node command to watch
+	unsigned char cmd;
+	unsigned char numparams;
+	unsigned char params[MAX_NODE_PARAMS];
+	unsigned char type;		// Value to watch, 0 for the whole response
+	unsigned char offset;		// Where the value is in the response
+	unsigned interval;		// msec between looks at the node
+	unsigned deadband;		// Changes up to this much aren't reported
+	int status;			// Event: HAN_CSTS_xxx of the node command
+	int value;			// Event: the value, if type is set
+	unsigned char values[MAX_NODE_PARAMS];	// Event: the response
+};
+
 /* Packet structure. Used by REQUEST_COMMAND */
  
 struct  han_packet {
@@ -161,6 +393,13 @@ union han_command {
 	struct hand_info info;
  	struct ppower_client_command ppower_cmd;
 	struct han_raw raw;
+	struct han_nodestats nodestats;
+	struct han_queuestats queuestats;
+	struct han_cachestats cachestats;
+	struct han_textstats textstats;
+	struct han_samples samples;
+	struct han_history history;
+	struct han_watch_entry watch;
 };
 
 
@@ -172,5 +411,16 @@ struct client_command {
 	union han_command cmd;
 }; 
 
+/*
+* Tagged client command. After a HAN_CCMD_SESSION request has been
+* acknowledged, requests and responses on the connection are sent in
+* this form. The daemon returns the tag of the request with each response.
+*/
+
+struct client_tagged_command {
+	unsigned tag;
+	struct client_command cc;
+};
+
 #endif
 	
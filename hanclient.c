@@ -27,6 +27,7 @@
 #include "options.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <limits.h>
@@ -36,6 +37,7 @@
 #include "socket.h"
 #include "pid.h"
 #include "han.h"
+#include "wire.h"
 #include "hanclient.h"
 
 /*
@@ -45,6 +47,10 @@ static char *inetService = NULL;
 static char *inetHost = NULL;
 static char *sockFilePath = NULL;
 static char *networkErr = "HAN network error: ";
+static int wireVersion = -1;		// Format to talk to the daemon in, -1 until it has been asked
+static int wireSock = -1;		// v2 connection, kept open between commands
+static uint32_t wireTag = 0;
+static unsigned wireFlags = 0;		// WIRE_FLAG_xxx sent with every request
 
 /*
 * Determine the best method to connect and check to see if everything is in place
@@ -73,9 +79,13 @@ void hanclient_connect_setup(char *pidpath, char *sockfilepath, char *service, c
 }
 
 
-int hanclient_send_command_return_res(Client_Command *client_command)
+/*
+* Connect to the han daemon, and return a non-blocking socket
+*/
+
+static int hanclient_connect(void)
 {
-	int sock,i;
+	int sock;
 
 	/* Attempt to connect to the han daemon */
   
@@ -92,6 +102,20 @@ int hanclient_send_command_return_res(Client_Command *client_command)
 	if(fcntl(sock, F_SETFL, O_NONBLOCK) == -1)
 		fatal_with_reason(errno, "Could not set socket to nonblocking");
 
+	return sock;
+}
+
+
+/*
+* Send a command in the fixed size format on a connection of its own
+*/
+
+static int hanclient_legacy_command(Client_Command *client_command)
+{
+	int sock,i;
+
+	sock = hanclient_connect();
+
 	/* Write the client command block */
 
 	i = socket_write(sock,
@@ -123,6 +147,245 @@ int hanclient_send_command_return_res(Client_Command *client_command)
 }
 
 
+
+/*
+* Find out which wire format the daemon speaks, with a fixed format
+* DAEMON_INFO request. If that is the command being sent, its result is
+* passed back in client_command, and TRUE is returned.
+*/
+
+static int hanclient_negotiate(Client_Command *client_command)
+{
+	Client_Command info;
+	Client_Command *cc = &info;
+
+	if(client_command && (client_command->request == HAN_CCMD_DAEMON_INFO))
+		cc = client_command;
+	else{
+		memset(&info, 0, sizeof(Client_Command));
+		info.request = HAN_CCMD_DAEMON_INFO;
+	}
+
+	hanclient_legacy_command(cc);
+
+	/* Daemons from before v2 leave the field zeroed */
+
+	wireVersion = (cc->commstatus == HAN_CSTS_OK) ? cc->cmd.info.wireversion : 0;
+	debug(DEBUG_EXPECTED, "Using wire format %d", (wireVersion >= WIRE_VERSION) ? WIRE_VERSION : 1);
+	return cc == client_command;
+}
+
+
+/*
+* Send a v2 message
+*/
+
+static void hanclient_wire_send(int sock, uint32_t tag, Client_Command *client_command)
+{
+	uint8_t msg[WIRE_MAX_MSG];
+
+	if(!socket_write(sock, msg, wire_encode(msg, client_command, tag, wireFlags), USER_WRITE_TIMEOUT))
+		fatal("Socket time out error, writing client command");
+}
+
+
+/*
+* Read a v2 response. Returns its tag.
+*/
+
+static uint32_t hanclient_wire_receive(int sock, Client_Command *client_command)
+{
+	uint8_t msg[WIRE_MAX_MSG];
+	Wire_Header hdr;
+
+	if(!socket_read(sock, msg, WIRE_HDR_LEN, USER_READ_TIMEOUT))
+		fatal("Socket time out error, waiting for response");
+	if(wire_header(msg, &hdr))
+		fatal("%sBad response header", networkErr);
+	if(!socket_read(sock, msg + WIRE_HDR_LEN, hdr.length, USER_READ_TIMEOUT))
+		fatal("Socket time out error, waiting for response");
+
+	memset(client_command, 0, sizeof(Client_Command));
+	if(wire_decode(client_command, &hdr, msg + WIRE_HDR_LEN, TRUE))
+		fatal("%sMalformed response to request %u", networkErr, hdr.request);
+	return hdr.tag;
+}
+
+
+/*
+* Send a command over the v2 connection, opening it first if need be
+*/
+
+static int hanclient_wire_command(Client_Command *client_command)
+{
+	uint32_t tag = ++wireTag;
+	char c;
+
+	/* The daemon may have closed the connection since the last command, if it was restarted */
+
+	if((wireSock != -1) && (recv(wireSock, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0)){
+		socket_close(wireSock);
+		wireSock = -1;
+	}
+	if(wireSock == -1)
+		wireSock = hanclient_connect();
+
+	hanclient_wire_send(wireSock, tag, client_command);
+
+	debug(DEBUG_EXPECTED,"packet sent, waiting for response");
+
+	if(hanclient_wire_receive(wireSock, client_command) != tag)
+		fatal("%sResponse out of sequence", networkErr);
+
+	return client_command->commstatus;
+}
+
+
+/*
+* Send a command to the daemon and wait for the response. The compact v2
+* format is used if the daemon understands it.
+*/
+
+int hanclient_send_command_return_res(Client_Command *client_command)
+{
+	if((wireVersion < 0) && hanclient_negotiate(client_command))
+		return client_command->commstatus;
+
+	if(wireVersion >= WIRE_VERSION)
+		return hanclient_wire_command(client_command);
+
+	return hanclient_legacy_command(client_command);
+}
+
+
+/*
+* Stick to the fixed size format, whatever the daemon supports
+*/
+
+void hanclient_use_legacy(void)
+{
+	wireVersion = 0;
+}
+
+
+/*
+* Mark the commands sent from now on as bulk work, which waits for the bus
+* behind interactive commands. Only takes effect if the daemon understands v2.
+*/
+
+void hanclient_use_bulk(void)
+{
+	wireFlags |= WIRE_FLAG_BULK;
+}
+
+
+/*
+* Open a session. The connection stays open, and any number of tagged
+* commands can be sent over it without waiting for each response.
+* Returns the session socket, or -1 if the daemon doesn't do sessions.
+*/
+
+int hanclient_session_open(void)
+{
+	int sock;
+	Client_Command client_command;
+
+	if(wireVersion < 0)
+		hanclient_negotiate(NULL);
+
+	/* A v2 connection is a session already */
+
+	if(wireVersion >= WIRE_VERSION)
+		return hanclient_connect();
+
+	sock = hanclient_connect();
+
+	memset(&client_command, 0, sizeof(Client_Command));
+	client_command.request = HAN_CCMD_SESSION;
+
+	if(!socket_write(sock, &client_command, sizeof(Client_Command), USER_WRITE_TIMEOUT))
+		fatal("Socket time out error, writing session request");
+
+	if(!socket_read(sock, &client_command, sizeof(Client_Command), USER_READ_TIMEOUT))
+		fatal("Socket time out error, waiting for session response");
+
+	if(client_command.commstatus != HAN_CSTS_OK){
+		debug(DEBUG_EXPECTED, "Daemon does not support sessions");
+		socket_close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+
+/*
+* Send a tagged command on a session. The response comes back with the same tag.
+*/
+
+void hanclient_session_send(int session, unsigned tag, Client_Command *client_command)
+{
+	Client_Tagged_Command tc;
+
+	if(wireVersion >= WIRE_VERSION){
+		hanclient_wire_send(session, tag, client_command);
+		return;
+	}
+
+	tc.tag = tag;
+	tc.cc = *client_command;
+
+	if(!socket_write(session, &tc, sizeof(Client_Tagged_Command), USER_WRITE_TIMEOUT))
+		fatal("Socket time out error, writing session command");
+}
+
+
+/*
+* Wait for the next response on a session. Returns its tag.
+*/
+
+unsigned hanclient_session_receive(int session, Client_Command *client_command)
+{
+	Client_Tagged_Command tc;
+
+	if(wireVersion >= WIRE_VERSION)
+		return hanclient_wire_receive(session, client_command);
+
+	if(!socket_read(session, &tc, sizeof(Client_Tagged_Command), USER_READ_TIMEOUT))
+		fatal("Socket time out error, waiting for session response");
+
+	*client_command = tc.cc;
+	return tc.tag;
+}
+
+
+/*
+* Send a command on a session and wait for its response. Only for use when
+* no other commands are outstanding on the session.
+*/
+
+int hanclient_session_command(int session, Client_Command *client_command)
+{
+	static unsigned tag = 0;
+	unsigned sent = ++tag;
+
+	hanclient_session_send(session, sent, client_command);
+	if(hanclient_session_receive(session, client_command) != sent)
+		fatal("Session response out of sequence");
+
+	return client_command->commstatus;
+}
+
+
+/*
+* Close a session
+*/
+
+void hanclient_session_close(int session)
+{
+	socket_close(session);
+}
+
+
 /*
 * Send a command to a node on a network, wait for the response, or time out
 */
@@ -156,6 +419,15 @@ void hanclient_error_check(Client_Command *client_command)
 
 		case HAN_CSTS_FORMAT_ERROR:
 			fatal("%sUnknown header format", networkErr);
+
+		case HAN_CSTS_SERIAL_DISCONNECT:
+			fatal("%sSerial port disconnected", networkErr);
+
+		case HAN_CSTS_NODE_DOWN:
+			fatal("%sNode is not answering", networkErr);
+
+		case HAN_CSTS_SCAN_CANCELED:
+			fatal("%sNetwork scan canceled", networkErr);
 			
 		case HAN_CSTS_NAK_ERROR:
 			fatal("Node returned NAK response");
@@ -26,8 +26,15 @@
 
 void hanclient_send_command(Client_Command *client_command);
 int hanclient_send_command_return_res(Client_Command *client_command);
+void hanclient_use_legacy(void);
+void hanclient_use_bulk(void);
 void hanclient_error_check(Client_Command *client_command);
 void hanclient_connect_setup(char *pidpath, char *sockfilepath, char *service, char *host);
+int hanclient_session_open(void);
+void hanclient_session_send(int session, unsigned tag, Client_Command *client_command);
+unsigned hanclient_session_receive(int session, Client_Command *client_command);
+int hanclient_session_command(int session, Client_Command *client_command);
+void hanclient_session_close(int session);
 
 
 #endif
@@ -29,6 +29,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <limits.h>
 #include <time.h>
 #include <sys/time.h>
@@ -41,10 +42,12 @@
 #include <unistd.h>
 #include <netdb.h>
 #include <fcntl.h>
-#include <sys/poll.h>
 #include <errno.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include "tnd.h"
 #include "options.h"
 #include "error.h"
@@ -53,6 +56,22 @@
 #include "socket.h"
 #include "pid.h"
 #include "han.h"
+#include "crc.h"
+#include "frame.h"
+#include "evloop.h"
+#include "wire.h"
+#include "mpscq.h"
+#include "rtt.h"
+#include "health.h"
+#include "noderec.h"
+#include "inventory.h"
+#include "sched.h"
+#include "cache.h"
+#include "tsdb.h"
+#include "sampler.h"
+#include "watch.h"
+#include "textq.h"
+#include "isub.h"
 
 
 /* Local Defines */
@@ -61,23 +80,8 @@
 
 
 
-/* Packet protocol constants */
-
-#define STX		0x02			// Denotes start of frame
-#define ETX		0x03			// Denotes end of frame
-#define SUBST		0x04			// Substitute next character
-#define HDC		0x01			// Header control bits for cmd
-#define HDCINTRQ	0x02			// Header control bits for interrupt request from node
-#define HDCINTRQ16	0x03			// Header control bits for interrupt request from node CRC16
-#define HDC16		0x05			// Header control bits for cmd CRC16
-#define	HDC_ACK		0xC1			// ACK response
-#define	HDC_ACK16	0xC5			// ACK Response CRC16
-#define HDC_NAK		0x81			// NAK response
-#define	HDC_NAK16	0x85			// NAK response CRC16
-
 #define MAX_PARAMS	MAX_NODE_PARAMS 	// Workaround: Compiler won't see MAX_NODE_PARAMS from config.h in handTransmitPacket!
 
-#define	HC_GIST		0x03			// Get interrupt status command
 
 /* Time out defines */
 
@@ -87,38 +91,107 @@
 #define MAX_INTR_RESPONSE_TIME		10000	// 10 milliseconds
 #define POLL_TIMEOUT				1000	// 1000 milliseconds
 #define SERIAL_PORT_OPEN_RETRY_TIME 20		// 20 seconds
+#define COALESCE_MAX	32			// Requests which others can share at once
+#define TEXT_LINE_MAX	256			// Longest text socket command, with its line ending
+#define TEXT_MAX_TAGGED	16			// Tagged text commands a client can have out at once
+#define SCAN_FORGET_AFTER	3			// Complete scans a node can miss before it is forgotten
 
 /* Enums */
 
-enum {RXP_WAIT_STX=0, RXP_GET_FRAME, RXP_STORE_SUBST};
-enum {CONF_STRING=1, CONF_INTEGER, CONF_UNS, CONF_MODE, CONF_UID, CONF_GID};
-enum {FD_UNUSED = 0, FD_RS485, FD_UNIX_CMD, FD_INET_CMD, FD_INET6_CMD, FD_INET_TEXT, FD_INET6_TEXT, FD_CONNECTED_TEXT};
-enum {IPS_INIT=0, IPS_RCV, IPS_IGN};
-enum {NC_INTRX=1, NC_CRC16=2};
+enum {CONF_STRING=1, CONF_INTEGER, CONF_UNS, CONF_MODE, CONF_UID, CONF_GID, CONF_CMDLIST, CONF_TTLLIST, CONF_SAMPLE, CONF_OVERFLOW};
+enum {FD_UNUSED = 0, FD_RS485, FD_UNIX_CMD, FD_INET_CMD, FD_INET6_CMD, FD_INET_TEXT, FD_INET6_TEXT, FD_CONNECTED_TEXT, FD_CONNECTED_CMD};
+enum {CMD_SNIFF = 0, CMD_LEGACY, CMD_SESSION, CMD_V2};
+enum {BUS_COMMAND = 0, BUS_TEXT, BUS_INTERRUPT, BUS_PROGRESS, BUS_SAMPLE, BUS_WATCH, BUS_QUIT};
+enum {SCAN_IDLE = 0, SCAN_RUNNING, SCAN_DONE};
+enum {TEXT_DROP_OLDEST = 0, TEXT_DISCONNECT};
 
 
 /* Typedefs */
 
 typedef uint8_t bool;
+typedef struct rx_frame Rx_Frame;
+typedef struct sock_entry Sock_Entry;
+typedef struct bus_req Bus_Req;
+
+/* Structs */
+
+/* Last frame handed over by the serial port frame decoder */
+
+struct rx_frame {
+	bool ready;
+	int len;
+	uint8_t buf[FRAME_MAX_LEN];
+};
+
+/* A listening, text or command socket watched by the event loop */
+
+struct sock_entry {
+	Ev_Handler h;
+	int type;				// FD_xxx
+	unsigned busy;				// Requests out with the bus thread
+
+	/* Text sockets */
+	Textq tq;				// Lines waiting to be written
+	char line[TEXT_LINE_MAX];		// Commands read, but not yet carried out
+	unsigned line_start;			// Start of the first of them
+	unsigned line_len;			// Bytes in line
+	uint8_t line_skip;			// Throwing away a line which was too long
+	uint8_t awaiting;			// An untagged command is out, so reading waits for it
+
+	/* Command sockets */
+	Ev_Timer deadline;			// Closes the connection if the client stalls
+	uint8_t mode;				// CMD_xxx, set from the first bytes the client sends
+	uint8_t closing;			// Close once the responses are written
+	unsigned in_done;			// Bytes of the request read so far
+	Client_Tagged_Command *in;		// Request being read, or decoded from wire_in
+	uint8_t *wire_in;			// v2 message being read
+	uint8_t *out;				// Responses waiting to be written
+	unsigned out_done;
+	unsigned out_len;
+	unsigned out_size;
+
+	Sock_Entry *prev;
+	Sock_Entry *next;
+};
+
+/*
+* A transaction for the bus thread. The same block comes back to the
+* network loop with the results once the bus thread is done with it.
+*/
+
+struct bus_req {
+	Mpscq_Node node;			// Must be first
+	int type;				// BUS_xxx
+	Sock_Entry *se;				// Connection to answer, NULL if none
+	uint32_t tag;				// Tag of the request on a session, v2 or text connection
+	uint8_t tagged;				// Text requests: the reply is to carry the tag
+	unsigned prio;				// HAN_PRIO_xxx
+	Sched_Item item;			// Place in the bus thread's queues
+	Bus_Req *next;				// Next request waiting on the network scan, or sharing this one
+	Client_Command cc;
+};
 
 /* Local prototypes. */
 
-static uint8_t calcCRC(void *buf, int len);
-static uint16_t calcCRC16(void *buf, int len);
 static int packetCheck16(void *buf, int size);
-static void stuffPacketByte(uint8_t value, uint8_t **buffer, uint16_t *count);
-static int handTransmitPacket(hanioStuff *hanio, Han_Packet *packet, int rx_timeout);
+static int handTransmitPacket(hanioStuff *hanio, Han_Packet *packet, int rx_timeout, unsigned *rtt);
+static void node_error(unsigned addr, int status);
 static int handSend(hanioStuff *hanio, Han_Packet *packet);
-static int handScanNetwork(hanioStuff *hanio, Han_Netscan *netscan);
+static int handScanNode(hanioStuff *hanio, unsigned addr, Han_Netscan *netscan);
+static void handProbeNode(hanioStuff *hanio, unsigned addr);
 static int handDoPPower(char *command_string);
 static int handDoRawPacket(struct han_raw *rp);
 static int fd_setup(void);
 static void handReconfig(void);
-static void clientCommand(hanioStuff *hanio, Client_Command *client_command);
+static void clientCommand(Client_Command *client_command);
 static int confSaveString(char *value, short handling, void *result);
 static int confSaveMode(char *value, short handling, void *result);
 static int confSaveUidGid(char *value, short handling, void *result);
 static int confSaveUnsigned(char *value, short handling, void *result);
+static int confSaveCmdList(char *value, short handling, void *result);
+static int confSaveTtlList(char *value, short handling, void *result);
+static int confSaveSample(char *value, short handling, void *result);
+static int confSaveOverflow(char *value, short handling, void *result);
 static void hand_handle_child(int sig);
 static void hand_handle_brkpipe(int sig);
 static void hand_handle_hup(int sig);
@@ -126,9 +199,24 @@ static void handle_exit_request(int sig);
 static void hand_show_help(void);
 static void hand_show_version(void);
 static void hand_exit(void);
-static int processClientCommand(int user_socket);
-static void process_interrupt_packet(uint8_t *buffer, int len);
+static void add_cmd_socket(int user_socket);
+static void process_interrupt_packet(uint8_t *buffer, int len, uint64_t seen);
 static void send_broadcast_enum(void);
+static void handle_listen_socket(Ev_Handler *h, uint32_t events);
+static void handle_text_socket(Ev_Handler *h, uint32_t events);
+static void text_input(Sock_Entry *se);
+static void handle_cmd_socket(Ev_Handler *h, uint32_t events);
+static void handle_bus_completions(Ev_Handler *h, uint32_t events);
+static void handResetReceiver(void);
+static void close_serial_port(void);
+static int bus_start(void);
+static void bus_warm_start(void);
+static void bus_stop(void);
+static void bus_submit(Bus_Req *r, Sock_Entry *se);
+static int bus_sample(unsigned series, const Han_Packet *pkt);
+static int bus_watch(unsigned target, const Han_Packet *pkt);
+static int notify_watcher(void *owner, uint32_t tag, const Han_Watch_Entry *ev);
+static void bus_post(Bus_Req *r);
 
 /* Global things. */
 
@@ -140,8 +228,6 @@ int debuglvl = 0;
 char *progname;
 
 
-/* The number of active poll fd's we have open in the pollfd structure. */
-
 /* Locals. */
 
 
@@ -177,6 +263,7 @@ static char conf_pid_path[MAX_CONFIG_STRING] = CONF_PID_PATH;
 static char conf_log_path[MAX_CONFIG_STRING] = CONF_LOG_PATH;
 static char conf_ppower_path[MAX_CONFIG_STRING] = "";
 static char conf_daemon_socket_path[MAX_CONFIG_STRING] = "";
+static char conf_inventory_path[MAX_CONFIG_STRING] = "";
 static char conf_service[MAX_CONFIG_STRING] = "";
 static char conf_textservice[MAX_CONFIG_STRING] = "";
 static char conf_bindaddr[MAX_CONFIG_STRING];
@@ -185,8 +272,23 @@ static int conf_daemon_socket_gid = 0;
 static int conf_daemon_socket_mode = 0660;
 static unsigned conf_max_retries = CONF_MAX_RETRIES;	// Maximum number of retries
 static unsigned max_node_addr = MAX_NODE_ADDR;		// Maximum node address
-static uint8_t node_attributes[256];				// Node attribute array
-static uint8_t serial_port_open_timer = 0;
+static unsigned conf_min_response_time = RTT_DEF_FLOOR / 1000;	// Response timeout limits, msec
+static unsigned conf_max_response_time = RTT_DEF_CEILING / 1000;
+static unsigned conf_down_after = CONF_DOWN_AFTER;		// Timeouts in a row which take a node down
+static unsigned conf_probe_interval = CONF_PROBE_INTERVAL;	// Seconds between checks on down nodes
+static unsigned conf_max_queue_wait = SCHED_DEF_MAX_WAIT;	// Msec before a request goes ahead of everything
+static uint8_t conf_coalesce[32];				// Bitmap of the node commands which may be shared
+static unsigned conf_cache_ttl[256];				// Msec to cache responses for, by node command
+static Sampler_Def conf_poll_series[SAMPLER_MAX_SERIES];	// Node commands to sample
+static unsigned conf_poll_count = 0;
+static unsigned conf_poll_history = SAMPLER_DEF_HISTORY;	// Samples kept of each
+static char conf_store_dir[MAX_CONFIG_STRING] = "";		// Where sampled values are stored
+static unsigned conf_store_interval = TSDB_DEF_SLOT;		// Secs per stored value
+static unsigned conf_store_days = TSDB_DEF_DAYS;		// Days of them kept
+static unsigned conf_text_queue = TEXTQ_DEF_LEN;		// Event lines a text socket may have waiting
+static unsigned conf_text_overflow = TEXT_DROP_OLDEST;	// What to do when there are more, TEXT_xxx
+static Frame_Decoder rx_decoder;				// Serial port frame decoder
+static Rx_Frame rx_frame;					// Frame from the decoder
 
 
 
@@ -194,16 +296,39 @@ static uint8_t serial_port_open_timer = 0;
 
 /* Sockets vars used by the daemon. */
 
-static short num_poll_fds = 0;		// Number of active poll fd's
-struct pollfd pollfd[POLL_MAX_COUNT];
-int fdtype[POLL_MAX_COUNT];
-char intreportingena[POLL_MAX_COUNT];
+static Sock_Entry *sockets = NULL;		// Listening and text sockets
+static Sock_Entry *closed_sockets = NULL;	// Closed this wakeup, freed once it's dispatched
+static unsigned num_cmd_listeners = 0;
+static unsigned num_text_sockets = 0;
+static Han_Textstats text_stats;		// Text socket output counters
+
+/* Bus thread. It owns the serial port, and everything above which goes with it. */
+
+static pthread_t bus_tid;
+static uint8_t bus_running = FALSE;
+static Mpscq bus_requests;			// Network loop to bus thread
+static Mpscq bus_completions;			// Bus thread to network loop
+static int bus_request_fd = -1;			// eventfd which wakes the bus thread
+static Ev_Handler bus_completion_handler;	// eventfd which wakes the network loop
+static uint64_t bus_reopen_at;			// When to try the serial port again
+
+/* Network scan, run by the bus thread an address at a time between other requests */
+
+static uint8_t scan_state = SCAN_IDLE;		// SCAN_xxx
+static unsigned scan_next;			// Next address to probe
+static Han_Netscan scan_result;			// Nodes found so far, or by the last scan
+static Bus_Req *scan_waiting = NULL;		// Requests to answer when the scan ends
+static uint8_t scan_missed[256];		// Complete scans in a row a known node has missed
+
+/* Waiting requests which others asking for the same thing can share */
+
+static Bus_Req *coalesce_leaders[COALESCE_MAX];
 
 /* Text Commands */
 
-#define NUM_TEXT_CMDS 3
-char *text_commands[NUM_TEXT_CMDS] = {"CA","IE","ID"};
-enum {TC_CA, TC_IE, TC_ID};
+#define NUM_TEXT_CMDS 5
+char *text_commands[NUM_TEXT_CMDS] = {"CA","IE","ID","WA","WC"};
+enum {TC_CA, TC_IE, TC_ID, TC_WA, TC_WC};
 	
 
 /* Commandline options. */
@@ -221,7 +346,7 @@ static struct option long_options[] = {
  
 /* Error Statistics */
 
-Err_Stats error_stats = {0,0,0,0,0};
+Err_Stats error_stats = {0,0,0,0,0,0,0,0,0};
 
 /* Configuration option tables */
 
@@ -244,13 +369,38 @@ Key_Entry	hand_keys[] = {
 	{"retries", CONF_UNS, &conf_max_retries, confSaveUnsigned},
 	{"ppower_path",CONF_STRING, conf_ppower_path, confSaveString},
 	{"max_node_addr",CONF_UNS, &max_node_addr, confSaveUnsigned},
+	{"min_response_time", CONF_UNS, &conf_min_response_time, confSaveUnsigned},
+	{"max_response_time", CONF_UNS, &conf_max_response_time, confSaveUnsigned},
+	{"down_after", CONF_UNS, &conf_down_after, confSaveUnsigned},
+	{"probe_interval", CONF_UNS, &conf_probe_interval, confSaveUnsigned},
+	{"inventory_file", CONF_STRING, conf_inventory_path, confSaveString},
+	{"max_queue_wait", CONF_UNS, &conf_max_queue_wait, confSaveUnsigned},
+	{"coalesce", CONF_CMDLIST, conf_coalesce, confSaveCmdList},
 	{"log_path", CONF_STRING, conf_log_path, confSaveString},
+	{"text_queue", CONF_UNS, &conf_text_queue, confSaveUnsigned},
+	{"text_overflow", CONF_OVERFLOW, &conf_text_overflow, confSaveOverflow},
+	{NULL, 0, NULL, NULL}
+};
+
+Key_Entry	cache_keys[] = {
+	{"ttl", CONF_TTLLIST, conf_cache_ttl, confSaveTtlList},
+	{NULL, 0, NULL, NULL}
+};
+
+Key_Entry	poll_keys[] = {
+	{"sample", CONF_SAMPLE, conf_poll_series, confSaveSample},
+	{"history", CONF_UNS, &conf_poll_history, confSaveUnsigned},
+	{"store_dir", CONF_STRING, conf_store_dir, confSaveString},
+	{"store_interval", CONF_UNS, &conf_store_interval, confSaveUnsigned},
+	{"store_days", CONF_UNS, &conf_store_days, confSaveUnsigned},
 	{NULL, 0, NULL, NULL}
 };
 
 Section_Entry	conf_section[] = {
 	{"global", global_keys},
 	{"hand", hand_keys},
+	{"cache", cache_keys},
+	{"poll", poll_keys},
 	{NULL, NULL}
 };
 
@@ -329,6 +479,145 @@ static int confSaveUnsigned(char *value, short handling, void *result){
 	return PASS;
 }
 
+/*
+* Save what to do with a text socket which falls too far behind: drop its
+* oldest events, or disconnect it
+*/
+
+static int confSaveOverflow(char *value, short handling, void *result){
+	unsigned *dest = (unsigned *) result;
+
+	if(!strcmp(value, "drop"))
+		*dest = TEXT_DROP_OLDEST;
+	else if(!strcmp(value, "disconnect"))
+		*dest = TEXT_DISCONNECT;
+	else{
+		debug(DEBUG_UNEXPECTED, "Bad text_overflow, must be drop or disconnect: %s", value);
+		return FAIL;
+	}
+	debug(DEBUG_STATUS,"set text_overflow: %s", value);
+	return PASS;
+}
+
+/*
+* Save a list of node commands in hex, separated by commas, as a bitmap
+*/
+
+static int confSaveCmdList(char *value, short handling, void *result){
+	uint8_t *dest = (uint8_t *) result;
+	char *p, *end;
+	unsigned long cmd;
+
+	memset(dest, 0, 32);
+	for(p = value; *p; p = end){
+		while(*p == ',')
+			p++;
+		if(!*p)
+			break;
+		cmd = strtoul(p, &end, 16);
+		if((end == p) || (cmd > 0xFF)){
+			debug(DEBUG_UNEXPECTED, "Bad node command in list: %s", p);
+			return FAIL;
+		}
+		dest[cmd >> 3] |= 1 << (cmd & 7);
+		debug(DEBUG_STATUS,"set command in list: 0x%02lX", cmd);
+	}
+	return PASS;
+}
+
+/*
+* Save a list of node commands in hex, each with a time in msec after a
+* colon, separated by commas, as a table of times by command
+*/
+
+static int confSaveTtlList(char *value, short handling, void *result){
+	unsigned *dest = (unsigned *) result;
+	char *p, *end;
+	unsigned long cmd, ttl;
+
+	memset(dest, 0, 256 * sizeof(unsigned));
+	for(p = value; *p; p = end){
+		while(*p == ',')
+			p++;
+		if(!*p)
+			break;
+		cmd = strtoul(p, &end, 16);
+		if((end == p) || (cmd > 0xFF) || (*end != ':')){
+			debug(DEBUG_UNEXPECTED, "Bad node command in list: %s", p);
+			return FAIL;
+		}
+		p = end + 1;
+		ttl = strtoul(p, &end, 10);
+		if((end == p) || (ttl > UINT32_MAX)){
+			debug(DEBUG_UNEXPECTED, "Bad time in list: %s", p);
+			return FAIL;
+		}
+		dest[cmd] = (unsigned) ttl;
+		debug(DEBUG_STATUS,"set time for command 0x%02lX: %lu", cmd, ttl);
+	}
+	return PASS;
+}
+
+/*
+* Save a node command to sample, as the node address, command, parameter
+* bytes and interval in msec, separated by colons. All but the interval are
+* in hex, and there may be no parameter bytes. A value from the response
+* to store on disk may follow after another colon, as its byte offset and
+* a B, I or U for its type. Each one adds to the list.
+*/
+
+static int confSaveSample(char *value, short handling, void *result){
+	Sampler_Def *dest = (Sampler_Def *) result;
+	Sampler_Def sd;
+	unsigned long addr, cmd = 0, interval = 0, offset;
+	unsigned byte;
+	char *p, *end;
+	int ok;
+
+	if(conf_poll_count == SAMPLER_MAX_SERIES){
+		debug(DEBUG_UNEXPECTED, "Too many samples, only %d allowed", SAMPLER_MAX_SERIES);
+		return FAIL;
+	}
+	memset(&sd, 0, sizeof(Sampler_Def));
+
+	addr = strtoul(value, &end, 16);
+	ok = (end != value) && (*end == ':') && (addr < 0xFF);
+	if(ok){
+		p = end + 1;
+		cmd = strtoul(p, &end, 16);
+		ok = (end != p) && (*end == ':') && (cmd <= 0xFF);
+	}
+	for(p = end + 1; ok && (*p != ':'); p += 2){
+		if((sd.nparams == MAX_NODE_PARAMS) || !p[0] || !p[1] || (p[1] == ':') || (sscanf(p, "%2x", &byte) != 1))
+			ok = FALSE;
+		else
+			sd.params[sd.nparams++] = (uint8_t) byte;
+	}
+	if(ok){
+		p++;
+		interval = strtoul(p, &end, 10);
+		ok = (end != p) && (!*end || (*end == ':')) && (interval <= UINT32_MAX);
+	}
+	if(ok && *end){
+		p = end + 1;
+		offset = strtoul(p, &end, 10);
+		ok = (end != p) && (offset < MAX_NODE_PARAMS) && *end && strchr("BIU", *end) && !end[1];
+		sd.offset = (uint8_t) offset;
+		sd.type = (uint8_t) *end;
+	}
+	if(!ok){
+		debug(DEBUG_UNEXPECTED, "Bad sample: %s", value);
+		return FAIL;
+	}
+
+	sd.addr = (uint8_t) addr;
+	sd.cmd = (uint8_t) cmd;
+	sd.interval = (unsigned) interval;
+	dest[conf_poll_count++] = sd;
+	debug(DEBUG_STATUS,"set sample of node 0x%02lX command 0x%02lX every %lu msec", addr, cmd, interval);
+	return PASS;
+}
+
 /*
 * Figure out the offset to the address field and return a pointer to it.
 */
@@ -346,19 +635,111 @@ static void *munge_ip_address(void *p)
 
 
 /*
-* Add an fd to the poll list
+* Add a socket to the event loop
 */
 
-static int add_poll_fd(int sock, int type)
+static int add_socket(int sock, int type)
 {
-	if(num_poll_fds < POLL_MAX_COUNT){
-		pollfd[num_poll_fds].fd = sock;
-		fdtype[num_poll_fds] = type;
-		pollfd[num_poll_fds++].events = POLLIN;
-		return PASS;
+	Sock_Entry *se;
+
+	if((se = calloc(1, sizeof(Sock_Entry))) == NULL){
+		debug(DEBUG_UNEXPECTED, "Out of memory adding socket");
+		return FAIL;
 	}
-	return FAIL;
-	
+	se->type = type;
+	se->deadline.index = -1;
+	if((type == FD_CONNECTED_TEXT) && textq_init(&se->tq, conf_text_queue + TEXTQ_REPLY_ROOM + TEXT_MAX_TAGGED)){
+		free(se);
+		return FAIL;
+	}
+	if(evloop_add(&se->h, sock, EPOLLIN, type == FD_CONNECTED_TEXT ? handle_text_socket :
+		type == FD_CONNECTED_CMD ? handle_cmd_socket : handle_listen_socket, se)){
+		textq_free(&se->tq);
+		free(se);
+		return FAIL;
+	}
+
+	se->next = sockets;
+	if(sockets)
+		sockets->prev = se;
+	sockets = se;
+
+	if(type == FD_CONNECTED_TEXT)
+		num_text_sockets++;
+	else if((type == FD_UNIX_CMD) || (type == FD_INET_CMD) || (type == FD_INET6_CMD))
+		num_cmd_listeners++;
+	return PASS;
+}
+
+
+/*
+* Take a socket out of the event loop and close it. The entry is freed
+* once the events from the current wakeup have all been dispatched.
+*/
+
+static void close_socket(Sock_Entry *se)
+{
+	watch_drop(se);
+	isub_drop(se);
+	evloop_remove(&se->h);
+	evloop_timer_stop(&se->deadline);
+	if(close(se->h.fd) < 0)
+		debug(DEBUG_UNEXPECTED, "Close error on socket: %s", strerror(errno));
+
+	if(se->prev)
+		se->prev->next = se->next;
+	else
+		sockets = se->next;
+	if(se->next)
+		se->next->prev = se->prev;
+
+	if(se->type == FD_CONNECTED_TEXT)
+		num_text_sockets--;
+	else if((se->type == FD_UNIX_CMD) || (se->type == FD_INET_CMD) || (se->type == FD_INET6_CMD))
+		num_cmd_listeners--;
+
+	se->prev = NULL;
+	se->next = closed_sockets;
+	closed_sockets = se;
+}
+
+
+/*
+* Free the sockets closed during the last wakeup. One with requests still
+* out with the bus thread is kept until they come back.
+*/
+
+static void free_closed_sockets(void)
+{
+	Sock_Entry *se, **pp = &closed_sockets;
+
+	while((se = *pp) != NULL){
+		if(se->busy){
+			pp = &se->next;
+			continue;
+		}
+		*pp = se->next;
+		free(se->in);
+		free(se->wire_in);
+		free(se->out);
+		textq_free(&se->tq);
+		free(se);
+	}
+}
+
+
+/*
+* Add a listening socket. Listening sockets are non-blocking so that
+* every pending connection can be accepted on each wakeup.
+*/
+
+static int add_listen_socket(int sock, int type)
+{
+	if(fcntl(sock, F_SETFL, O_NONBLOCK) == -1){
+		debug(DEBUG_UNEXPECTED, "Could not set listening socket to non-blocking: %s", strerror(errno));
+		return FAIL;
+	}
+	return add_socket(sock, type);
 }
 
 
@@ -378,7 +759,7 @@ static int add_ip_socket_cmd(int sock, void *addr, int family, int socktype)
 		debug(DEBUG_EXPECTED, "Command Socket listen ip address: %s", addrstr);
 	}
 
-	return add_poll_fd(sock, (family == AF_INET) ? FD_INET_CMD : FD_INET6_CMD);
+	return add_listen_socket(sock, (family == AF_INET) ? FD_INET_CMD : FD_INET6_CMD);
 
 }
 
@@ -397,61 +778,142 @@ static int add_ip_socket_text(int sock, void *addr, int family, int socktype)
 		debug(DEBUG_EXPECTED, "Monitor Socket listen ip address: %s", addrstr);
 	}
 
-	return add_poll_fd(sock, (family == AF_INET) ? FD_INET_TEXT : FD_INET6_TEXT);
+	return add_listen_socket(sock, (family == AF_INET) ? FD_INET_TEXT : FD_INET6_TEXT);
 
 }
 
 /*
-* Add text socket to the polling list if there is room
+* Add a connected text socket to the event loop
 */
 
 static int add_text_socket(int text_socket)
 {
-	if(!add_poll_fd(text_socket, FD_CONNECTED_TEXT)){
-		debug(DEBUG_EXPECTED, "Added text socket to polling list");
+	/* Lines are written as the socket will take them, so it mustn't block */
+
+	if(fcntl(text_socket, F_SETFL, O_NONBLOCK) == -1){
+		debug(DEBUG_UNEXPECTED, "Could not make text socket non-blocking: %s", strerror(errno));
+		return FAIL;
 	}
-	else{
-		debug(DEBUG_UNEXPECTED, "Text socket list is full");
+	if(add_socket(text_socket, FD_CONNECTED_TEXT)){
+		debug(DEBUG_UNEXPECTED, "Could not add text socket");
 		return FAIL;
 	}
+	debug(DEBUG_EXPECTED, "Added text socket, %u text sockets open", num_text_sockets);
 	return PASS;
 }
 
 /*
-* Print a message to all active text sockets
+* Return TRUE if a text socket's next command can be carried out. Not while
+* an untagged command, or too many tagged ones, are out with the bus
+* thread, or while the client is behind reading the replies.
 */
 
-static void ts_printf(char *msg, ...)
+static int text_ready(Sock_Entry *se)
 {
-	va_list ap;
-	int i;
-	
-	va_start(ap, msg);
+	return !se->awaiting && (se->busy < TEXT_MAX_TAGGED) && (se->tq.count < conf_text_queue);
+}
+
 
-	/* print the message */
+/*
+* Write what a text socket has waiting, then decide what to wait for next.
+* Commands aren't read while one is out with the bus thread, or while the
+* client is behind reading the replies.
+*/
 
-	for(i = 0 ; i < num_poll_fds; i++){
-		if((fdtype[i] != FD_CONNECTED_TEXT) || (!intreportingena[i]))
-			continue;			
-		vdprintf(pollfd[i].fd, msg, ap);
+static void text_socket_update(Sock_Entry *se)
+{
+	if(!se->h.active)
+		return;
+	if(textq_flush(&se->tq, se->h.fd)){
+		close_socket(se);
+		return;
 	}
-	va_end(ap);
+	evloop_modify(&se->h, (text_ready(se) ? EPOLLIN : 0) |
+		(se->tq.count ? EPOLLOUT : 0));
+}
+
+
+/*
+* Queue a line for a text socket
+*/
+
+static int text_push(Sock_Entry *se, Textq_Msg *m)
+{
+	if(textq_push(&se->tq, m))
+		return FAIL;
+	if(se->tq.count > text_stats.maxqueued)
+		text_stats.maxqueued = se->tq.count;
+	return PASS;
 }
 
 
+/*
+* Send a reply to a text socket, with the tag of the command in front if
+* it was tagged. Replies are never dropped.
+*/
 
+static void text_reply(Sock_Entry *se, int tagged, uint32_t tag, char *fmt, ...)
+{
+	Textq_Msg *m;
+	va_list ap;
+	char line[128];
 
-/* Initialization of file handles  */
+	va_start(ap, fmt);
+	if(tagged){
+		vsnprintf(line, sizeof(line), fmt, ap);
+		m = textq_msg(FALSE, "#%u %s", tag, line);
+	}
+	else
+		m = textq_vmsg(FALSE, fmt, ap);
+	va_end(ap);
+	if(!m || text_push(se, m)){
+		debug(DEBUG_UNEXPECTED, "Could not queue a text socket reply");
+		close_socket(se);
+	}
+	else
+		text_socket_update(se);
+	textq_release(m);
+}
 
 
-static int fd_setup(void){
+/*
+* Queue an interrupt report for a text socket which subscribed to it. The
+* report is formatted once, and shared by the queues of every subscriber. A
+* socket with too many lines waiting loses its oldest event, or is
+* disconnected, as the config file says.
+*/
 
-	int s;
+static void text_event(void *owner, void *ctx)
+{
+	Sock_Entry *se = owner;
+	Textq_Msg *m = ctx;
+
+	if(se->tq.count >= conf_text_queue){
+		if(conf_text_overflow == TEXT_DISCONNECT){
+			debug(DEBUG_UNEXPECTED, "Disconnecting a text socket which isn't keeping up");
+			text_stats.disconnects++;
+			close_socket(se);
+			return;
+		}
+		text_stats.dropped++;
+		if(textq_drop_oldest(&se->tq))
+			return;
+	}
+	if(text_push(se, m) == PASS){
+		text_stats.events++;
+		text_socket_update(se);
+	}
+}
 
-	num_poll_fds = 0;
 
 
-	/* Open the han RS-485 interface. */
+
+/*
+* Open the han RS-485 interface
+*/
+
+static int serial_open(void)
+{
 	debug(DEBUG_STATUS, "Opening tty %s", conf_tty);
 
 	if(!(hanio = hanio_open(conf_tty))){
@@ -460,10 +922,26 @@ static int fd_setup(void){
 	}
 	if(hanio_flush_input(hanio)){
 		debug(DEBUG_UNEXPECTED, "Could not flush serial input buffer");
+		close_serial_port();
 		return -1;
 	}
-	
-	add_poll_fd(hanio->fd, FD_RS485);
+	handResetReceiver();
+	return 0;
+}
+
+
+/* Initialization of file handles  */
+
+
+static int fd_setup(void){
+
+	int s;
+
+
+	/* Open the han RS-485 interface. */
+
+	if(serial_open())
+		return -1;
 
 
 	if(conf_daemon_socket_path[0]){
@@ -474,11 +952,14 @@ static int fd_setup(void){
 		/* Create the unix domain daemon socket used for commands */
 
 		debug(DEBUG_STATUS, "Creating unix domain socket '%s'", conf_daemon_socket_path);
-		if((s = socket_create(conf_daemon_socket_path, conf_daemon_socket_mode, conf_daemon_socket_uid, conf_daemon_socket_gid) == -1)){
+		if((s = socket_create(conf_daemon_socket_path, conf_daemon_socket_mode, conf_daemon_socket_uid, conf_daemon_socket_gid)) == -1){
 			debug(DEBUG_UNEXPECTED, "Could not create unix socket");
 			return -1;
 		}
-		add_poll_fd(s, FD_UNIX_CMD);
+		if(add_listen_socket(s, FD_UNIX_CMD)){
+			close(s);
+			return -1;
+		}
 	}
 
 	/* Create the ipv4/ipv6 socket if a command service port is defined */
@@ -495,7 +976,7 @@ static int fd_setup(void){
 
 	/* If no socket connection type defined, we can't do anything. Might as well quit now */
 
-	if(num_poll_fds < 2){
+	if(!num_cmd_listeners){
 		debug(DEBUG_UNEXPECTED, "No command socket: (ipv4, ipv6, or unix domain) defined in config file");
 		return -1;
 	}
@@ -514,14 +995,67 @@ static int fd_setup(void){
 }
 
 /*
-* Close all polled sockets
+* Close all listening, text and command sockets
 */
 
-void close_all_polled_sockets(void)
+void close_all_sockets(void)
 {
-	int i;
-	for(i = 1; i < num_poll_fds; i++)
-		close(pollfd[i].fd);
+	while(sockets)
+		close_socket(sockets);
+}
+
+
+/*
+* Add to one of the error statistics. The bus thread counts, and the
+* network loop reads them for NETSTATS without stopping it.
+*/
+
+static void stats_add(unsigned *counter, unsigned n)
+{
+	__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+
+/*
+* Move the serial port's I/O counts into the error statistics
+*/
+
+static void fold_io_stats(void)
+{
+	if(!hanio)
+		return;
+	stats_add(&error_stats.rx_syscalls, hanio->rx_syscalls);
+	stats_add(&error_stats.rx_bytes, hanio->rx_bytes);
+	stats_add(&error_stats.tx_syscalls, hanio->tx_syscalls);
+	stats_add(&error_stats.tx_bytes, hanio->tx_bytes);
+	hanio->rx_syscalls = hanio->rx_bytes = hanio->tx_syscalls = hanio->tx_bytes = 0;
+}
+
+
+/*
+* Close the serial port, keeping its I/O counts in the error statistics
+*/
+
+static void close_serial_port(void)
+{
+	if(!hanio)
+		return;
+	fold_io_stats();
+	hanio_close(hanio);
+	hanio = NULL;
+}
+
+
+/*
+* The serial port went away. Close it, and have the bus thread try to open
+* it again later. Requests which come in meanwhile fail straight away.
+*/
+
+static void serial_port_lost(void)
+{
+	debug(DEBUG_UNEXPECTED, "Serial port lost. Closing it to re-open later");
+	close_serial_port();
+	bus_reopen_at = evloop_now() + SERIAL_PORT_OPEN_RETRY_TIME * 1000;
 }
 
 
@@ -533,13 +1067,14 @@ void hand_exit(void)
 	debug(DEBUG_STATUS, "Cleaning up for exit.");
 
 
-	/* Close the existing TTY */
+	/* Stop the bus thread, and close the existing TTY */
 
-	hanio_close(hanio);
+	bus_stop();
+	close_serial_port();
 
-	/* Close polled sockets. */
+	/* Close the sockets. */
 
-	close_all_polled_sockets();
+	close_all_sockets();
 
 
 	/* Unlink the two filesystem-bound sockets if they exist. */
@@ -555,7 +1090,6 @@ void hand_exit(void)
 /* Re-read the config file, and re-initialize the daemon */
 
 static void handReconfig(void){
-	int i;
 
 	reconfigRequest = 0;
 
@@ -566,18 +1100,14 @@ static void handReconfig(void){
 	if((debuglvl) && (no_background == 0))
 		error_logpath(conf_log_path);
 
-	/* Close the existing TTY */
-
-	hanio_close(hanio);
-
-	/* Close polled sockets. */
+	/* Stop the bus thread, and close the existing TTY */
 
-	close_all_polled_sockets();
+	bus_stop();
+	close_serial_port();
 
-	/* Turn off interrupt monitoring */
+	/* Close the sockets, which also turns off interrupt monitoring */
 
-	for(i = 0; i < POLL_MAX_COUNT; i++)
-		intreportingena[i] = 0;
+	close_all_sockets();
 
 	/* Unlink the pid file */
 
@@ -587,6 +1117,7 @@ static void handReconfig(void){
 
 	debug(DEBUG_STATUS,"Re-reading configuration file");
 
+	conf_poll_count = 0;
 	confscan(conf_file, conf_section);
 
 	/* Create the PID file */
@@ -598,76 +1129,28 @@ static void handReconfig(void){
 	if(fd_setup())
 		fatal("fd_setup() failed during reconfig");
 
-}
-
+	if(bus_start())
+		fatal("Could not restart the bus thread");
 
-/*
-* Calculate an 8 bit CRC of polynomial X^8+X^5+X^4+1
-*/
-
-static uint8_t calcCRC(void *buf, int len){
-	uint8_t theBits, fb, crcReg = 0;
-	uint8_t *p = (uint8_t *) buf;
-	uint16_t i, j;
-	
-	if(!len)
-		return FAIL;
-	
-	for(i = 0 ; i < len ; i++)
-	{
-		theBits = *p++;
-		for(j = 0 ; j < 8 ; j++)
-		{
-			fb = (theBits ^ crcReg) & 1;
-			crcReg >>= 1;
-			if(fb)
-				crcReg ^= 0x8C;
-			theBits >>= 1;
-		}
-	}
-	return crcReg;
 }
 
 
-/* Calculate CRC over buffer using polynomial: X^16 + X^12 + X^5 + 1 */
-
-static uint16_t calcCRC16(void *buf, int len)
-{
-	uint8_t i;
-	uint16_t crc = 0;
-	uint8_t *b = (uint8_t *) buf;
-	
-	if(!len)
-		return FAIL;
-
-	while(len--){
-		crc ^= (((uint16_t) *b++) << 8);
-		for ( i = 0 ; i < 8 ; ++i ){
-			if (crc & 0x8000)
-				crc = (crc << 1) ^ 0x1021;
-			else
-				crc <<= 1;
-          	}
-	}
-	return crc;
-}
-
 /* Check a CRC16 on a packet buffer */
 
 static int packetCheck16(void *buf, int size)
 {
-	uint16_t	rcrc16, crc16;
+	uint16_t	rcrc16, ccrc16;
 	
-	if(!size)
-		return FAIL; /* Zero length is bad */
+	if(size <= sizeof(uint16_t))
+		return FAIL; /* Too short to hold a CRC16 and something to check */
 	
-	crc16 =  calcCRC16(buf, size - sizeof(uint16_t));
+	ccrc16 =  crc16(buf, size - sizeof(uint16_t));
 
 	rcrc16 = *((uint16_t *)(((uint8_t *) buf) + (size - sizeof(uint16_t))));
 
-	debug(DEBUG_ACTION, "Rx CRC16: 0x%04X, Calc CRC16 0x%04X", rcrc16, crc16);
+	debug(DEBUG_ACTION, "Rx CRC16: 0x%04X, Calc CRC16 0x%04X", rcrc16, ccrc16);
 
-	if(crc16 == rcrc16)
+	if(ccrc16 == rcrc16)
 		return PASS;
 	else
 		return FAIL;
@@ -677,53 +1160,52 @@ static int packetCheck16(void *buf, int size)
 
 
 /*
-* Stuff a packet byte in the buffer, performing any necessary substitutions
+* Frame decoder callback. Keep the frame, and stop the decoder so the
+* caller can deal with it before any more bytes are looked at.
 */
 
-static void stuffPacketByte(uint8_t value, uint8_t **buffer, uint16_t *count){
+static int handFrameReceived(void *ctx, uint8_t *frame, int len)
+{
+	Rx_Frame *rf = (Rx_Frame *) ctx;
 
-	if(value <= SUBST){
-		**buffer = SUBST;
-		(*buffer)++;
-		(*count)++;
-	}
-	
-	**buffer = value;
-	(*buffer)++;
-	(*count)++;
+	memcpy(rf->buf, frame, len);
+	rf->len = len;
+	rf->ready = TRUE;
+	return 1;
+}
+
+
+/*
+* Throw away any partially received frame and the last frame received.
+*/
+
+static void handResetReceiver(void)
+{
+	frame_decoder_reset(&rx_decoder);
+	rx_frame.ready = FALSE;
 }
 
+
 /*
  * Poll for a response.
- * Setting init true and count to point to a int, initializes the receiver
- * Setting init false, count to point to an int, and buffer to point to a buffer processes incoming characters
  * 
- * Once a packet is received, 1 will be returned.
+ * Once a frame is received, 1 will be returned and the frame will be in rx_frame.
  * If the serial port is closed due to a disconnect, then a -1 will be returned
- * If a packet has not been completely received, a 0 will be returned
- * Init will always return a 0.
+ * If a frame has not been completely received, a 0 will be returned
  */
  
-static int handPollForResponse(bool init, uint8_t *buffer, int *count)
+static int handPollForResponse(void)
 {
-	int retval;
-	char c;
-	static int packet_state;
-	static char subst, done;
-	
-	
-	if(count && init){ /* Reset persistent variables */
-		packet_state = IPS_INIT;
-		subst = done = FALSE;
-		*count = 0;
-		return 0;
-	}
-	
-	if(!buffer || !count)
-		fatal("NULL pointer passed to handPollForResponse");
+	int retval, n;
+	uint8_t *p;
 	
-	while(!done){ /* Loop getting bytes */
-		retval = hanio_getchar(hanio, &c);
+	if(rx_frame.ready)
+		return 1;
+
+	/* Only go to the tty when the ring is empty, and then just once */
+
+	if(!hanio_rx_pending(hanio)){
+		retval = hanio_fill(hanio);
 		if(retval < 0){
 			if((errno != EAGAIN) && (errno != EWOULDBLOCK))
 				fatal_with_reason(errno, "Error reading from serial port");
@@ -732,128 +1214,86 @@ static int handPollForResponse(bool init, uint8_t *buffer, int *count)
 						
 		}
 		else if(retval == 0){
-			hanio_close(hanio);
-			hanio = NULL;
-			close_all_polled_sockets();
-			serial_port_open_timer = SERIAL_PORT_OPEN_RETRY_TIME;
+			serial_port_lost();
 			return -1;	
 		}
-		switch(packet_state){
-			case IPS_INIT:
-				if(c == STX)
-					packet_state = IPS_RCV;
-				else
-					debug(DEBUG_EXPECTED, "Garbage byte received: %02X",((uint8_t) c)& 0xFF);
-				break;
+	}
 
-			case IPS_RCV:
-				if(!subst){
-					if(c == ETX){
-						done = TRUE;
-						packet_state = IPS_INIT;
-					}
-					else if( c == SUBST){
-						subst = TRUE;
-					}
-					else{
-						buffer[(*count)++] = c;
-					}
-				}
-				else{
-					subst = FALSE;
-					buffer[(*count)++] = c;
-				}
-				break;
+	/* Decode the received bytes in place */
 
-			default:
-				packet_state = IPS_INIT;
-				break;
-		}
-	} /* End while */
-	done = 0;
-	return 1;
+	while(!rx_frame.ready && (n = hanio_rx_peek(hanio, &p)))
+		hanio_rx_consume(hanio, frame_decoder_feed(&rx_decoder, p, n));
+
+	return rx_frame.ready ? 1 : 0;
 }
 
 
 /*
-* Transmit a packet to the network and wait for a response
+* Transmit a packet to the network and wait for a response. If rtt isn't
+* NULL, it is set to the microseconds from the end of the transmission
+* to the response being received.
 */
 
-static int handTransmitPacket(hanioStuff *hanio, Han_Packet *packet, int rx_timeout) {
+static int handTransmitPacket(hanioStuff *hanio, Han_Packet *packet, int rx_timeout, unsigned *rtt) {
 	int i,retval;
-	unsigned char *p;
-	int rxPacketLen;
-	unsigned short txPacketLen = 1;
-	unsigned char crcBuffer[4 + MAX_PARAMS];
+	struct timespec sent, now;
+	int crcLen, numStatus;
+	int txPacketLen;
+	unsigned char crcBuffer[5 + MAX_PARAMS];
 	unsigned char txBuffer[MAX_PARAMS*2 + 12];
-	unsigned char rxBuffer[MAX_PARAMS + 6];
-	uint8_t crc16 = node_attributes[packet->nodeaddress] & NC_CRC16;
+	uint8_t *rxBuffer = rx_frame.buf;
+	uint8_t use_crc16 = noderec_get(packet->nodeaddress)->attr & NR_CRC16;
 	uint8_t ack, nak;
 	
-	debug(DEBUG_ACTION, "Addressing node 0x%02x, command 0x%02x, Numparms 0x%02x, crc16 = %d", packet->nodeaddress, packet->nodecommand,packet->numnodeparams, crc16);
+	debug(DEBUG_ACTION, "Addressing node 0x%02x, command 0x%02x, Numparms 0x%02x, crc16 = %d", packet->nodeaddress, packet->nodecommand,packet->numnodeparams, use_crc16);
+
+	if(packet->numnodeparams > MAX_PARAMS)
+		return HAN_CSTS_INVPARM;
 
 	/*
 	* Build the TX packet
 	*/
 	
-	txBuffer[0] = STX;
-	p = txBuffer + 1;
-	
-	/* Add the header control bits */
-	
-	stuffPacketByte((crcBuffer[0] = (crc16) ? HDC16 : HDC), &p, &txPacketLen);
-
-	/* Add the node address */
-	
-	stuffPacketByte((crcBuffer[1] = packet->nodeaddress), &p, &txPacketLen);
-
-	/* Add the command */
-
-	stuffPacketByte((crcBuffer[2] = packet->nodecommand), &p, &txPacketLen);
-
-	/* Add the parameter bytes */
-
+	crcBuffer[0] = (use_crc16) ? HDC16 : HDC;
+	crcBuffer[1] = packet->nodeaddress;
+	crcBuffer[2] = packet->nodecommand;
 	for(i = 0 ; i < packet->numnodeparams ; i++)
-		stuffPacketByte((crcBuffer[3 + i ] = packet->nodeparams[i]), &p, &txPacketLen);
+		crcBuffer[3 + i] = packet->nodeparams[i];
+	crcLen = 3 + packet->numnodeparams;
 
 	/* Calculate a CRC and place it in the packet */
-	if(crc16){
-		uint8_t crclo, crchi;
-		uint16_t crc = calcCRC16(crcBuffer, 3 + packet->numnodeparams);
+	if(use_crc16){
+		uint16_t crc = crc16(crcBuffer, crcLen);
 		debug(DEBUG_ACTION, "TX CRC16: %04X", crc);
 
-		crclo = (uint8_t) crc;
-		crchi = (uint8_t) (crc >> 8);
-		stuffPacketByte((crcBuffer[3 + packet->numnodeparams] = crclo), &p, &txPacketLen);
-		stuffPacketByte((crcBuffer[4 + packet->numnodeparams] = crchi), &p, &txPacketLen);
+		crcBuffer[crcLen++] = (uint8_t) crc;
+		crcBuffer[crcLen++] = (uint8_t) (crc >> 8);
 	}
 	else{		 
-		stuffPacketByte((crcBuffer[3 + packet->numnodeparams] = calcCRC(crcBuffer, 3 + packet->numnodeparams)),
-					&p, &txPacketLen);
+		crcBuffer[crcLen] = crc8(crcBuffer, crcLen);
+		crcLen++;
 	}
 	
-	/* Add the end framing character */
-	
-	*p = ETX;
-	txPacketLen++;
-	
+	/* Stuff it and add the framing characters */
+
+	txPacketLen = frame_encode(txBuffer, sizeof(txBuffer), crcBuffer, crcLen);
+	if(txPacketLen < 0)
+		panic("TX buffer too small in handTransmitPacket");
 				
-	debug_hexdump(DEBUG_EXPECTED, crcBuffer, packet->numnodeparams + ((crc16)? 5 : 4), "TX Packet: ");
+	debug_hexdump(DEBUG_EXPECTED, crcBuffer, crcLen, "TX Packet: ");
 	debug_hexdump(DEBUG_ACTION, txBuffer, txPacketLen, "Stuffed TX Packet: ");
 
 	// Send the TX packet
 
 	retval = hanio_write(hanio, txBuffer, txPacketLen, MAX_WRITE_BUSY_TIME);
 	if(retval != txPacketLen){
-		debug(DEBUG_UNEXPECTED, "Serial port write error. Closing port to re-open later");
-		hanio_close(hanio);
-		hanio = NULL;
-		close_all_polled_sockets();
-		serial_port_open_timer = SERIAL_PORT_OPEN_RETRY_TIME;	
+		debug(DEBUG_UNEXPECTED, "Serial port write error");
+		serial_port_lost();
 		return HAN_CSTS_SERIAL_DISCONNECT;
 	}
 
 	debug(DEBUG_ACTION,"TX packet sent.");
+	clock_gettime(CLOCK_MONOTONIC, &sent);
 
 	// If broadcast packet, there will be no response
 
@@ -862,14 +1302,14 @@ static int handTransmitPacket(hanioStuff *hanio, Han_Packet *packet, int rx_time
 		return HAN_CSTS_OK;
 	}
 	
- 	handPollForResponse(TRUE, NULL, &rxPacketLen);
+ 	handResetReceiver();
 	for(;;){
 		int res;
-		if(!rxPacketLen && !hanio_wait_read(hanio, rx_timeout)){
+		if(!hanio_rx_pending(hanio) && !hanio_wait_read(hanio, rx_timeout)){
 			return HAN_CSTS_RX_TIMEOUT;
 		}
 		
-		res = handPollForResponse(FALSE, rxBuffer ,&rxPacketLen);
+		res = handPollForResponse();
 		if(res < 0){
 			return HAN_CSTS_SERIAL_DISCONNECT;
 		}
@@ -877,13 +1317,18 @@ static int handTransmitPacket(hanioStuff *hanio, Han_Packet *packet, int rx_time
 				break;
 		}
 	}
+	rx_frame.ready = FALSE;
+	if(rtt){
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		*rtt = (now.tv_sec - sent.tv_sec) * 1000000 + (now.tv_nsec - sent.tv_nsec) / 1000;
+	}
 	
 	// Check the packet
 
-	if(crc16){
+	if(use_crc16){
 		ack = HDC_ACK16;
 		nak = HDC_NAK16;
-		if(packetCheck16(rxBuffer, rxPacketLen)){
+		if(packetCheck16(rxBuffer, rx_frame.len)){
 			debug(DEBUG_EXPECTED, "CRC16 error on status packet");
 			return HAN_CSTS_CRC_ERROR; 
 		}
@@ -891,7 +1336,7 @@ static int handTransmitPacket(hanioStuff *hanio, Han_Packet *packet, int rx_time
 	else{
 		ack = HDC_ACK;
 		nak = HDC_NAK;
-		if(calcCRC(rxBuffer , rxPacketLen)){
+		if(crc8(rxBuffer , rx_frame.len)){
 			debug(DEBUG_UNEXPECTED, "CRC8 error on status packet");
 			return HAN_CSTS_CRC_ERROR;
 		}
@@ -900,8 +1345,8 @@ static int handTransmitPacket(hanioStuff *hanio, Han_Packet *packet, int rx_time
 	debug(DEBUG_ACTION, "CRC OK on response.");
 
 
-	if((rxBuffer[0] != ack)&&(rxBuffer[0] != nak)){
-		debug_hexdump(DEBUG_UNEXPECTED, rxBuffer, rxPacketLen,  "Unrecognized HDC: ");
+	if((rx_frame.len < 4) || ((rxBuffer[0] != ack)&&(rxBuffer[0] != nak))){
+		debug_hexdump(DEBUG_UNEXPECTED, rxBuffer, rx_frame.len,  "Unrecognized HDC: ");
 		return HAN_CSTS_FORMAT_ERROR;	
 	}
 	
@@ -912,7 +1357,10 @@ static int handTransmitPacket(hanioStuff *hanio, Han_Packet *packet, int rx_time
 		return HAN_CSTS_NAK_ERROR;
 	}
 
-	for(i = 0 ; i < (rxPacketLen - 4) ; i++)
+	numStatus = rx_frame.len - 4;
+	if(numStatus > MAX_PARAMS)
+		numStatus = MAX_PARAMS;
+	for(i = 0 ; i < numStatus ; i++)
 		packet->nodestatus[i] = rxBuffer[ 3 + i];
 	
 	usleep(1000); // Wait 1ms for tx driver disable on node	
@@ -920,42 +1368,78 @@ static int handTransmitPacket(hanioStuff *hanio, Han_Packet *packet, int rx_time
 }
 
 /*
-* Send a packet and wait for a response, wait the normal response time before
-* timing out. Attempt to retry if an RX timeout occurs. Log error counts
-* and successful packets
+* A node answered, but not properly. Count it against the node.
+*/
+
+static void node_error(unsigned addr, int status)
+{
+	Node_Rec *nr = noderec_get(addr);
+
+	health_answered(addr);
+	noderec_begin(nr);
+	if(status == HAN_CSTS_CRC_ERROR)
+		nr->crc_errs++;
+	else if(status == HAN_CSTS_NAK_ERROR)
+		nr->naks++;
+	else
+		nr->format_errs++;
+	noderec_end(nr);
+}
+
+
+/*
+* Send a packet and wait for a response, waiting as long as the node usually
+* takes to answer the command before timing out. Attempt to retry if an RX
+* timeout occurs, waiting twice as long each time. Log error counts
+* and successful packets. Nodes which have stopped answering aren't sent
+* anything, and the retries stop as soon as a node is taken as down.
 */
 
 static int handSend(hanioStuff *hanio, Han_Packet *packet) {
-	unsigned txCount;
+	unsigned txCount, rtt, timeout;
 	int retVal = HAN_CSTS_OK;
-	int done;
+	int done, timed_out = FALSE;
 	
+	if(!health_admit(packet->nodeaddress))
+		return HAN_CSTS_NODE_DOWN;
+
+	timeout = rtt_timeout(packet->nodeaddress, packet->nodecommand, MAX_CMD_RESPONSE_TIME);
 	for(txCount = 0, done = 0 ; (done == 0) && (txCount < (conf_max_retries + 1)); txCount++){
-		switch((retVal = handTransmitPacket(hanio, packet, MAX_CMD_RESPONSE_TIME))){
+		switch((retVal = handTransmitPacket(hanio, packet, timeout, &rtt))){
 			case HAN_CSTS_OK:
 				done = 1;
-				error_stats.round_trips++;
+				stats_add(&error_stats.round_trips, 1);
+				if(packet->nodeaddress != 0xFF){
+					health_answered(packet->nodeaddress);
+					inventory_seen(packet->nodeaddress);
+					if(!timed_out)
+						rtt_sample(packet->nodeaddress, packet->nodecommand, rtt);
+				}
 				break;
 				
 			case HAN_CSTS_RX_TIMEOUT:
-				error_stats.rx_timeouts++;
+				stats_add(&error_stats.rx_timeouts, 1);
+				rtt_missed(packet->nodeaddress);
+				timeout = rtt_backoff(timeout);
+				timed_out = TRUE;
+				if(health_missed(packet->nodeaddress))
+					done = 1;
 				break;
 			
 			case HAN_CSTS_SERIAL_DISCONNECT:
+			case HAN_CSTS_INVPARM:
 				done = 1;
 				break;
 			
 			case HAN_CSTS_CRC_ERROR:
-				error_stats.crc_errs++;
+				stats_add(&error_stats.crc_errs, 1);
+				node_error(packet->nodeaddress, retVal);
 				break;
 			
 			case HAN_CSTS_FORMAT_ERROR:
-				break;
-				
 			case HAN_CSTS_NAK_ERROR:
-				break;
-			
 			case HAN_CSTS_FRAMING_ERROR:
+				node_error(packet->nodeaddress, retVal);
 				break;
 
 			default:
@@ -968,35 +1452,45 @@ static int handSend(hanioStuff *hanio, Han_Packet *packet) {
 		
 
 /*
-* Scan the network for attached nodes, and report all nodes found
+* Probe one address for a network scan, and add the node to the list if
+* one answers. Addresses where nothing has answered are only waited on for
+* as long as nodes usually take to answer NODEID, and never longer than
+* MAX_NODEID_RESPONSE_TIME. A node already identified is asked twice
+* before it is taken as missing.
 */
 
-static int handScanNetwork(hanioStuff *hanio, Han_Netscan *netscan){
-	unsigned i;
-	unsigned j;
-	int res = HAN_CSTS_OK;
-	static Han_Packet packet;
+static int handScanNode(hanioStuff *hanio, unsigned addr, Han_Netscan *netscan){
+	unsigned j = netscan->numnodesfound;
+	unsigned rtt, timeout, tries;
+	int res;
+	Han_Packet packet;
 	
-	packet.numnodeparams = 4;
-	packet.nodecommand = HAN_CMD_NODEID;
+	timeout = rtt_timeout(addr, HAN_CMD_NODEID, MAX_NODEID_RESPONSE_TIME);
+	if(timeout > MAX_NODEID_RESPONSE_TIME)
+		timeout = MAX_NODEID_RESPONSE_TIME;
 
-	netscan->numnodesfound = 0;
-	
-	for(i = 0, j = 0 ; i <= max_node_addr ; i++){
-		packet.nodeaddress = (unsigned char) i;
-
-		if((res = handTransmitPacket(hanio, &packet, MAX_NODEID_RESPONSE_TIME) == HAN_CSTS_OK)){
-			netscan->nodelist[j].addr = (unsigned char) i;
-			netscan->nodelist[j].type = (((unsigned)packet.nodestatus[1]) << 8) + packet.nodestatus[0]; 
-			netscan->nodelist[j++].fwlevel = (((unsigned)packet.nodestatus[3]) << 8) + packet.nodestatus[2];
-			netscan->numnodesfound++;
-		}
-		if(res == HAN_CSTS_TX_TIMEOUT) // This one is a real error.
+	tries = (noderec_get(addr)->flags & NR_IDENTIFIED) ? 2 : 1;
+	for(;;){
+		memset(&packet, 0, sizeof(Han_Packet));
+		packet.numnodeparams = 4;
+		packet.nodecommand = HAN_CMD_NODEID;
+		packet.nodeaddress = (unsigned char) addr;
+		res = handTransmitPacket(hanio, &packet, timeout, &rtt);
+		if((res == HAN_CSTS_OK) || (res == HAN_CSTS_TX_TIMEOUT) || (res == HAN_CSTS_SERIAL_DISCONNECT) || !--tries)
 			break;
+		debug(DEBUG_ACTION, "Node %02X didn't answer the scan, status %d, trying again", addr, res);
+		timeout = MAX_NODEID_RESPONSE_TIME;
 	}
-	if(res != HAN_CSTS_TX_TIMEOUT)
-		res = HAN_CSTS_OK;
 
+	if(res == HAN_CSTS_OK){
+		rtt_sample(addr, HAN_CMD_NODEID, rtt);
+		health_answered(addr);
+		netscan->nodelist[j].addr = (unsigned char) addr;
+		netscan->nodelist[j].type = (((unsigned)packet.nodestatus[1]) << 8) + packet.nodestatus[0]; 
+		netscan->nodelist[j].fwlevel = (((unsigned)packet.nodestatus[3]) << 8) + packet.nodestatus[2];
+		inventory_identify(addr, netscan->nodelist[j].type, netscan->nodelist[j].fwlevel);
+		netscan->numnodesfound++;
+	}
 	return res;
 }
 
@@ -1048,12 +1542,297 @@ static int handDoRawPacket(struct han_raw *rp)
 }
 
 
+/*
+* Check whether a down node has come back, using the same command as a
+* network scan
+*/
+
+static void handProbeNode(hanioStuff *hanio, unsigned addr)
+{
+	Han_Packet packet;
+	unsigned rtt;
+	int res;
+
+	memset(&packet, 0, sizeof(Han_Packet));
+	packet.nodeaddress = (unsigned char) addr;
+	packet.nodecommand = HAN_CMD_NODEID;
+	packet.numnodeparams = 4;
+
+	debug(DEBUG_ACTION, "Checking on down node 0x%02X", addr);
+	res = handTransmitPacket(hanio, &packet, rtt_timeout(addr, HAN_CMD_NODEID, MAX_NODEID_RESPONSE_TIME), &rtt);
+	if(res == HAN_CSTS_SERIAL_DISCONNECT)
+		return;
+	health_probed(addr, res != HAN_CSTS_RX_TIMEOUT);
+	if(res == HAN_CSTS_OK)
+		inventory_seen(addr);
+	fold_io_stats();
+}
+
+
+/*
+* Return TRUE if a client request has to go to the bus thread
+*/
+
+static int bus_request(int request)
+{
+	return (request == HAN_CCMD_SENDPKT) || (request == HAN_CCMD_NETSCAN) || (request == HAN_CCMD_RAW_PACKET);
+}
+
+
+/*
+* Carry out a client request which uses the bus. Runs on the bus thread.
+*/
+
+static void bus_command(Client_Command *client_command){
+
+	if(!hanio){
+		client_command->commstatus = HAN_CSTS_SERIAL_DISCONNECT;
+		return;
+	}
+
+	switch(client_command->request){
+		case HAN_CCMD_SENDPKT:
+			/* It is transmit command request */
+			/* Send the command to the network. */
+
+			client_command->commstatus = handSend(hanio, &client_command->cmd.pkt);
+			break;
+		
+		/* It's a raw packet */
+		case HAN_CCMD_RAW_PACKET:
+			client_command->commstatus = handDoRawPacket(&client_command->cmd.raw);
+			break;
+
+		default:
+			panic("Request %d sent to the bus thread", client_command->request);
+	}
+	fold_io_stats();
+}
+
+
+/*
+* Send the scan result so far to a request waiting on it. A partial result
+* goes in a copy of the request, as the request itself is still waiting.
+*/
+
+static void scan_post(Bus_Req *r, int status, int partial)
+{
+	Bus_Req *p;
+
+	if(partial){
+		if((p = malloc(sizeof(Bus_Req))) == NULL)
+			return;
+		*p = *r;
+		p->type = BUS_PROGRESS;
+		r = p;
+	}
+	r->cc.cmd.scan = scan_result;
+	r->cc.cmd.scan.flags = partial ? HAN_NETSCAN_PARTIAL : 0;
+	r->cc.commstatus = status;
+	bus_post(r);
+}
+
+
+/*
+* Finish the network scan, and answer everything waiting on it
+*/
+
+static void scan_end(int status)
+{
+	Bus_Req *r;
+	uint8_t found[256];
+	unsigned i;
+
+	debug(DEBUG_ACTION, "Network scan ended, status %d, %u nodes found", status, scan_result.numnodesfound);
+
+	/*
+	* A complete scan shows which nodes may have gone. One is only dropped
+	* from the inventory once it has missed SCAN_FORGET_AFTER scans in a row.
+	*/
+
+	if(status == HAN_CSTS_OK){
+		memset(found, 0, sizeof(found));
+		for(i = 0; i < scan_result.numnodesfound; i++)
+			found[scan_result.nodelist[i].addr] = TRUE;
+		for(i = 0; (i <= max_node_addr) && (i < 256); i++){
+			if(found[i] || !(noderec_get(i)->flags & NR_IDENTIFIED))
+				scan_missed[i] = 0;
+			else if(++scan_missed[i] >= SCAN_FORGET_AFTER){
+				debug(DEBUG_EXPECTED, "Node %02X missed %u scans, dropping it from the inventory", i, scan_missed[i]);
+				inventory_forget(i);
+				scan_missed[i] = 0;
+			}
+		}
+	}
+	while((r = scan_waiting) != NULL){
+		scan_waiting = r->next;
+		scan_post(r, status, FALSE);
+	}
+	scan_state = (status == HAN_CSTS_OK) ? SCAN_DONE : SCAN_IDLE;
+}
+
+
+/*
+* Take a network scan request. The result of the last scan is sent straight
+* back unless a refresh is asked for. Otherwise the request waits for the
+* scan in progress, starting one if need be.
+*/
+
+static void scan_request(Bus_Req *r)
+{
+	unsigned flags = r->cc.cmd.scan.flags;
+
+	if(flags & HAN_NETSCAN_CANCEL){
+		if(scan_state == SCAN_RUNNING)
+			scan_end(HAN_CSTS_SCAN_CANCELED);
+		scan_post(r, HAN_CSTS_OK, FALSE);
+		return;
+	}
+
+	if((scan_state == SCAN_DONE) && !(flags & HAN_NETSCAN_REFRESH)){
+		scan_post(r, HAN_CSTS_OK, FALSE);
+		return;
+	}
+
+	if(!hanio){
+		r->cc.commstatus = HAN_CSTS_SERIAL_DISCONNECT;
+		bus_post(r);
+		return;
+	}
+
+	if(scan_state != SCAN_RUNNING){
+		debug(DEBUG_ACTION, "Starting network scan");
+		memset(&scan_result, 0, sizeof(Han_Netscan));
+		scan_next = 0;
+		scan_state = SCAN_RUNNING;
+	}
+	r->next = scan_waiting;
+	scan_waiting = r;
+}
+
+
+/*
+* Probe the next address of the network scan. Progress goes to the
+* requests which asked for it whenever a node is found, and every 16
+* addresses otherwise.
+*/
+
+static void scan_step(void)
+{
+	Bus_Req *r;
+	int res;
+
+	res = handScanNode(hanio, scan_next, &scan_result);
+	fold_io_stats();
+	scan_result.lastaddr = (unsigned char) scan_next;
+
+	if((res == HAN_CSTS_TX_TIMEOUT) || (res == HAN_CSTS_SERIAL_DISCONNECT)){ // These are real errors.
+		scan_end(res);
+		return;
+	}
+	if(scan_next++ >= max_node_addr){
+		scan_end(HAN_CSTS_OK);
+		return;
+	}
+	if((res == HAN_CSTS_OK) || !(scan_next & 0x0F)){
+		for(r = scan_waiting; r; r = r->next){
+			if(r->cc.cmd.scan.flags & HAN_NETSCAN_PROGRESS)
+				scan_post(r, HAN_CSTS_OK, TRUE);
+		}
+	}
+}
+
+
+/*
+* Let a node command share the transaction of a waiting request which asks
+* the same node for the same thing, if the command is one of those listed
+* as safe to share. Returns TRUE if it joined one. Otherwise it may be
+* shared itself by requests which come after it. A request only joins one
+* which will be served at least as soon as it would have been.
+*/
+
+static int coalesce_join(Bus_Req *r)
+{
+	Han_Packet *p = &r->cc.cmd.pkt, *q;
+	Bus_Req *l;
+	unsigned i, free_slot = COALESCE_MAX;
+
+	if((r->cc.request != HAN_CCMD_SENDPKT) || !(conf_coalesce[p->nodecommand >> 3] & (1 << (p->nodecommand & 7))))
+		return FALSE;
+	if(p->numnodeparams > MAX_NODE_PARAMS)
+		return FALSE;
+
+	for(i = 0; i < COALESCE_MAX; i++){
+		if(!(l = coalesce_leaders[i])){
+			if(free_slot == COALESCE_MAX)
+				free_slot = i;
+			continue;
+		}
+		q = &l->cc.cmd.pkt;
+		if((l->prio <= r->prio) && (q->nodeaddress == p->nodeaddress) && (q->nodecommand == p->nodecommand) &&
+			(q->numnodeparams == p->numnodeparams) && !memcmp(q->nodeparams, p->nodeparams, p->numnodeparams)){
+			r->next = l->next;
+			l->next = r;
+			sched_coalesced(r->prio);
+			debug(DEBUG_ACTION, "Sharing command 0x%02X for node 0x%02X with an earlier request", p->nodecommand, p->nodeaddress);
+			return TRUE;
+		}
+	}
+	if(free_slot < COALESCE_MAX){
+		r->next = NULL;
+		coalesce_leaders[free_slot] = r;
+	}
+	return FALSE;
+}
+
+
+/*
+* A request is about to go on the bus, so nothing more can share it
+*/
+
+static void coalesce_close(Bus_Req *r)
+{
+	unsigned i;
+
+	for(i = 0; i < COALESCE_MAX; i++){
+		if(coalesce_leaders[i] == r){
+			coalesce_leaders[i] = NULL;
+			break;
+		}
+	}
+}
+
+
+/*
+* Give the requests which shared a transaction its result
+*/
+
+static void coalesce_post(Bus_Req *r)
+{
+	Bus_Req *f;
+
+	while((f = r->next) != NULL){
+		r->next = f->next;
+		f->cc.commstatus = r->cc.commstatus;
+		f->cc.cmd.pkt = r->cc.cmd.pkt;
+		bus_post(f);
+	}
+}
+
+
 /*
 * Figure out what command the client sent to us and try to do something
-* with it.
+* with it. Requests for the bus go to bus_command() instead.
 */
 
-static void clientCommand(hanioStuff *hanio, Client_Command *client_command){
+static void clientCommand(Client_Command *client_command){
+	unsigned *src = (unsigned *) &error_stats;
+	unsigned *dst = (unsigned *) &client_command->cmd.stats;
+	unsigned i, n;
+	uint32_t now;
+	struct node_stats *ns;
+	Node_Rec nr;
+	Sock_Entry *se;
 			
 	switch(client_command->request){
 
@@ -1066,38 +1845,94 @@ static void clientCommand(hanioStuff *hanio, Client_Command *client_command){
 			client_command->cmd.info.errstatssize = sizeof(struct err_stats);
 			client_command->cmd.info.ppowersize = sizeof(struct ppower_client_command);
 			client_command->cmd.info.rawsize = sizeof(struct han_raw);
+			client_command->cmd.info.sessionsize = sizeof(Client_Tagged_Command);
+			client_command->cmd.info.wireversion = WIRE_VERSION;
 			client_command->commstatus = HAN_CSTS_OK;
 			break;
 
-	
-		case HAN_CCMD_SENDPKT:
-			/* It is transmit command request */
-			/* Send the command to the network. */
+		case HAN_CCMD_NETSTATSCLR:
+		case HAN_CCMD_NETSTATS:
 
-			client_command->commstatus = handSend(hanio, &client_command->cmd.pkt);
+			/*
+			* It is a request for the net statistics. Every field of
+			* Err_Stats is an unsigned counter the bus thread may be adding to.
+			*/
+
+			client_command->commstatus = HAN_CSTS_OK;
+			for(i = 0; i < sizeof(Err_Stats) / sizeof(unsigned); i++){
+				if(client_command->request == HAN_CCMD_NETSTATSCLR)
+					dst[i] = __atomic_exchange_n(&src[i], 0, __ATOMIC_RELAXED);
+				else
+					dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+			}
 			break;
-		
-		case HAN_CCMD_NETSCAN:
-			/* It is a scan request */	
-			
-			client_command->commstatus = handScanNetwork(hanio, &client_command->cmd.scan);
+
+		case HAN_CCMD_QUEUESTATS:
+			sched_get(&client_command->cmd.queuestats);
+			client_command->commstatus = HAN_CSTS_OK;
 			break;
 
-	
-		case HAN_CCMD_NETSTATSCLR:
-		case HAN_CCMD_NETSTATS:
+		case HAN_CCMD_CACHESTATS:
+			cache_get(&client_command->cmd.cachestats, evloop_now());
+			client_command->commstatus = HAN_CSTS_OK;
+			break;
+
+		case HAN_CCMD_TEXTSTATS:
+			client_command->cmd.textstats = text_stats;
+			client_command->cmd.textstats.sockets = num_text_sockets;
+			for(se = sockets; se; se = se->next){
+				if(se->type == FD_CONNECTED_TEXT)
+					client_command->cmd.textstats.queued += se->tq.count;
+			}
+			client_command->commstatus = HAN_CSTS_OK;
+			break;
+
+		case HAN_CCMD_SAMPLES:
+			if(sampler_get(&client_command->cmd.samples, evloop_now()))
+				client_command->commstatus = HAN_CSTS_INVPARM;
+			else
+				client_command->commstatus = HAN_CSTS_OK;
+			break;
+
+		case HAN_CCMD_HISTORY:
+			if(sampler_history(&client_command->cmd.history))
+				client_command->commstatus = HAN_CSTS_INVPARM;
+			else
+				client_command->commstatus = HAN_CSTS_OK;
+			break;
 
-			/* It is a request for the net statistics */
+		case HAN_CCMD_NODESTATS:
+
+			/* Report the nodes something has been recorded for, a page at a time */
 
 			client_command->commstatus = HAN_CSTS_OK;
-			memcpy(&client_command->cmd.stats, &error_stats, sizeof(error_stats));
-			if(client_command->request == HAN_CCMD_NETSTATSCLR){
-				error_stats.round_trips = 0;
-				error_stats.rx_timeouts = 0;
-				error_stats.tx_timeouts = 0;
-				error_stats.crc_errs = 0;
-				error_stats.spurious_packets = 0;
+			client_command->cmd.nodestats.more = FALSE;
+			now = (uint32_t) time(NULL);
+			for(i = client_command->cmd.nodestats.first, n = 0; i < 256; i++){
+				noderec_read(i, &nr);
+				if(!nr.flags && !nr.rtt.samples && !nr.rtt.timeouts && !nr.downs)
+					continue;
+				if(n == HAN_NODESTATS_MAX){
+					client_command->cmd.nodestats.more = TRUE;
+					break;
+				}
+				ns = &client_command->cmd.nodestats.nodelist[n++];
+				ns->addr = (unsigned char) i;
+				ns->state = nr.state;
+				ns->samples = nr.rtt.samples;
+				ns->timeouts = nr.rtt.timeouts;
+				ns->srtt = nr.rtt.srtt;
+				ns->rttvar = nr.rtt.rttvar;
+				ns->timeout = nr.rtt.samples ? rtt_rto(&nr.rtt) : 0;
+				ns->downs = nr.downs;
+				ns->ups = nr.ups;
+				ns->refused = nr.refused;
+				ns->crc_errs = nr.crc_errs;
+				ns->naks = nr.naks;
+				ns->format_errs = nr.format_errs;
+				ns->idle = nr.lastseen ? now - nr.lastseen : HAN_NODE_NEVER_SEEN;
 			}
+			client_command->cmd.nodestats.numnodes = (unsigned char) n;
 			break;
 
      		 /* It's a request to send a command string to ppower */
@@ -1106,11 +1941,6 @@ static void clientCommand(hanioStuff *hanio, Client_Command *client_command){
         		client_command->commstatus = handDoPPower(client_command->cmd.ppower_cmd.command_string);
         		break;
 
-		/* It's a raw packet */
-		case HAN_CCMD_RAW_PACKET:
-			client_command->commstatus = handDoRawPacket(&client_command->cmd.raw);
-			break;
-
 		default:
 			/* It was a wacky client command.. */
 
@@ -1149,63 +1979,431 @@ static void hand_show_version(void) {
 
 
 /*
-* Read the client command, execute it, and return the result
-* returns 1 if timeout from a read, 0 of ok.
+* A command connection stalled. Give up on it.
+*/
+
+static void cmd_socket_timeout(Ev_Timer *t)
+{
+	Sock_Entry *se = t->ctx;
+
+	if(se->out_len > se->out_done)
+		debug(DEBUG_UNEXPECTED, "Gave up waiting to write HAN command response");
+	else
+		debug(DEBUG_UNEXPECTED, "Gave up waiting for user command socket");
+	close_socket(se);
+}
+
+
+/*
+* Arm the deadline for whatever the connection is waiting on, restarting it
+* if bytes moved. A session sitting idle between requests has no deadline,
+* nor does a connection waiting on the bus thread.
 */
 
-static int processClientCommand(int user_socket){
+static void cmd_socket_arm(Sock_Entry *se, int progress)
+{
+	unsigned msec;
+
+	if(se->out_len > se->out_done)
+		msec = USER_WRITE_TIMEOUT / 1000;
+	else if(se->in_done || ((se->mode != CMD_SESSION) && (se->mode != CMD_V2) && !se->closing))
+		msec = USER_READ_TIMEOUT / 1000;
+	else{
+		evloop_timer_stop(&se->deadline);
+		return;
+	}
+	if(progress || !se->deadline.active)
+		evloop_timer_start(&se->deadline, msec, cmd_socket_timeout, se);
+}
+
 
-        Client_Command client_command;
+/*
+* Accept a new command connection. Requests are read and responses written
+* a piece at a time as the socket allows, so a slow client only holds up
+* itself.
+*/
+
+static void add_cmd_socket(int user_socket)
+{
+	Sock_Entry *se;
 
 	/* The socket needs to be non-blocking. */
 	if(fcntl(user_socket, F_SETFL, O_NONBLOCK) == -1) {
 		fatal_with_reason(errno, "Could not set user socket to non-blocking");
 	}
-			
-	/* Read the request from the client. */
-
-	if(!socket_read(user_socket, &client_command, sizeof(Client_Command), USER_READ_TIMEOUT)) {
-		debug(DEBUG_UNEXPECTED, "Gave up waiting for user command socket");
-				
-		/* We timed out, close the socket and continue. */
-		if(close(user_socket) != 0) {
-			debug(DEBUG_UNEXPECTED, "Problem closing timed-out user command socket: %s", strerror(errno));
-		}
-		return FAIL;
-	}
-			
-	/* Process the command */
 
-	clientCommand(hanio, &client_command);
-	
-	if(client_command.commstatus == HAN_CSTS_SERIAL_DISCONNECT){
-		
-		return FAIL;
+	if(add_socket(user_socket, FD_CONNECTED_CMD)){
+		debug(DEBUG_UNEXPECTED, "Could not add user command socket");
+		close(user_socket);
+		return;
 	}
-	
-	/* Send a response to the controlling process */
-	
-	if(!socket_write(user_socket, &client_command, sizeof(Client_Command), USER_WRITE_TIMEOUT)){
-		debug(DEBUG_UNEXPECTED, "Gave up waiting to write HAN command response");
-		/* We timed out, close the socket and continue. */
-		if(close(user_socket) != 0)
-			debug(DEBUG_UNEXPECTED, "Problem closing socket after a time out writing the response info");
+	se = sockets;
+	if((se->in = malloc(sizeof(Client_Tagged_Command))) == NULL){
+		debug(DEBUG_UNEXPECTED, "Out of memory for user command");
+		close_socket(se);
+		return;
 	}
+	cmd_socket_arm(se, TRUE);
+}
 
-		
-	/* Close the user's socket. */
-	if(close(user_socket) != 0) {
-		debug(DEBUG_UNEXPECTED, "Problem closing completed user command socket: %s", strerror(errno));
-	}
-	debug(DEBUG_STATUS, "User socket closed");
-	return PASS;
-}	
 
 /*
-* Convert two hex digits into an unsigned char
+* Queue a response to go back to the client
 */
 
-static unsigned char h2touc(char *s, char *err)
+static int cmd_queue_response(Sock_Entry *se, void *p, unsigned len)
+{
+	uint8_t *n;
+
+	/* Reclaim the space already written */
+
+	if(se->out_done){
+		memmove(se->out, se->out + se->out_done, se->out_len - se->out_done);
+		se->out_len -= se->out_done;
+		se->out_done = 0;
+	}
+	if(se->out_len + len > se->out_size){
+		if((n = realloc(se->out, se->out_len + len)) == NULL){
+			debug(DEBUG_UNEXPECTED, "Out of memory queueing a response");
+			return FAIL;
+		}
+		se->out = n;
+		se->out_size = se->out_len + len;
+	}
+	memcpy(se->out + se->out_len, p, len);
+	se->out_len += len;
+	return PASS;
+}
+
+
+/*
+* Return TRUE if the client has so many requests in progress, or responses
+* waiting, that no more requests should be read until it catches up
+*/
+
+static int cmd_backlogged(Sock_Entry *se)
+{
+	return (se->busy >= SESSION_MAX_BACKLOG) ||
+		((se->out_len - se->out_done) >= SESSION_MAX_BACKLOG * sizeof(Client_Tagged_Command));
+}
+
+
+/*
+* Write out as many of the queued responses as the socket will take.
+* Sets *progress if anything was written. Returns PASS if the socket is
+* still good, FAIL if it should be closed.
+*/
+
+static int cmd_flush(Sock_Entry *se, int *progress)
+{
+	ssize_t n;
+
+	while(se->out_done < se->out_len){
+		n = write(se->h.fd, se->out + se->out_done, se->out_len - se->out_done);
+		if(n > 0){
+			se->out_done += n;
+			*progress = TRUE;
+			continue;
+		}
+		if((n < 0) && (errno == EINTR))
+			continue;
+		if((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+			break;
+		debug(DEBUG_UNEXPECTED, "User command socket write error: %s", strerror(errno));
+		return FAIL;
+	}
+	if(se->out_done == se->out_len)
+		se->out_done = se->out_len = 0;
+	return PASS;
+}
+
+
+/*
+* Queue the response to a request in the form the connection uses. If it
+* can't be queued the client would wait for it forever, so the connection
+* is closed and FAIL returned.
+*/
+
+static int cmd_respond(Sock_Entry *se, Client_Command *cc, uint32_t tag)
+{
+	Client_Tagged_Command tc;
+	uint8_t msg[WIRE_MAX_MSG];
+	int res;
+
+	switch(se->mode){
+		case CMD_V2:
+			res = cmd_queue_response(se, msg, wire_encode(msg, cc, tag, WIRE_FLAG_RESPONSE));
+			break;
+
+		case CMD_SESSION:
+			tc.tag = tag;
+			tc.cc = *cc;
+			res = cmd_queue_response(se, &tc, sizeof(Client_Tagged_Command));
+			break;
+
+		default:
+			res = cmd_queue_response(se, cc, sizeof(Client_Command));
+			break;
+	}
+	if(res){
+		debug(DEBUG_UNEXPECTED, "Could not queue a command socket response");
+		close_socket(se);
+	}
+	return res;
+}
+
+
+/*
+* Start or stop a watch. Changes are sent back on the connection as they
+* happen, so a legacy connection, which closes after its one response,
+* can't have one.
+*/
+
+static void cmd_watch(Sock_Entry *se, Client_Command *cc)
+{
+	if((se->mode != CMD_V2) && (se->mode != CMD_SESSION))
+		cc->commstatus = HAN_CSTS_INVPARM;
+	else if(cc->request == HAN_CCMD_UNWATCH)
+		cc->commstatus = watch_cancel(cc->cmd.watch.id, se) ? HAN_CSTS_NO_SUCH_WATCH : HAN_CSTS_OK;
+	else{
+		cc->cmd.watch.event = FALSE;
+		cc->commstatus = watch_add(&cc->cmd.watch, se, se->in->tag) ? HAN_CSTS_INVPARM : HAN_CSTS_OK;
+	}
+}
+
+
+/*
+* Execute a complete request. Requests for the bus are handed to the bus
+* thread and answered when they come back, anything else is answered here
+* and now.
+*/
+
+static void cmd_execute(Sock_Entry *se)
+{
+	Client_Command *cc = &se->in->cc;
+	Wire_Header hdr;
+	Bus_Req *r;
+
+	/* Unpack a v2 request. One the daemon can't make sense of gets an error back. */
+
+	if(se->mode == CMD_V2){
+		wire_header(se->wire_in, &hdr);
+		memset(cc, 0, sizeof(Client_Command));
+		se->in->tag = hdr.tag;
+		if(wire_decode(cc, &hdr, se->wire_in + WIRE_HDR_LEN, FALSE)){
+			debug(DEBUG_UNEXPECTED, "Malformed v2 request %u, %u bytes", hdr.request, hdr.length);
+			cc->commstatus = HAN_CSTS_INVPARM;
+			cmd_respond(se, cc, hdr.tag);
+			return;
+		}
+	}
+
+	/* A session request turns the connection over to tagged commands */
+
+	if((se->mode != CMD_V2) && (se->mode != CMD_SESSION) && (cc->request == HAN_CCMD_SESSION)){
+		debug(DEBUG_STATUS, "Starting command session");
+		cc->commstatus = HAN_CSTS_OK;
+
+		/* The acknowledgement still goes in the untagged form */
+
+		if(cmd_respond(se, cc, 0) == PASS)
+			se->mode = CMD_SESSION;
+		return;
+	}
+
+	/* A legacy connection closes once its one request has been answered */
+
+	if((se->mode != CMD_V2) && (se->mode != CMD_SESSION)){
+		se->closing = TRUE;
+
+		/* Older clients leave whatever was on the stack in the netscan flags */
+
+		if(cc->request == HAN_CCMD_NETSCAN)
+			cc->cmd.scan.flags = 0;
+	}
+
+	/* Process the command. v2 connections always stay open, so a session request there is a no-op. */
+
+	if((se->mode == CMD_V2) && (cc->request == HAN_CCMD_SESSION))
+		cc->commstatus = HAN_CSTS_OK;
+	else if((cc->request == HAN_CCMD_SENDPKT) && cache_lookup(&cc->cmd.pkt, evloop_now()))
+		cc->commstatus = HAN_CSTS_OK;
+	else if((cc->request == HAN_CCMD_WATCH) || (cc->request == HAN_CCMD_UNWATCH))
+		cmd_watch(se, cc);
+	else if(bus_request(cc->request)){
+		if((r = calloc(1, sizeof(Bus_Req))) == NULL){
+			debug(DEBUG_UNEXPECTED, "Out of memory for bus request");
+			close_socket(se);
+			return;
+		}
+		r->type = BUS_COMMAND;
+		r->tag = se->in->tag;
+		r->prio = ((se->mode == CMD_V2) && (hdr.flags & WIRE_FLAG_BULK)) ? HAN_PRIO_BULK : HAN_PRIO_INTERACTIVE;
+		r->cc = *cc;
+		bus_submit(r, se);
+		return;
+	}
+	else
+		clientCommand(cc);
+
+	/* Queue the response for the controlling process */
+
+	cmd_respond(se, cc, se->in->tag);
+}
+
+
+/*
+* Return where the next bytes of a request go, and how many bytes the
+* request will take. A new connection is read a v2 header's worth at a time
+* until its first bytes show which format the client speaks.
+*/
+
+static unsigned cmd_want(Sock_Entry *se, uint8_t **buf)
+{
+	Wire_Header hdr;
+
+	switch(se->mode){
+		case CMD_V2:
+			*buf = se->wire_in;
+			if(se->in_done < WIRE_HDR_LEN)
+				return WIRE_HDR_LEN;
+			wire_header(se->wire_in, &hdr);
+			return WIRE_HDR_LEN + hdr.length;
+
+		case CMD_SESSION:
+			*buf = (uint8_t *) se->in;
+			return sizeof(Client_Tagged_Command);
+
+		case CMD_SNIFF:
+			*buf = (uint8_t *) &se->in->cc;
+			return WIRE_HDR_LEN;
+
+		default:
+			*buf = (uint8_t *) &se->in->cc;
+			return sizeof(Client_Command);
+	}
+}
+
+
+/*
+* Look at what has been read of the current request. Returns PASS if the
+* connection is still good, FAIL if the client sent something unusable.
+*/
+
+static int cmd_check_input(Sock_Entry *se)
+{
+	Wire_Header hdr;
+	uint8_t *p = (uint8_t *) &se->in->cc;
+
+	if((se->mode == CMD_SNIFF) && (se->in_done == WIRE_HDR_LEN)){
+		if((p[0] != WIRE_MAGIC0) || (p[1] != WIRE_MAGIC1)){
+			se->mode = CMD_LEGACY;
+			return PASS;
+		}
+		if((se->wire_in = malloc(WIRE_MAX_MSG)) == NULL){
+			debug(DEBUG_UNEXPECTED, "Out of memory for v2 command connection");
+			return FAIL;
+		}
+		debug(DEBUG_STATUS, "Client speaks wire format v2");
+		memcpy(se->wire_in, p, WIRE_HDR_LEN);
+		se->mode = CMD_V2;
+	}
+	if((se->mode == CMD_V2) && (se->in_done == WIRE_HDR_LEN) && wire_header(se->wire_in, &hdr)){
+		debug(DEBUG_UNEXPECTED, "Bad v2 header on command connection");
+		return FAIL;
+	}
+	return PASS;
+}
+
+
+/*
+* Write what can be written, then decide what to wait for next. progress
+* is TRUE if bytes have moved already this time round.
+*/
+
+static void cmd_socket_update(Sock_Entry *se, int progress)
+{
+	if(cmd_flush(se, &progress)){
+		close_socket(se);
+		return;
+	}
+
+	/* All done? Close the user's socket. */
+
+	if(se->closing && !se->busy && (se->out_len == 0)){
+		close_socket(se);
+		debug(DEBUG_STATUS, "User socket closed");
+		return;
+	}
+
+	evloop_modify(&se->h, ((!se->closing && !cmd_backlogged(se)) ? EPOLLIN : 0) |
+		((se->out_len > se->out_done) ? EPOLLOUT : 0));
+	cmd_socket_arm(se, progress);
+}
+
+
+/*
+* Command socket event. Read the client requests, execute them, and return
+* the results. A session or v2 connection keeps reading while it has
+* requests pipelined, until too many responses are waiting on the client.
+*/
+
+static void handle_cmd_socket(Ev_Handler *h, uint32_t events)
+{
+	Sock_Entry *se = h->ctx;
+	unsigned want;
+	uint8_t *buf;
+	int progress = FALSE;
+	ssize_t n;
+
+	if((events & EPOLLOUT) && cmd_flush(se, &progress)){
+		close_socket(se);
+		return;
+	}
+
+	while(!se->closing && !cmd_backlogged(se)){
+		want = cmd_want(se, &buf);
+		n = read(h->fd, buf + se->in_done, want - se->in_done);
+		if(n > 0){
+			progress = TRUE;
+			se->in_done += n;
+			if(cmd_check_input(se)){
+				close_socket(se);
+				return;
+			}
+			if(se->in_done < cmd_want(se, &buf))
+				continue;
+			se->in_done = 0;
+			cmd_execute(se);
+			if(!h->active)
+				return;
+			continue;
+		}
+		if(n == 0){
+			if(se->in_done || ((se->mode != CMD_SESSION) && (se->mode != CMD_V2)))
+				debug(DEBUG_UNEXPECTED, "User command socket closed early");
+			se->closing = TRUE;
+			se->in_done = 0;
+			break;
+		}
+		if(errno == EINTR)
+			continue;
+		if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			break;
+		debug(DEBUG_UNEXPECTED, "User command socket read error: %s", strerror(errno));
+		close_socket(se);
+		return;
+	}
+
+	cmd_socket_update(se, progress);
+}
+
+
+/*
+* Convert two hex digits into an unsigned char
+*/
+
+static unsigned char h2touc(char *s, char *err)
 {
 	unsigned char res;
 	int i;
@@ -1219,194 +2417,938 @@ static unsigned char h2touc(char *s, char *err)
 		else
 			*err |= 1;
 	}
-	return res;
+	return res;
+}
+
+
+
+
+/*
+* Parse a text command into a packet for the bus thread
+*/
+
+static int parse_text_command(Han_Packet *packet, char *line, int len)
+{
+	int i;
+	char err = 0;
+
+	if(len & 1){
+		debug(DEBUG_UNEXPECTED, "Command string must have an even number of bytes");
+		return FAIL;
+	}
+	if((len < 4) || (len > (4 + (MAX_PARAMS * 2)))){
+		debug(DEBUG_UNEXPECTED, "Command string has too few or too many digits");
+		return FAIL;
+	}
+	packet->nodeaddress = h2touc(line, &err);
+	packet->nodecommand = h2touc(line+2, &err);
+	for(i = 0; i < (len - 4); i++){
+		packet->nodeparams[i] = h2touc(line + 4 + (i << 1), &err);
+	}
+	packet->numnodeparams = ((len - 4) >> 1);
+	if(err)
+		return FAIL;
+
+	debug(DEBUG_EXPECTED, "Address: 0x%02X, Command: 0x%02X Number of node parameters: %i", packet->nodeaddress, packet->nodecommand, packet->numnodeparams);
+	return PASS;
+}
+
+
+/*
+* Format the result of a node command as a text socket reply. rs must have
+* room for 64 bytes.
+*/
+
+static void text_result(char *rs, const Han_Packet *packet, int status)
+{
+	int i;
+
+	if(status != HAN_CSTS_OK)
+		sprintf(rs, "CE%02X", -status);
+	else{
+		sprintf(rs,"RS%02X%02X",packet->nodeaddress, packet->nodecommand);
+		for(i = 0; i < packet->numnodeparams; i++)
+			sprintf(rs + ((i + 3) << 1),"%02X", packet->nodestatus[i]);
+	}
+}
+
+
+/*
+* A text command came back from the bus thread. Send the result, and go
+* back to reading commands from the socket.
+*/
+
+static void text_bus_done(Bus_Req *r)
+{
+	Sock_Entry *se = r->se;
+	char rs[64];
+
+	if(!se->h.active)
+		return;
+
+	text_result(rs, &r->cc.cmd.pkt, r->cc.commstatus);
+	text_reply(se, r->tagged, r->tag, "%s\n", rs);
+}
+
+
+/*
+* Parse the watch in a WA text command. It is the node command as for CA,
+* then after colons the interval in msec, and optionally the byte offset
+* and B, I or U type of the value to watch and its deadband, as in
+* 0612000000:1000:3I:4.
+*/
+
+static int parse_text_watch(Han_Watch_Entry *we, char *line, int len)
+{
+	Han_Packet packet;
+	unsigned long interval, offset = 0, deadband = 0;
+	char *colon, *end, type = 0;
+
+	memset(&packet, 0, sizeof(Han_Packet));
+	if(((colon = memchr(line, ':', len)) == NULL) || parse_text_command(&packet, line, colon - line))
+		return FAIL;
+	interval = strtoul(colon + 1, &end, 10);
+	if((end == colon + 1) || (*end && (*end != ':')))
+		return FAIL;
+	if(*end){
+		colon = end;
+		offset = strtoul(colon + 1, &end, 10);
+		if((end == colon + 1) || !*end || !strchr("BIU", *end))
+			return FAIL;
+		type = *end++;
+		if(*end){
+			colon = end;
+			deadband = strtoul(colon + 1, &end, 10);
+			if((*colon != ':') || (end == colon + 1) || *end)
+				return FAIL;
+		}
+	}
+	if((interval > UINT32_MAX) || (offset >= MAX_NODE_PARAMS) || (deadband > UINT32_MAX))
+		return FAIL;
+
+	memset(we, 0, sizeof(Han_Watch_Entry));
+	we->addr = packet.nodeaddress;
+	we->cmd = packet.nodecommand;
+	we->numparams = packet.numnodeparams;
+	memcpy(we->params, packet.nodeparams, packet.numnodeparams);
+	we->interval = (unsigned) interval;
+	we->type = (unsigned char) type;
+	we->offset = (unsigned char) offset;
+	we->deadband = (unsigned) deadband;
+	return PASS;
+}
+ 
+
+/*
+* Parse the filter in an IE text command. It is an optional node address,
+* or range of them, in hex, then optionally a colon and a reason code mask
+* in hex, as in 06, 10-1F or 06:01. Without an address it is every node,
+* and without a mask every reason code.
+*/
+
+static int parse_text_filter(char *line, unsigned *lo, unsigned *hi, unsigned *mask)
+{
+	unsigned long v;
+	char *p = line, *end;
+
+	*lo = 0;
+	*hi = 255;
+	*mask = ISUB_ANY_REASON;
+	if(*p && (*p != ':')){
+		v = strtoul(p, &end, 16);
+		if((end == p) || (v > 255))
+			return FAIL;
+		*lo = *hi = (unsigned) v;
+		p = end;
+		if(*p == '-'){
+			v = strtoul(++p, &end, 16);
+			if((end == p) || (v > 255) || (v < *lo))
+				return FAIL;
+			*hi = (unsigned) v;
+			p = end;
+		}
+	}
+	if(*p == ':'){
+		v = strtoul(++p, &end, 16);
+		if((end == p) || (v > 255) || !v)
+			return FAIL;
+		*mask = (unsigned) v;
+		p = end;
+	}
+	return *p ? FAIL : PASS;
+}
+
+
+/*
+* Process a command received from a text socket
+*/
+
+
+static void text_command(Sock_Entry *se, char *line, int len)
+{
+	int i,err = 0, tagged = FALSE;
+	Bus_Req *r;
+	Han_Watch_Entry we;
+	unsigned id, lo, hi, mask;
+	unsigned long tag = 0;
+	char *end;
+
+	/* A command can have a tag in front, as in #42 CA0612..., which is put in front of its reply */
+
+	if(*line == '#'){
+		tag = strtoul(line + 1, &end, 10);
+		if((line[1] < '0') || (line[1] > '9') || (*end != ' ') || (tag > UINT32_MAX)){
+			text_reply(se, FALSE, 0, "ER\n");
+			return;
+		}
+		for(tagged = TRUE; *end == ' '; end++);
+		len -= (int)(end - line);
+		line = end;
+	}
+
+	if(len >= 2){
+		for(i = 0; i < NUM_TEXT_CMDS; i++){
+			if(!strncmp(line, text_commands[i], 2))
+				break;
+		}
+		if(i == NUM_TEXT_CMDS)
+			err = 1;
+	}
+	else
+		err = 1;
+	
+	if(!err){
+		switch(i){
+			case TC_CA:
+				if((r = calloc(1, sizeof(Bus_Req))) == NULL){
+					err = 1;
+					break;
+				}
+				r->type = BUS_TEXT;
+				r->prio = HAN_PRIO_INTERACTIVE;
+				r->tag = (uint32_t) tag;
+				r->tagged = (uint8_t) tagged;
+				r->cc.request = HAN_CCMD_SENDPKT;
+				if((err = parse_text_command(&r->cc.cmd.pkt, line + 2, len - 2))){
+					free(r);
+					break;
+				}
+				if(cache_lookup(&r->cc.cmd.pkt, evloop_now())){
+					r->se = se;
+					text_bus_done(r);
+					free(r);
+					return;
+				}
+
+				/*
+				* Untagged, stop reading until the reply is out, so replies stay in
+				* order. Tagged, carry on with the commands after it.
+				*/
+
+				bus_submit(r, se);
+				se->awaiting = !tagged;
+				text_socket_update(se);
+				return;
+			case TC_IE:
+				if(!(err = parse_text_filter(line + 2, &lo, &hi, &mask)))
+					err = isub_add(se, lo, hi, mask);
+				break;
+			case TC_ID:
+				isub_drop(se);
+				break;
+			case TC_WA:
+				if((err = parse_text_watch(&we, line + 2, len - 2)) || (err = watch_add(&we, se, 0)))
+					break;
+				text_reply(se, tagged, (uint32_t) tag, "WA%04X\n", we.id);
+				return;
+			case TC_WC:
+				id = (unsigned) strtoul(line + 2, &end, 16);
+				err = (len == 2) || *end || watch_cancel(id, se);
+				break;
+			default:
+				err = 1;
+				break;
+		}
+	}
+
+	if(err){
+		text_reply(se, tagged, (uint32_t) tag, "ER\n");
+	}
+	else
+		text_reply(se, tagged, (uint32_t) tag, "OK\n");
+	return;
+}
+
+
+/*
+* Ask an interrupting node why, and pass the answer to the network loop
+* for the text sockets. seen is when the bus thread found the request.
+* Runs on the bus thread.
+*/
+
+static void process_interrupt_packet(uint8_t *buffer, int len, uint64_t seen)
+{
+	int res;
+	Bus_Req *r;
+	Han_Packet *packet;
+
+	debug(DEBUG_EXPECTED, "Got interrupt packet from address %u", (unsigned) buffer[1]);
+	health_answered(buffer[1]);
+	inventory_set_attr(buffer[1], NR_INTRX | ((len == 4) ? NR_CRC16 : 0));
+	inventory_seen(buffer[1]);
+	debug_hexdump(DEBUG_EXPECTED, buffer, len,"Packet Bytes: ");
+
+	if((r = calloc(1, sizeof(Bus_Req))) == NULL){
+		debug(DEBUG_UNEXPECTED, "Out of memory for interrupt report");
+		return;
+	}
+	r->type = BUS_INTERRUPT;
+	packet = &r->cc.cmd.pkt;
+
+	packet->nodeaddress = buffer[1];
+	packet->nodecommand  = HAN_CMD_GIST;
+	packet->nodeparams[0] = packet->nodeparams[1] = packet->nodeparams[2] = 0;
+	packet->numnodeparams = 3;
+	
+	// Retrive IRQ Reason from interruptor
+	sched_served(HAN_PRIO_INTERRUPT, (unsigned)(evloop_now() - seen), FALSE);
+	res = handSend(hanio, packet);
+	if(res == HAN_CSTS_OK)
+		debug(DEBUG_EXPECTED, "Interrupt reason code: 0x%02X", packet->nodestatus[0]);
+	else
+		debug(DEBUG_UNEXPECTED, "Communications status error during interrupt acknowledge, code = %d", res);
+
+	// Send message to listening sockets
+
+	r->cc.commstatus = res;
+	bus_post(r);
+}
+
+/*
+* Send a broadcast enum packet over the network
+*/
+
+void send_broadcast_enum(void)
+{
+	Han_Packet packet;
+
+	packet.nodeaddress = 0xFF;
+	packet.nodecommand  = BCP_ENUM;
+	packet.numnodeparams = 0;
+
+	handTransmitPacket(hanio, &packet, 0, NULL);
+
+}
+
+
+
+/*
+* Serial port input on the bus thread, between transactions. Get the data
+* bytes, and decode every packet they hold.
+*/
+
+static void bus_serial_input(void)
+{
+	int res, bufcount;
+	uint8_t buffer[FRAME_MAX_LEN];
+	uint64_t start = evloop_now();
+
+	do {
+		res = handPollForResponse();
+
+		if(!hanio) /* If no serial port, there isn't much sense in going on */
+			break;
+
+		if(res){ /* If packet received */
+			bufcount = rx_frame.len;
+			memcpy(buffer, rx_frame.buf, bufcount);
+			handResetReceiver();
+			if(buffer[0] == HDCINTRQ){
+				if(crc8(buffer , bufcount))
+					debug(DEBUG_UNEXPECTED,"Bad CRC8 on interrupt packet");
+				else
+					process_interrupt_packet(buffer, bufcount, start);
+			}
+			else if (buffer[0] == HDCINTRQ16){
+				if(packetCheck16(buffer, bufcount))
+					debug(DEBUG_UNEXPECTED,"Bad CRC16 on interrupt packet");
+				else
+					process_interrupt_packet(buffer, bufcount, start);
+			}
+			else
+				debug_hexdump(DEBUG_ACTION, buffer, bufcount, "Invalid packet received: ");
+		}
+	} while(res && hanio && hanio_rx_pending(hanio));
+	fold_io_stats();
+}
+
+
+/*
+* Return TRUE if there is serial port input waiting, which between
+* transactions can only be a node asking for attention
+*/
+
+static int bus_rx_ready(void)
+{
+	struct pollfd pfd;
+
+	if(rx_frame.ready || hanio_rx_pending(hanio))
+		return TRUE;
+	pfd.fd = hanio->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return (poll(&pfd, 1, 0) > 0) ? TRUE : FALSE;
+}
+
+
+/*
+* Bus thread. Carries out the transactions queued by the network loop one
+* at a time in priority order, and listens for interrupt requests from the
+* nodes in between. Nothing else touches the serial port while it runs.
+*/
+
+static void *bus_thread(void *arg)
+{
+	struct pollfd pfd[2];
+	Mpscq_Node *node;
+	Sched_Item *it;
+	Bus_Req *r;
+	eventfd_t count;
+	uint64_t now;
+	unsigned addr;
+	int timeout, flush, quit = FALSE;
+
+	/* Send one broadcast enum packet to set up CRC16 transfers on capable nodes */
+
+	if(hanio)
+		send_broadcast_enum();
+
+	for(;;){
+		now = evloop_now();
+		while((node = mpscq_pop(&bus_requests)) != NULL){
+			r = (Bus_Req *) node;
+			if(r->type == BUS_QUIT){
+				quit = TRUE;
+				free(r);
+				continue;
+			}
+			if((r->type == BUS_COMMAND) && (r->cc.request == HAN_CCMD_NETSCAN)){
+				scan_request(r);
+				continue;
+			}
+			if(!coalesce_join(r))
+				sched_add(&r->item, r->prio, now);
+		}
+
+		/* Nodes asking for attention go first, unless a request has waited too long */
+
+		if(!(it = sched_overdue(now)) && hanio && bus_rx_ready()){
+			bus_serial_input();
+			continue;
+		}
+
+		/* Then the waiting requests, one at a time so the above gets a look in between */
+
+		if(it || (it = sched_take(now))){
+			r = (Bus_Req *)((char *) it - offsetof(Bus_Req, item));
+			coalesce_close(r);
+			bus_command(&r->cc);
+			coalesce_post(r);
+			bus_post(r);
+			continue;
+		}
+
+		/* Once everything asked for before the quit is done, stop */
+
+		if(quit){
+			if(scan_state == SCAN_RUNNING)
+				scan_end(HAN_CSTS_SCAN_CANCELED);
+			inventory_flush(TRUE);
+			return NULL;
+		}
+
+		/* Check on a down node if one is due, then look for requests again */
+
+		timeout = -1;
+		if(hanio && ((timeout = health_next_probe(evloop_now(), &addr)) == 0)){
+			handProbeNode(hanio, addr);
+			continue;
+		}
+
+		/* Or take the next step of a network scan, without waiting for anything else */
+
+		if(scan_state == SCAN_RUNNING){
+			if(!hanio)
+				scan_end(HAN_CSTS_SERIAL_DISCONNECT);
+			else{
+				scan_step();
+				timeout = 0;
+			}
+		}
+
+		/* Write the inventory once its changes have waited long enough */
+
+		if(((flush = inventory_flush(FALSE)) >= 0) && ((timeout < 0) || (flush < timeout)))
+			timeout = flush;
+
+		/* Keep trying to get the serial port back */
+
+		if(!hanio){
+			now = evloop_now();
+			if(now >= bus_reopen_at){
+				if(serial_open()){
+					debug(DEBUG_UNEXPECTED, "Serial port open failed, retrying...");
+					bus_reopen_at = now + SERIAL_PORT_OPEN_RETRY_TIME * 1000;
+				}
+				else{
+					debug(DEBUG_ACTION, "Serial port reopened successfully");
+					continue;
+				}
+			}
+			timeout = (int)(bus_reopen_at - now);
+		}
+
+		pfd[0].fd = bus_request_fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = hanio ? hanio->fd : -1;
+		pfd[1].events = POLLIN;
+		pfd[0].revents = pfd[1].revents = 0;
+
+		if((poll(pfd, 2, timeout) < 0) && (errno != EINTR))
+			fatal_with_reason(errno, "Bus thread poll failed");
+
+		if(pfd[0].revents & POLLIN)
+			eventfd_read(bus_request_fd, &count);
+		if(hanio && (pfd[1].revents & (POLLIN | POLLHUP | POLLERR)))
+			bus_serial_input();
+	}
+	return NULL;
 }
 
 
+/*
+* Hand a request to the bus thread. se is the connection to answer, or NULL.
+*/
+
+static void bus_submit(Bus_Req *r, Sock_Entry *se)
+{
+	r->se = se;
+	if(se)
+		se->busy++;
+	mpscq_push(&bus_requests, &r->node);
+	if(eventfd_write(bus_request_fd, 1))
+		fatal_with_reason(errno, "Could not wake the bus thread");
+}
 
 
 /*
-* Parse a text command into a Client Command Structure
+* Send the command for a sample out on the bus, as bulk work. The result
+* goes to the sampler. Returns FAIL if it couldn't be sent.
 */
 
-static int parse_text_command(char *rs, char *line, int len)
+static int bus_sample(unsigned series, const Han_Packet *pkt)
 {
-	Han_Packet packet;
-	int i,res;
-	char err = 0;
-
-	memset(&packet, 0, sizeof(Han_Packet));
+	Bus_Req *r;
 
-	if(len & 1){
-		debug(DEBUG_UNEXPECTED, "Command string must have an even number of bytes");
+	if((r = calloc(1, sizeof(Bus_Req))) == NULL){
+		debug(DEBUG_UNEXPECTED, "Out of memory for a sample");
 		return FAIL;
 	}
-	if((len < 4) || (len > (4 + (MAX_PARAMS * 2)))){
-		debug(DEBUG_UNEXPECTED, "Command string has too few or too many digits");
+	r->type = BUS_SAMPLE;
+	r->tag = series;
+	r->prio = HAN_PRIO_BULK;
+	r->cc.request = HAN_CCMD_SENDPKT;
+	r->cc.cmd.pkt = *pkt;
+	bus_submit(r, NULL);
+	return PASS;
+}
+
+
+/*
+* Send the command for a watched target out on the bus, as bulk work. The
+* result goes to the watches. Returns FAIL if it couldn't be sent.
+*/
+
+static int bus_watch(unsigned target, const Han_Packet *pkt)
+{
+	Bus_Req *r;
+
+	if((r = calloc(1, sizeof(Bus_Req))) == NULL){
+		debug(DEBUG_UNEXPECTED, "Out of memory for a watch");
 		return FAIL;
 	}
-	packet.nodeaddress = h2touc(line, &err);
-	packet.nodecommand = h2touc(line+2, &err);
-	for(i = 0; i < (len - 4); i++){
-		packet.nodeparams[i] = h2touc(line + 4 + (i << 1), &err);
-	}
-	packet.numnodeparams = ((len - 4) >> 1);
-	if(!err){
-		debug(DEBUG_EXPECTED, "Address: 0x%02X, Command: 0x%02X Number of node parameters: %i", packet.nodeaddress, packet.nodecommand, packet.numnodeparams);
+	r->type = BUS_WATCH;
+	r->tag = target;
+	r->prio = HAN_PRIO_BULK;
+	r->cc.request = HAN_CCMD_SENDPKT;
+	r->cc.cmd.pkt = *pkt;
+	bus_submit(r, NULL);
+	return PASS;
+}
 
-		if((res =handSend(hanio, &packet)) != HAN_CSTS_OK){
-			sprintf(rs, "CE%02X", -res);
-			return 0;
-		}
 
-		sprintf(rs,"RS%02X%02X",packet.nodeaddress, packet.nodecommand);
+/*
+* Pass a change a watch has seen to its connection. A command connection
+* which isn't keeping up with its responses is told on a later look at
+* the node instead.
+*/
+
+static int notify_watcher(void *owner, uint32_t tag, const Han_Watch_Entry *ev)
+{
+	Sock_Entry *se = owner;
+	Client_Command cc;
+	Han_Packet packet;
+	char rs[64];
+
+	if(!se->h.active)
+		return FAIL;
 
-		for(i = 0; i < packet.numnodeparams; i++)
-			sprintf(rs + ((i + 3) << 1),"%02X", packet.nodestatus[i]);
+	if(se->type == FD_CONNECTED_TEXT){
+		packet.nodeaddress = ev->addr;
+		packet.nodecommand = ev->cmd;
+		packet.numnodeparams = ev->numparams;
+		memcpy(packet.nodestatus, ev->values, ev->numparams);
+		if(se->tq.count >= conf_text_queue)
+			return FAIL;
+		text_result(rs, &packet, ev->status);
+		text_reply(se, FALSE, 0, "EW%04X%s\n", ev->id, rs);
 		return PASS;
 	}
-	else
+
+	if(cmd_backlogged(se))
 		return FAIL;
+	memset(&cc, 0, sizeof(Client_Command));
+	cc.request = HAN_CCMD_WATCH;
+	cc.commstatus = HAN_CSTS_OK;
+	cc.cmd.watch = *ev;
+	if(cmd_respond(se, &cc, tag) == PASS)
+		cmd_socket_update(se, FALSE);
+	return PASS;
+}
 
 
+/*
+* Pass a finished request back to the network loop. Runs on the bus thread.
+*/
 
+static void bus_post(Bus_Req *r)
+{
+	mpscq_push(&bus_completions, &r->node);
+	if(eventfd_write(bus_completion_handler.fd, 1))
+		fatal_with_reason(errno, "Could not wake the network loop");
 }
- 
+
 
 /*
-* Process a command received from a text socket
+* Requests are back from the bus thread. Send the results on their way.
 */
 
-
-static void text_command(int sockindex, char *line, int len)
+static void handle_bus_completions(Ev_Handler *h, uint32_t events)
 {
-	int i,err = 0, s;
-	char rs[64];
+	Mpscq_Node *node;
+	Bus_Req *r;
+	Textq_Msg *m;
+	eventfd_t count;
 
-	rs[0] = 0;
-	
-	s = pollfd[sockindex].fd;
+	eventfd_read(bus_completion_handler.fd, &count);
 
-	if(len >= 2){
-		for(i = 0; i < NUM_TEXT_CMDS; i++){
-			if(!strncmp(line, text_commands[i], 2))
+	while((node = mpscq_pop(&bus_completions)) != NULL){
+		r = (Bus_Req *) node;
+		if(r->se && (r->type != BUS_PROGRESS))
+			r->se->busy--;
+
+		/* Keep the responses which can be cached, and drop those the request made stale */
+
+		if((r->type == BUS_COMMAND) || (r->type == BUS_TEXT) || (r->type == BUS_SAMPLE) || (r->type == BUS_WATCH))
+			cache_result(&r->cc, evloop_now());
+
+		switch(r->type){
+			case BUS_COMMAND:
+			case BUS_PROGRESS:
+				if(r->se->h.active && (cmd_respond(r->se, &r->cc, r->tag) == PASS))
+					cmd_socket_update(r->se, FALSE);
 				break;
-		}
-		if(i == NUM_TEXT_CMDS)
-			err = 1;
-	}
-	else
-		err = 1;
-	
-	if(!err){
-		switch(i){
-			case TC_CA:
-				err = parse_text_command(rs, line + 2, len - 2);
+
+			case BUS_TEXT:
+				if(!r->tagged)
+					r->se->awaiting = FALSE;
+				text_bus_done(r);
+				text_input(r->se);
 				break;
-			case TC_IE:
-				intreportingena[sockindex] = 1;
+
+			case BUS_SAMPLE:
+				sampler_record(r->tag, &r->cc, evloop_now());
 				break;
-			case TC_ID:
-				intreportingena[sockindex] = 0;
+
+			case BUS_WATCH:
+				watch_result(r->tag, &r->cc);
 				break;
-			default:
-				err = 1;
+
+			case BUS_INTERRUPT:
+				cache_invalidate(r->cc.cmd.pkt.nodeaddress);
+				if((m = textq_msg(TRUE, "EI%02X%02X%02X%02X\n", r->cc.cmd.pkt.nodeaddress, r->cc.cmd.pkt.nodestatus[0],
+					r->cc.cmd.pkt.nodestatus[1], r->cc.cmd.pkt.nodestatus[2])) == NULL)
+					break;
+
+				/* Without the reason code, only those taking every reason get it */
+
+				isub_fanout(r->cc.cmd.pkt.nodeaddress, (r->cc.commstatus == HAN_CSTS_OK) ? r->cc.cmd.pkt.nodestatus[0] : 0,
+					text_event, m);
+				textq_release(m);
 				break;
 		}
+		free(r);
 	}
-	if(err){
-		dprintf(s, "ER\n");
-	}
-	else if(rs[0])
-		dprintf(s, "%s\n", rs);
-	else
-		dprintf(s, "OK\n");
-	return;
 }
 
 
 /*
-* Return the poll index for the supplied key
+* Pick up where the last run left off from the inventory file. Nodes known
+* to do CRC16 are spoken to that way straight away, response timeouts start
+* from the times learned before, and network scans are answered from the
+* nodes identified until a refresh is asked for.
 */
 
-static int fd_index(int key)
+static void bus_warm_start(void)
 {
-	int i;
-	for(i = 0; i < POLL_MAX_COUNT; i++){
-		if(key == fdtype[i]){
-			return i;
+	Node_Rec *nr;
+	unsigned i, j;
+
+	scan_state = SCAN_IDLE;
+	memset(&scan_result, 0, sizeof(Han_Netscan));
+	if(inventory_open(conf_inventory_path) <= 0)
+		return;
+
+	for(i = 0, j = 0; i <= max_node_addr && i < 256; i++){
+		nr = noderec_get(i);
+		if(nr->flags & NR_IDENTIFIED){
+			scan_result.nodelist[j].addr = (unsigned char) i;
+			scan_result.nodelist[j].type = nr->type;
+			scan_result.nodelist[j].fwlevel = nr->fwlevel;
+			j++;
 		}
 	}
-	return -1;
+	if(j){
+		scan_result.numnodesfound = j;
+		scan_result.lastaddr = (unsigned char) max_node_addr;
+		scan_state = SCAN_DONE;
+	}
 }
 
+
 /*
-* Send interrupt packets to text sockets
+* Start the bus thread. It takes over the serial port opened by fd_setup().
 */
 
-static void process_interrupt_packet(uint8_t *buffer, int len)
+static int bus_start(void)
 {
-	int res;
-	Han_Packet packet;
+	sigset_t all, old;
+	int fd, res;
+
+	if(bus_request_fd == -1){
+		mpscq_init(&bus_requests);
+		mpscq_init(&bus_completions);
+		if((bus_request_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+			return FAIL;
+		if((fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+			return FAIL;
+		if(evloop_add(&bus_completion_handler, fd, EPOLLIN, handle_bus_completions, NULL))
+			return FAIL;
+	}
 
-	node_attributes[buffer[1]] |= NC_INTRX;
+	rtt_limits(conf_min_response_time * 1000, conf_max_response_time * 1000);
+	health_config(conf_down_after, conf_probe_interval);
+	sched_config(conf_max_queue_wait);
+	cache_config(conf_cache_ttl);
+	sampler_store(conf_store_dir, conf_store_interval, conf_store_days);
+	if(sampler_config(conf_poll_series, conf_poll_count, conf_poll_history, bus_sample))
+		return FAIL;
+	watch_init(bus_watch, notify_watcher);
+	bus_warm_start();
 
-	if(len == 4)
-		node_attributes[buffer[1]] |= NC_CRC16;
-	else
-		node_attributes[buffer[1]] &= ~NC_CRC16;
+	/* Signals are for the network loop. Block them all in the bus thread. */
 
-	debug(DEBUG_EXPECTED, "Got interrupt packet from address %u", (unsigned) buffer[1]);
-	debug_hexdump(DEBUG_EXPECTED, buffer, len,"Packet Bytes: ");
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	res = pthread_create(&bus_tid, NULL, bus_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if(res){
+		debug(DEBUG_UNEXPECTED, "Could not create the bus thread: %s", strerror(res));
+		return FAIL;
+	}
+	bus_running = TRUE;
+	return PASS;
+}
 
-	packet.nodeaddress = buffer[1];
-	packet.nodecommand  = HC_GIST;
-	packet.nodeparams[0] = packet.nodeparams[1] = packet.nodeparams[2] = 0;
-	packet.numnodeparams = 3;
-	
-	// Retrive IRQ Reason from interruptor
-	res = handSend(hanio, &packet);
-	if(res == HAN_CSTS_OK)
-		debug(DEBUG_EXPECTED, "Interrupt reason code: 0x%02X", packet.nodestatus[0]);
-	else
-		debug(DEBUG_UNEXPECTED, "Communications status error during interrupt acknowledge, code = %d", res);
 
-	// Send message to listening sockets
+/*
+* Stop the bus thread once it has finished the requests it has been given,
+* and deal with their results. The serial port is the network loop's again
+* afterwards.
+*/
 
-	ts_printf("EI%02X%02X%02X%02X\n", packet.nodeaddress, packet.nodestatus[0],packet.nodestatus[1], packet.nodestatus[2]);
+static void bus_stop(void)
+{
+	Bus_Req *r;
+
+	if(!bus_running)
+		return;
+	if((r = calloc(1, sizeof(Bus_Req))) == NULL)
+		fatal("Out of memory stopping the bus thread");
+	r->type = BUS_QUIT;
+	bus_submit(r, NULL);
+	pthread_join(bus_tid, NULL);
+	bus_running = FALSE;
+	handle_bus_completions(&bus_completion_handler, EPOLLIN);
+}
 
-	return;
+
+/*
+* Connection waiting on a listening socket. Accept every one which is
+* pending, not just the first.
+*/
+
+static void handle_listen_socket(Ev_Handler *h, uint32_t events)
+{
+	Sock_Entry *se = h->ctx;
+	struct sockaddr_storage peerAddress;
+	socklen_t peerAddressSize;
+	char addrstr[INET6_ADDRSTRLEN];
+	char *kind = (se->type == FD_UNIX_CMD) ? "unix" : ((se->type == FD_INET_CMD) || (se->type == FD_INET_TEXT)) ? "ipv4" : "ipv6";
+	int user_socket;
+
+	/* A serial port failure while running a command closes this socket too */
+
+	while(h->active){
+		peerAddressSize = sizeof(struct sockaddr_storage);
+		user_socket = accept(h->fd, (struct sockaddr *) &peerAddress, &peerAddressSize);
+		if(user_socket == -1){
+			if((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+				debug(DEBUG_UNEXPECTED, "Could not do accept on %s socket: %s", kind, strerror(errno));
+			return;
+		}
+
+		switch(se->type){
+			case FD_UNIX_CMD:
+				debug(DEBUG_STATUS, "Accepting socket connection");
+				add_cmd_socket(user_socket);
+				break;
+
+			case FD_INET_CMD:
+			case FD_INET6_CMD:
+				debug(DEBUG_STATUS, "Accepting %s command socket connection from %s", kind, inet_ntop(peerAddress.ss_family, munge_ip_address(&peerAddress), addrstr, sizeof(addrstr)));
+				add_cmd_socket(user_socket);
+				break;
+
+			default:
+				debug(DEBUG_STATUS, "Accepting %s text socket connection from %s", kind, inet_ntop(peerAddress.ss_family, munge_ip_address(&peerAddress), addrstr, sizeof(addrstr)));
+
+				/* Monitor sockets must be non-blocking */
+
+				if(fcntl(user_socket, F_SETFL, O_NONBLOCK) == -1) {
+					fatal("Could not set text socket to non-blocking: %s", strerror(errno));
+				}
+
+				if(add_text_socket(user_socket))
+					close(user_socket);
+				break;
+		}
+	}
 }
 
+
 /*
-* Send a broadcast enum packet over the network
+* Carry out the commands a text socket has sent, as far as there are whole
+* lines of them. A line can end with CR, LF or both. Stops while a command
+* is out with the bus thread, or while the client is behind reading the
+* replies, and is called again once they're done. A partial line is kept
+* for the rest of it to come.
 */
 
-void send_broadcast_enum(void)
+static void text_input(Sock_Entry *se)
 {
-	Han_Packet packet;
+	char *line, *p, *end;
 
-	packet.nodeaddress = 0xFF;
-	packet.nodecommand  = BCP_ENUM;
-	packet.numnodeparams = 0;
+	while(se->h.active && text_ready(se)){
+		line = se->line + se->line_start;
+		end = se->line + se->line_len;
+		for(p = line; (p < end) && (*p != '\r') && (*p != '\n'); p++);
+		if(p == end)
+			break;
+		*p = 0;
+		se->line_start = (unsigned)(p + 1 - se->line);
+		if(se->line_skip){
+			se->line_skip = FALSE;
+			text_reply(se, FALSE, 0, "ER\n");
+		}
+		else if(p > line)
+			text_command(se, line, (int)(p - line));
+	}
 
-	handTransmitPacket(hanio, &packet, 0);
+	/* Move what's left to the start, and throw away a line which can't fit */
 
+	if(se->line_start){
+		memmove(se->line, se->line + se->line_start, se->line_len - se->line_start);
+		se->line_len -= se->line_start;
+		se->line_start = 0;
+	}
+	if(se->line_len == TEXT_LINE_MAX){
+		for(p = se->line; (p < se->line + TEXT_LINE_MAX) && (*p != '\r') && (*p != '\n'); p++);
+		if(p == se->line + TEXT_LINE_MAX){
+			debug(DEBUG_UNEXPECTED, "Text socket command too long");
+			se->line_len = 0;
+			se->line_skip = TRUE;
+		}
+	}
 }
 
 
+/*
+* Service a text socket. Whatever has arrived is read in one go, and every
+* whole command in it is carried out.
+*/
+
+static void handle_text_socket(Ev_Handler *h, uint32_t events)
+{
+	Sock_Entry *se = h->ctx;
+	ssize_t res;
+
+	/* Only room to write more? */
+
+	if(!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))){
+		text_socket_update(se);
+		text_input(se);
+		return;
+	}
+
+	/* No room until the commands already read have been done */
+
+	if(se->line_len == TEXT_LINE_MAX){
+		if(events & (EPOLLHUP | EPOLLERR))
+			close_socket(se);
+		return;
+	}
+	if((res = read(h->fd, se->line + se->line_len, TEXT_LINE_MAX - se->line_len)) < 0){
+		if((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+			return;
+		debug(DEBUG_UNEXPECTED,"Read Error on socket: %s", strerror(errno));
+	}
+	if(res < 1){ // A return value of 0 means the far end disconnected, if negative, then a socket read error occured. Remove the socket in both cases.
+		debug(DEBUG_STATUS,"Removing text socket fd %d, res = %d", h->fd, (int) res);
+		close_socket(se);
+		return;
+	}
+	debug(DEBUG_STATUS,"Bytes read: %d\n", (int) res);
+	se->line_len += (unsigned) res;
+	text_input(se);
+}
+
 
 /* Main... */
 int main(int argc, char *argv[]) {
 	int retval;
-	int user_socket;
 	int longindex;
 	int optchar;
-	int si, i, bufcount = 0;
-	char sockrm;
-	static uint8_t buffer[256];
-	
-	
 
 	/* Save the name of the program. */
 	progname=argv[0];
@@ -1508,6 +3450,11 @@ int main(int argc, char *argv[]) {
 		fatal("hand is already running");
 	}
 
+	if(evloop_init())
+		fatal("Could not create the event loop");
+
+	frame_decoder_init(&rx_decoder, handFrameReceived, &rx_frame);
+
 	if(fd_setup())
 		fatal("fd_setup() failed during initialization");
 
@@ -1583,11 +3530,10 @@ int main(int argc, char *argv[]) {
 	sigaction(SIGPIPE, &brkpipe_sig_action, NULL);
 	sigaction(SIGCHLD, &child_sig_action, NULL);
 
-	handPollForResponse(TRUE, NULL, &bufcount); /* Reset receiver */
-
-	/* Send one broadcast enum packet to set up CRC16 transfers on capable nodes */
+	/* Hand the serial port over to the bus thread */
 
-	send_broadcast_enum();
+	if(bus_start())
+		fatal("Could not start the bus thread");
 	
 	/* We loop forever handling input and output. */
 
@@ -1596,241 +3542,15 @@ int main(int argc, char *argv[]) {
 		 * Wait for input to be available. 
 		 */
 		//debug(DEBUG_STATUS, "Waiting for events.");
-		retval=poll(pollfd, num_poll_fds, POLL_TIMEOUT);
-		if(retval == -1) {
-			/* If we are interrupted, determine the cause  */
-			if(errno == EINTR) {
-				if(exitRequest == 1)
-          				hand_exit();
-        			else if(reconfigRequest == 1)
-					 handReconfig();
-       		 		else
-        	  			debug(DEBUG_UNEXPECTED, "EINTR received in poll without a flag, restarting poll.");
-				continue;
-			}
-			/* Nope, poll broke. */
-			fatal_with_reason(errno, "Poll failed");
-		}
-		if(!hanio){ /* If serial port closed */
-			if(serial_port_open_timer)
-				serial_port_open_timer--;
-			else{ /* Attempt to re-open serial port */
-				if(!fd_setup()){
-					handPollForResponse(TRUE, NULL, &bufcount); /* Reset receiver */
-					debug(DEBUG_ACTION, "Serial port reopened successfully");
-				}
-				else{
-					debug(DEBUG_UNEXPECTED, "Serial port open failed, retrying...");	
-					serial_port_open_timer = SERIAL_PORT_OPEN_RETRY_TIME;
-				}
-			}
-			continue;		
-		}
-		
-		if(retval == 0){ /* The poll timed out */
-			continue;
-		}
-		
-
-		si = fd_index(FD_RS485);
-
-		if((si >= 0) && (pollfd[si].revents)) {
-			/* Get the data bytes*/
-			int res = handPollForResponse(FALSE, buffer, &bufcount);
-			
-			if(!hanio) /* If no serial port, there isn't much sense in executing the rest of the main loop */
-				continue;
-				
-			if(res){ /* If packet received */
-				if(buffer[0] == HDCINTRQ){
-					if(calcCRC(buffer , bufcount))
-						debug(DEBUG_UNEXPECTED,"Bad CRC8 on interrupt packet");
-					else
-						process_interrupt_packet(buffer, bufcount);
-				}
-				else if (buffer[0] == HDCINTRQ16){
-					if(packetCheck16(buffer, bufcount))
-						debug(DEBUG_UNEXPECTED,"Bad CRC16 on interrupt packet");
-					else
-						process_interrupt_packet(buffer, bufcount);
-				}
-				else
-						debug_hexdump(DEBUG_ACTION, buffer, bufcount, "Invalid packet received: ");
-				handPollForResponse(TRUE, NULL, &bufcount); /* Reset receiver */
-			}
-				
-		} /* End if serial event */
-		
-		/* 
-		 * Was it a new client connection?
-		 */
-		si = fd_index(FD_UNIX_CMD);
-		if((si >= 0) && (pollfd[si].revents)){
-
-			debug(DEBUG_STATUS, "Accepting socket connection");
-			
-			/* Accept the user connection. */
-			user_socket=accept(pollfd[si].fd, NULL, NULL);
-			if(user_socket == -1) {
-				debug(DEBUG_UNEXPECTED, "Could not accept socket");
-				continue;
-			}
-			if(processClientCommand(user_socket))
-				continue;	/* Got an error, restart at the top */
-		}
-
-		/*
-		 * Was it a new ipv4  command socket connection?
-		 */
-		si = fd_index(FD_INET_CMD);
-		if((si >= 0) && (pollfd[si].revents)){
-			struct sockaddr_storage peerAddress;
-			socklen_t peerAddressSize  = sizeof(struct sockaddr_storage);
-			char addrstr[INET6_ADDRSTRLEN];
-
-			
-			/* Accept the user connection. */
-			user_socket=accept(pollfd[si].fd, (struct sockaddr *) &peerAddress, &peerAddressSize);
-			if(user_socket == -1) {
-				debug(DEBUG_UNEXPECTED, "Could not do accept on ipv4 command socket");
-				continue;
-			}
-
-			debug(DEBUG_STATUS, "Accepting ipv4 command socket connection from %s", inet_ntop(peerAddress.ss_family, munge_ip_address(&peerAddress), addrstr, sizeof(addrstr)));
-			
-			if(processClientCommand(user_socket))
-				continue;
-		}
-
-
-		/*
-		 * Was it a new ipv6 command socket connection?
-		 */
-		si = fd_index(FD_INET6_CMD);
-		if((si >= 0) && (pollfd[si].revents)){
-
-			struct sockaddr_storage peerAddress;
-			socklen_t peerAddressSize = sizeof(struct sockaddr_storage);
-			char addrstr[INET6_ADDRSTRLEN];
-
-			/* Accept the user connection. */
-			user_socket=accept(pollfd[si].fd, (struct sockaddr *) &peerAddress, &peerAddressSize);
-			if(user_socket == -1) {
-				debug(DEBUG_UNEXPECTED, "Could not do accept on ipv6 command socket");
-				continue;
-			}
-
-			debug(DEBUG_STATUS, "Accepting ipv6 command socket connection from %s",  inet_ntop(peerAddress.ss_family, munge_ip_address(&peerAddress), addrstr, sizeof(addrstr)));
-			
-			if(processClientCommand(user_socket))
-				continue;
-		}
-
-		/*
-		* Service text socket
-		*/
-
-		for(i = 0, sockrm = 0; i < num_poll_fds; i++){
-			if(fdtype[i] != FD_CONNECTED_TEXT)
-				continue;
-			else{
-				int res;
-				if(pollfd[i].revents){// Read event on the text socket?
-					if((res = socket_read_line(pollfd[i].fd, (char *) buffer, 80, 1000)) < 0)
-						debug(DEBUG_UNEXPECTED,"Read Error on socket: %s", strerror(errno));
-					if(res < 1){ // A return value of 0 means the far end disconnected, if negative, then a socket read error occured. Remove the socket in both cases.
-						debug(DEBUG_STATUS,"Removing socket index %d from the poll list, res = %d", i, res);
-						user_socket = pollfd[i].fd;
-						if(close(user_socket) < 0)
-							debug(DEBUG_UNEXPECTED,"Close error on text socket");
-						if((i + 1) != num_poll_fds){ // Not the last fd in the poll list?
-							debug(DEBUG_EXPECTED,"Moving socket array down over the top of the disconnected socket i = %d, num_poll_fds = %d", i, num_poll_fds);
-							memmove(&pollfd[i], &pollfd[i + 1], (num_poll_fds - (i + 1)) * sizeof(struct pollfd));
-						}
-						else{
-							debug(DEBUG_EXPECTED,"No memmove required i = %d, num_poll_fds = %d", i, num_poll_fds);
-						}
-						num_poll_fds--; // We have one less now
-						intreportingena[i] = 0; // Int reporting off
-						sockrm = 1;
-						break;
-					}
-					else{
-						debug(DEBUG_STATUS,"Bytes read: %d\n", res);
-						text_command(i, (char *) buffer, res); // FIXME
-						break;
-					}
-				}
-			}
-		}
-		if(sockrm) // If we removed a text socket, start poll over with shortened list
-			continue;			
-
-		/*
-		 * Was it a new ipv4  text socket connection?
-		 */
-		si = fd_index(FD_INET_TEXT);
-		if((si >= 0) && (pollfd[si].revents)){
-			struct sockaddr_storage peerAddress;
-			socklen_t peerAddressSize  = sizeof(struct sockaddr_storage);
-			char addrstr[INET6_ADDRSTRLEN];
-
-			
-			/* Accept the user connection. */
-			user_socket=accept(pollfd[si].fd, (struct sockaddr *) &peerAddress, &peerAddressSize);
-			if(user_socket == -1) {
-				debug(DEBUG_UNEXPECTED, "Could not do accept on ipv4 text socket");
-				continue;
-			}
-
-			debug(DEBUG_STATUS, "Accepting ipv4 text socket connection from %s", inet_ntop(peerAddress.ss_family, munge_ip_address(&peerAddress), addrstr, sizeof(addrstr)));
-
-			/* Monitor sockets must be non-blocking */
-
-			if(fcntl(user_socket, F_SETFL, O_NONBLOCK) == -1) {
-				fatal("Could not set text socket to non-blocking: %s", strerror(errno));
-			}
-	
-			/* Add it to the poll list if there's room */
-
-			if(add_text_socket(user_socket))
-				close(user_socket);
-			else{
-				debug(DEBUG_EXPECTED, "num_poll_fds = %d", num_poll_fds);
-			}
-		}
-
-
-		/*
-		 * Was it a new ipv6 text socket connection?
-		 */
-		si = fd_index(FD_INET6_TEXT);
-		if((si >= 0) && (pollfd[si].revents)){
-
-			struct sockaddr_storage peerAddress;
-			socklen_t peerAddressSize  = sizeof(struct sockaddr_storage);
-			char addrstr[INET6_ADDRSTRLEN];
-
-			/* Accept the user connection. */
-			user_socket=accept(pollfd[si].fd, (struct sockaddr *) &peerAddress, &peerAddressSize);
-			if(user_socket == -1) {
-				debug(DEBUG_UNEXPECTED, "Could not do accept on ipv6 text socket");
-				continue;
-			}
-
-			debug(DEBUG_STATUS, "Accepting ipv6 text socket connection from %s",  inet_ntop(peerAddress.ss_family, munge_ip_address(&peerAddress), addrstr, sizeof(addrstr)));
-			/* Monitor sockets must be non-blocking */
-
-			if(fcntl(user_socket, F_SETFL, O_NONBLOCK) == -1) {
-				fatal("Could not set text socket to non-blocking: %s", strerror(errno));
-			}
-			
-			if(add_text_socket(user_socket))
-				close(user_socket);
-			else{
-				debug(DEBUG_EXPECTED, "num_poll_fds = %d", num_poll_fds);
-			}
-		}
+		retval=evloop_run_once(POLL_TIMEOUT);
+		if((retval == -1) && (errno != EINTR)) /* Nope, epoll broke. */
+			fatal_with_reason(errno, "epoll_wait failed");
+		free_closed_sockets();
+		/* A signal may land outside epoll_wait, so look at the flags every time round */
+		if(exitRequest == 1)
+			hand_exit();
+		if(reconfigRequest == 1)
+			handReconfig();
 	}
 	exit(-1);
 }
@@ -34,6 +34,7 @@
 #include <termios.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
@@ -51,7 +52,7 @@ hanioStuff *hanio_open(char *han_tty_name) {
 	struct termios termios;
 	hanioStuff *hanio;
 
-	if((hanio = malloc(sizeof(hanioStuff))) == NULL)
+	if((hanio = calloc(1, sizeof(hanioStuff))) == NULL)
 		fatal("Could not malloc memory for hanioStuff");
 
 	/* 
@@ -59,6 +60,7 @@ hanioStuff *hanio_open(char *han_tty_name) {
 	 */
 	hanio->fd=open(han_tty_name, O_RDWR | O_NOCTTY | O_NDELAY);
 	if(hanio->fd == -1) {
+		free(hanio);
 		return NULL;
 	}
 	
@@ -226,13 +228,81 @@ int hanio_wait_write(hanioStuff *hanio, int tx_timeout) {
 }
 
 /*
- * Read one character into a location pointed to by C, return the result
+ * Fill the receive ring with whatever the tty has for us.
+ *
+ * One non-blocking read is made into all of the free space in the ring.
+ * Returns the number of bytes read, 0 if the tty went away, or -1 with errno
+ * set. errno will be EAGAIN if there was nothing to read, or ENOBUFS if
+ * the ring is full.
+ */
+
+int hanio_fill(hanioStuff *hanio)
+{
+	struct iovec iov[2];
+	unsigned head = hanio->rx_head & (HANIO_RX_RING_SIZE - 1);
+	unsigned space = HANIO_RX_RING_SIZE - (hanio->rx_head - hanio->rx_tail);
+	int iovcnt = 1;
+	ssize_t retval;
+
+	if(!space){
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	/* The free space may wrap around the end of the ring */
+
+	iov[0].iov_base = hanio->rx_ring + head;
+	if(head + space > HANIO_RX_RING_SIZE){
+		iov[0].iov_len = HANIO_RX_RING_SIZE - head;
+		iov[1].iov_base = hanio->rx_ring;
+		iov[1].iov_len = space - iov[0].iov_len;
+		iovcnt = 2;
+	}
+	else
+		iov[0].iov_len = space;
+
+	hanio->rx_syscalls++;
+	retval = readv(hanio->fd, iov, iovcnt);
+	if(retval > 0){
+		hanio->rx_head += retval;
+		hanio->rx_bytes += retval;
+	}
+	return retval;
+}
+
+/*
+ * Return the number of received bytes waiting in the ring
  */
- 
- 
-int hanio_getchar(hanioStuff *hanio, char *c)
+
+int hanio_rx_pending(hanioStuff *hanio)
 {
-	return read(hanio->fd, c, 1);
+	return hanio->rx_head - hanio->rx_tail;
+}
+
+/*
+ * Point p at the oldest received byte and return how many bytes can be
+ * taken from there without wrapping. The bytes stay in the ring until
+ * hanio_rx_consume() is called.
+ */
+
+int hanio_rx_peek(hanioStuff *hanio, uint8_t **p)
+{
+	unsigned tail = hanio->rx_tail & (HANIO_RX_RING_SIZE - 1);
+	unsigned pending = hanio->rx_head - hanio->rx_tail;
+
+	*p = hanio->rx_ring + tail;
+	if(tail + pending > HANIO_RX_RING_SIZE)
+		return HANIO_RX_RING_SIZE - tail;
+	return pending;
+}
+
+/*
+ * Discard count bytes from the tail of the ring
+ */
+
+void hanio_rx_consume(hanioStuff *hanio, int count)
+{
+	hanio->rx_tail += count;
 }
 
 /* 
@@ -247,9 +317,20 @@ int hanio_getchar(hanioStuff *hanio, char *c)
 ssize_t hanio_read(hanioStuff *hanio, void *buf, size_t count, int rx_timeout) {
 	int bytes_read;
 	ssize_t retval;
+	uint8_t *p;
 	
+	/* Anything already in the ring goes first. */
+	for(bytes_read=0; (bytes_read < count) && hanio_rx_pending(hanio);) {
+		retval = hanio_rx_peek(hanio, &p);
+		if(retval > count - bytes_read)
+			retval = count - bytes_read;
+		memcpy((char *) buf + bytes_read, p, retval);
+		hanio_rx_consume(hanio, retval);
+		bytes_read += retval;
+	}
+
 	/* Read the request into the buffer. */
-	for(bytes_read=0; bytes_read < count;) {
+	for(; bytes_read < count;) {
 		
 		/* Wait for data to be available. */
 		if(!hanio_wait_read(hanio, rx_timeout)) {
@@ -258,10 +339,12 @@ ssize_t hanio_read(hanioStuff *hanio, void *buf, size_t count, int rx_timeout) {
 		}
 		
 		/* Get as much of it as we can.  Loop for the rest. */
+		hanio->rx_syscalls++;
 		retval=read(hanio->fd, (char *) buf + bytes_read, count - bytes_read);
 		if(retval == -1) {
 			fatal_with_reason(errno, "Failure reading hanio response");
 		}
+		hanio->rx_bytes += retval;
 		bytes_read += retval;
 //		debug(DEBUG_ACTION, "Read %i bytes, %i remaining.", retval, count - bytes_read);
 	}
@@ -294,10 +377,12 @@ ssize_t hanio_write(hanioStuff *hanio, void *buf, size_t count, int tx_timeout)
 		}
 		
 		/* Get as much of it as we can.  Loop for the rest. */
+		hanio->tx_syscalls++;
 		retval=write(hanio->fd, (char *) buf + bytes_written, count - bytes_written);
 		if(retval == -1) {
 			fatal_with_reason(errno, "Failure writing hanio buffer");
 		}
+		hanio->tx_bytes += retval;
 		bytes_written += retval;
 //		debug(DEBUG_ACTION, "Wrote %i bytes, %i remaining.", retval, count - bytes_written);
 	}
@@ -311,8 +396,10 @@ ssize_t hanio_write(hanioStuff *hanio, void *buf, size_t count, int tx_timeout)
 int hanio_flush_input(hanioStuff *hanio)
 {
 	int res = -1;
-	if(hanio)
+	if(hanio){
+		hanio->rx_tail = hanio->rx_head;
 		res = tcflush(hanio->fd, TCIFLUSH);
+	}
 	return res;
 }
 
@@ -31,6 +31,7 @@
 
 #include <time.h>
 #include <unistd.h>
+#include <stdint.h>
 
 /* The maximum time to wait for an expected byte to be readable. */
 #define HANIO_WAIT_READ_USEC_DELAY 5000000
@@ -38,6 +39,9 @@
 /* The maximum time to wait to be able to write to the x10 hardware. */
 #define HANIO_WAIT_WRITE_USEC_DELAY 5000000
 
+/* Size of the receive ring buffer. Must be a power of 2. */
+#define HANIO_RX_RING_SIZE 4096
+
 /* Typedefs. */
 typedef struct haniostuff hanioStuff;
 
@@ -46,6 +50,20 @@ struct haniostuff {
 	
 	/* File descriptor to the hanio tty. */
 	int fd;
+
+	/* 
+	 * Receive ring buffer. rx_head and rx_tail are free running counts of
+	 * bytes put in by read() and taken out by the caller.
+	 */
+	unsigned rx_head;
+	unsigned rx_tail;
+	uint8_t rx_ring[HANIO_RX_RING_SIZE];
+
+	/* I/O statistics */
+	unsigned rx_syscalls;
+	unsigned rx_bytes;
+	unsigned tx_syscalls;
+	unsigned tx_bytes;
 };
 
 /* Prototypes. */
@@ -53,7 +71,10 @@ hanioStuff *hanio_open(char *han_tty_name);
 void hanio_close(hanioStuff *hanio);
 int hanio_wait_read(hanioStuff *hanio, int rx_timeout);
 int hanio_wait_write(hanioStuff *hanio, int tx_timeout);
-int hanio_getchar(hanioStuff *hanio, char *c);
+int hanio_fill(hanioStuff *hanio);
+int hanio_rx_pending(hanioStuff *hanio);
+int hanio_rx_peek(hanioStuff *hanio, uint8_t **p);
+void hanio_rx_consume(hanioStuff *hanio, int count);
 ssize_t hanio_read(hanioStuff *hanio, void *buf, size_t count, int rx_timeout);
 ssize_t hanio_write(hanioStuff *hanio, void *buf, size_t count, int tx_timeout);
 int hanio_flush_input(hanioStuff *hanio);
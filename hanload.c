@@ -0,0 +1,386 @@
+/*
+ * hanload.c.  Drive hand with back to back node commands and report
+ * the throughput and latency achieved.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+#include "tnd.h"
+#include "options.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "error.h"
+#include "confscan.h"
+#include "han.h"
+#include "hanclient.h"
+
+/* Local Defines */
+
+#define SHORT_OPTIONS "a:Bc:d:FhHk:l:n:p:Sv"
+
+#define DEF_COUNT	1000		// Transactions per run
+#define DEF_ADDR	0x02		// Node to talk to
+#define DEF_PARAMS	3		// Parameter bytes sent with each command
+
+#define CONF_STRING	1
+
+/* Typedefs */
+
+typedef struct load_result Load_Result;
+
+/* Outcome of one run */
+
+struct load_result {
+	unsigned ok;
+	unsigned timeouts;
+	unsigned crc;
+	unsigned nak;
+	unsigned format;
+	unsigned other;
+};
+
+/* Global variables */
+
+int debuglvl = 0;
+char *progname;
+
+/* Internal global variables */
+
+static char confFile[MAX_CONFIG_STRING] = CONF_FILE_PATH;
+static char confPidPath[MAX_CONFIG_STRING] = "";
+static char confSocketPath[MAX_CONFIG_STRING] = "";
+static char confService[MAX_CONFIG_STRING] = "";
+static char confHost[MAX_CONFIG_STRING] = "";
+
+/* Local prototypes. */
+
+static int confSaveString(char *value, short handling, void *result);
+
+/* Commandline options. */
+
+static struct option long_options[] = {
+	{"address", 1, 0, 'a'},
+	{"bulk", 0, 0, 'B'},
+	{"config-file", 1, 0, 'c'},
+	{"debug", 1, 0, 'd'},
+	{"fixed", 0, 0, 'F'},
+	{"help", 0, 0, 'h'},
+	{"header", 0, 0, 'H'},
+	{"command", 1, 0, 'k'},
+	{"label", 1, 0, 'l'},
+	{"count", 1, 0, 'n'},
+	{"params", 1, 0, 'p'},
+	{"session", 0, 0, 'S'},
+	{"version", 0, 0, 'v'},
+	{0, 0, 0, 0}
+};
+
+/* Configuration option tables */
+
+static Key_Entry globalKeys[] = {
+	{"pid_file", CONF_STRING, confPidPath, confSaveString},
+	{"socket", CONF_STRING, confSocketPath, confSaveString},
+	{"service", CONF_STRING, confService, confSaveString},
+	{"textservice", 0, NULL, NULL},
+	{"host", CONF_STRING, confHost, confSaveString},
+	{"nocheck", 0, NULL, NULL},
+	{NULL, 0, NULL, NULL}
+};
+
+static Section_Entry sectionHeader[] = {
+	{"global", globalKeys},
+	{NULL, NULL}
+};
+
+
+/*
+* Save a configuration string option
+*/
+
+static int confSaveString(char *value, short handling, void *result){
+	char *dest = (char *) result;
+	strncpy(dest,value,MAX_CONFIG_STRING - 1);
+	dest[MAX_CONFIG_STRING - 1] = 0;
+	debug(DEBUG_STATUS,"set string: %s",dest);
+	return PASS;
+}
+
+
+/*
+* Return the time in microseconds from the monotonic clock
+*/
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/* Sort helper for the latency samples */
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+
+/* Return the pct percentile of n sorted samples in milliseconds */
+
+static double percentile(uint32_t *sorted, unsigned n, unsigned pct)
+{
+	unsigned i;
+
+	if(!n)
+		return 0.0;
+	i = (n * pct + 99) / 100;
+	if(i)
+		i--;
+	return sorted[i] / 1000.0;
+}
+
+
+/*
+* Fetch the daemon's error statistics
+*/
+
+static void get_stats(Err_Stats *stats)
+{
+	Client_Command client_command;
+
+	memset(&client_command, 0, sizeof(Client_Command));
+	client_command.request = HAN_CCMD_NETSTATS;
+	hanclient_send_command(&client_command);
+	*stats = client_command.cmd.stats;
+}
+
+
+/* Show the help screen for hanload. */
+static void hanload_show_help(void) {
+	printf("'hanload' sends node commands through hand as fast as it can and reports\n");
+	printf("the transactions per second and latency percentiles achieved\n");
+	printf("\n");
+	printf("Usage: %s [OPTION]...\n", progname);
+	printf("\n");
+	printf("  -a, --address ADDR        node address in hex, default %02X\n", DEF_ADDR);
+	printf("  -B, --bulk                send the commands as bulk work, which waits\n");
+	printf("                            behind interactive commands\n");
+	printf("  -c, --config-file PATH    set the path for the config file\n");
+	printf("  -d, --debug LEVEL         set the debug level, 0 is off, the\n");
+	printf("                            max level allowed is %i\n", DEBUG_MAX);
+	printf("  -F, --fixed               use the fixed size wire format even if\n");
+	printf("                            hand understands v2\n");
+	printf("  -h, --help                give help on usage\n");
+	printf("  -H, --header              print a header line before the results\n");
+	printf("  -k, --command CMD         node command in hex, default %02X\n", HAN_CMD_RLYN_GSLS);
+	printf("  -l, --label TEXT          first column of the result line, e.g. the\n");
+	printf("                            error rate the simulator was run with\n");
+	printf("  -n, --count N             number of transactions, default %d\n", DEF_COUNT);
+	printf("  -p, --params N            parameter bytes per command, default %d\n", DEF_PARAMS);
+	printf("  -S, --session             send every command over one session\n");
+	printf("                            connection instead of a connection each\n");
+	printf("  -v, --version             display program version\n");
+	printf("\n");
+	printf("Latencies are in milliseconds. timeouts, crc, nak and format count the\n");
+	printf("transactions which failed that way after hand's retries. rxto and crcerr\n");
+	printf("are the increase in hand's own error counters, retries included.\n");
+	printf("\n");
+	printf("Report bugs to <%s>\n", EMAIL);
+}
+
+
+/* Show the version info for hanload. */
+static void hanload_show_version(void) {
+	printf("hanload (%s) %s\n", PACKAGE, VERSION);
+}
+
+
+int main(int argc, char *argv[])
+{
+	int longindex, optchar, header = FALSE, use_session = FALSE, session = -1;
+	unsigned i, addr = DEF_ADDR, cmd = HAN_CMD_RLYN_GSLS, count = DEF_COUNT, nparams = DEF_PARAMS;
+	char *label = "-";
+	uint32_t *lat;
+	uint64_t start, t, elapsed;
+	Client_Command client_command;
+	Load_Result res;
+	Err_Stats before, after;
+
+	/* Save the name of the program. */
+	progname=argv[0];
+
+	/* Parse the arguments. */
+	while((optchar=getopt_long(argc, argv, SHORT_OPTIONS, long_options, &longindex)) != EOF) {
+		switch(optchar) {
+			case '?':
+				exit(1);
+
+			case 'a':
+				if((sscanf(optarg, "%x", &addr) != 1) || (addr > 0xFE))
+					fatal("Bad node address '%s'", optarg);
+				break;
+
+			case 'B':
+				hanclient_use_bulk();
+				break;
+
+			case 'c':
+				confSaveString(optarg, CONF_STRING, confFile);
+				break;
+
+			case 'd':
+				debuglvl = atoi(optarg);
+				if(debuglvl < 0 || debuglvl > DEBUG_MAX)
+					fatal("Invalid debug level");
+				break;
+
+			case 'F':
+				hanclient_use_legacy();
+				break;
+
+			case 'h':
+				hanload_show_help();
+				exit(0);
+
+			case 'H':
+				header = TRUE;
+				break;
+
+			case 'k':
+				if((sscanf(optarg, "%x", &cmd) != 1) || (cmd > 0xFF))
+					fatal("Bad node command '%s'", optarg);
+				break;
+
+			case 'l':
+				label = optarg;
+				break;
+
+			case 'n':
+				if((sscanf(optarg, "%u", &count) != 1) || !count)
+					fatal("Bad count '%s'", optarg);
+				break;
+
+			case 'p':
+				if((sscanf(optarg, "%u", &nparams) != 1) || (nparams > MAX_NODE_PARAMS))
+					fatal("Bad parameter count '%s'", optarg);
+				break;
+
+			case 'S':
+				use_session = TRUE;
+				break;
+
+			case 'v':
+				hanload_show_version();
+				exit(0);
+
+			default:
+				panic("Unhandled getopt return value %d", optchar);
+		}
+	}
+
+	if(optind < argc)
+		fatal("Extra argument on commandline, '%s'", argv[optind]);
+
+	confscan(confFile, sectionHeader);
+	hanclient_connect_setup(confPidPath, confSocketPath, confService, confHost);
+
+	if((lat = malloc(count * sizeof(uint32_t))) == NULL)
+		fatal("Out of memory");
+	memset(&res, 0, sizeof(Load_Result));
+
+	get_stats(&before);
+
+	if(use_session && ((session = hanclient_session_open()) == -1))
+		fatal("hand does not support sessions");
+
+	start = now_usec();
+	for(i = 0; i < count; i++){
+		memset(&client_command, 0, sizeof(Client_Command));
+		client_command.request = HAN_CCMD_SENDPKT;
+		client_command.cmd.pkt.nodeaddress = (unsigned char) addr;
+		client_command.cmd.pkt.nodecommand = (unsigned char) cmd;
+		client_command.cmd.pkt.numnodeparams = (unsigned char) nparams;
+
+		t = now_usec();
+		if(session != -1)
+			hanclient_session_command(session, &client_command);
+		else
+			hanclient_send_command_return_res(&client_command);
+		lat[i] = (uint32_t)(now_usec() - t);
+
+		switch(client_command.commstatus){
+			case HAN_CSTS_OK:
+				res.ok++;
+				break;
+
+			case HAN_CSTS_RX_TIMEOUT:
+			case HAN_CSTS_TX_TIMEOUT:
+				res.timeouts++;
+				break;
+
+			case HAN_CSTS_CRC_ERROR:
+				res.crc++;
+				break;
+
+			case HAN_CSTS_NAK_ERROR:
+				res.nak++;
+				break;
+
+			case HAN_CSTS_FORMAT_ERROR:
+			case HAN_CSTS_FRAMING_ERROR:
+				res.format++;
+				break;
+
+			default:
+				res.other++;
+				break;
+		}
+	}
+	elapsed = now_usec() - start;
+
+	if(session != -1)
+		hanclient_session_close(session);
+
+	get_stats(&after);
+
+	qsort(lat, count, sizeof(uint32_t), compare_u32);
+
+	if(header)
+		printf("%-10s %6s %8s %8s %8s %8s %8s %6s %8s %5s %6s %5s %6s %6s\n",
+			"label", "count", "tps", "p50", "p90", "p99", "max", "ok", "timeouts", "crc",
+			"nak", "format", "rxto", "crcerr");
+	printf("%-10s %6u %8.1f %8.2f %8.2f %8.2f %8.2f %6u %8u %5u %6u %5u %6u %6u\n",
+		label, count, count * 1000000.0 / (elapsed ? elapsed : 1),
+		percentile(lat, count, 50), percentile(lat, count, 90), percentile(lat, count, 99),
+		lat[count - 1] / 1000.0, res.ok, res.timeouts, res.crc, res.nak, res.format + res.other,
+		after.rx_timeouts - before.rx_timeouts, after.crc_errs - before.crc_errs);
+
+	free(lat);
+	exit(0);
+}
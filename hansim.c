@@ -0,0 +1,1069 @@
+/*
+ * hansim.c.  Simulate a network of HAN nodes on a pseudo terminal.
+ *
+ * The slave side of the pty stands in for the RS-485 tty, so hand can be
+ * pointed at it in han.conf and driven without any hardware attached.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+#define _GNU_SOURCE
+#include "tnd.h"
+#include "options.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include <poll.h>
+#include "error.h"
+#include "confscan.h"
+#include "han.h"
+#include "crc.h"
+#include "frame.h"
+
+/* Local Defines */
+
+#define SHORT_OPTIONS "b:c:d:e:f:hi:l:L:N:s:T:v"
+
+#define MAX_SIM_NODES		64		// Most nodes one simulator will emulate
+#define MAX_TX_QUEUE		16		// Frames waiting to go out on the bus
+#define DEF_LATENCY		2000		// Node turnaround time in usec
+#define DEF_BAUD		9600		// Line speed used for pacing
+#define BITS_PER_BYTE		10		// 8N1
+#define ENUM_SLOT_TIME		5000		// usec between enum responses of adjacent addresses
+#define IRQ_RETRY_TIME		500000		// usec before an unacknowledged interrupt is re-sent
+#define IRQ_QUIET_TIME		300000		// usec a command nobody answered holds off interrupts
+#define IRQ_GAP_TIME		20000		// usec left for the master to start its next command
+#define COUNTS_PER_C		16		// Temperature sensor resolution
+#define FAULT_GARBAGE_MAX	8		// Most junk bytes put in front of a frame
+#define DEF_LATE_TIME		400000		// usec added to a late response, longer than hand waits
+
+#define NODE_TYPE_GENERIC	0x0000
+#define NODE_TYPE_RELAY		0x0001
+#define NODE_FWLEVEL		0x0100
+
+#define IRQ_REASON_ENUM		0x00		// Interrupt sent in answer to BCP_ENUM
+#define IRQ_REASON_SENSE	0x01		// A sense line changed
+
+/* Enums */
+
+enum {CONF_STRING=1, CONF_UNS, CONF_NODE, CONF_DOUBLE, CONF_FAULTS};
+
+/* Kinds of fault which can be injected */
+
+enum {FAULT_CORRUPT=0, FAULT_DROP, FAULT_TRUNCATE, FAULT_GARBAGE, FAULT_LATE, FAULT_SPURIOUS, NUM_FAULTS};
+
+/* Typedefs */
+
+typedef struct sim_node Sim_Node;
+typedef struct tx_entry Tx_Entry;
+typedef struct sim_stats Sim_Stats;
+typedef struct fault_name Fault_Name;
+
+/* One emulated node */
+
+struct sim_node {
+	uint8_t addr;
+	uint16_t type;
+	uint16_t fwlevel;
+	uint8_t crc16;			// Node can do CRC16
+	uint8_t relays;			// Relay states, one bit per relay
+	uint8_t sense;			// Sense line states
+	uint8_t power_cycled;		// Reported and cleared by GPCY
+	int16_t temp[4];		// Temperatures in sensor counts
+	uint8_t irq_pending;		// Interrupt waiting for a GIST
+	uint8_t irq_reason;
+	uint64_t irq_due;		// When to (re)send the interrupt request
+	uint64_t next_event;		// When the next spontaneous interrupt happens
+	unsigned rx_errors;		// Reported by GCST
+	unsigned crc_errors;
+};
+
+/* A frame scheduled to go out on the bus */
+
+struct tx_entry {
+	uint64_t due;
+	int len;
+	uint8_t buf[FRAME_MAX_STUFFED_LEN + FAULT_GARBAGE_MAX];
+};
+
+/* Simulator statistics */
+
+struct sim_stats {
+	unsigned frames_rx;
+	unsigned frames_tx;
+	unsigned crc_errors;
+	unsigned format_errors;
+	unsigned not_ours;
+	unsigned naks;
+	unsigned interrupts;
+	unsigned broadcasts;
+	unsigned faults[NUM_FAULTS];
+};
+
+/* Fault names used in the --faults spec */
+
+struct fault_name {
+	char *name;
+	int fault;
+};
+
+/* Global things. */
+
+int debuglvl = 0;
+char *progname;
+
+/* Locals. */
+
+static unsigned short exitRequest = 0;
+static unsigned short statsRequest = 0;
+
+static char conf_file[MAX_CONFIG_STRING] = "";
+static char conf_link[MAX_CONFIG_STRING] = "";
+static unsigned conf_latency = DEF_LATENCY;
+static unsigned conf_baud = DEF_BAUD;
+static unsigned conf_irq_rate = 0;		// Spontaneous interrupts per node per minute
+static unsigned conf_seed = 1;
+static unsigned conf_late_time = DEF_LATE_TIME;
+static double conf_error_rate = 0.0;		// Chance a frame suffers a random line fault
+static double conf_faults[NUM_FAULTS];		// Chance of each individual fault per frame
+
+static Sim_Node nodes[MAX_SIM_NODES];
+static int num_nodes = 0;
+static Sim_Node *node_by_addr[256];
+
+static Tx_Entry tx_queue[MAX_TX_QUEUE];
+static int tx_count = 0;
+static uint64_t bus_free_at = 0;		// When the last queued frame finishes
+static uint64_t bus_quiet_at = 0;		// When the master can't still be waiting on a reply
+
+static uint64_t rng_state;
+static uint64_t fault_rng_state;		// Separate stream so faults repeat for a given seed
+static Sim_Stats stats;
+static int master_fd = -1;
+static int slave_fd = -1;
+
+static Frame_Decoder decoder;
+
+/* Local prototypes. */
+
+static int confSaveString(char *value, short handling, void *result);
+static int confSaveUnsigned(char *value, short handling, void *result);
+static int confAddNode(char *value, short handling, void *result);
+static int confSaveDouble(char *value, short handling, void *result);
+static int confSaveFaults(char *value, short handling, void *result);
+
+/* Commandline options. */
+
+static struct option long_options[] = {
+	{"baud", 1, 0, 'b'},
+	{"config-file", 1, 0, 'c'},
+	{"debug", 1, 0, 'd'},
+	{"error-rate", 1, 0, 'e'},
+	{"faults", 1, 0, 'f'},
+	{"help", 0, 0, 'h'},
+	{"interrupt-rate", 1, 0, 'i'},
+	{"link", 1, 0, 'l'},
+	{"latency", 1, 0, 'L'},
+	{"node", 1, 0, 'N'},
+	{"seed", 1, 0, 's'},
+	{"late-time", 1, 0, 'T'},
+	{"version", 0, 0, 'v'},
+	{0, 0, 0, 0}
+};
+
+/* Configuration option tables */
+
+static Key_Entry hansim_keys[] = {
+	{"node", CONF_NODE, NULL, confAddNode},
+	{"link", CONF_STRING, conf_link, confSaveString},
+	{"latency", CONF_UNS, &conf_latency, confSaveUnsigned},
+	{"baud", CONF_UNS, &conf_baud, confSaveUnsigned},
+	{"interrupt_rate", CONF_UNS, &conf_irq_rate, confSaveUnsigned},
+	{"seed", CONF_UNS, &conf_seed, confSaveUnsigned},
+	{"error_rate", CONF_DOUBLE, &conf_error_rate, confSaveDouble},
+	{"faults", CONF_FAULTS, conf_faults, confSaveFaults},
+	{"late_time", CONF_UNS, &conf_late_time, confSaveUnsigned},
+	{NULL, 0, NULL, NULL}
+};
+
+static Fault_Name fault_names[] = {
+	{"corrupt", FAULT_CORRUPT},
+	{"drop", FAULT_DROP},
+	{"truncate", FAULT_TRUNCATE},
+	{"garbage", FAULT_GARBAGE},
+	{"late", FAULT_LATE},
+	{"spurious", FAULT_SPURIOUS},
+	{NULL, 0}
+};
+
+static Section_Entry conf_section[] = {
+	{"hansim", hansim_keys},
+	{NULL, NULL}
+};
+
+
+/* Handle exit signals */
+
+static void handle_exit_request(int sig){
+	exitRequest = 1;
+}
+
+/* Make a note of a statistics request */
+
+static void handle_stats_request(int sig){
+	statsRequest = 1;
+}
+
+
+/*
+* Return the time in microseconds from the monotonic clock
+*/
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/*
+* Seedable pseudo random numbers (xorshift64*). The same seed always gives
+* the same run.
+*/
+
+static uint32_t rng_next(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return (uint32_t)((*state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/* Return a random number in the range [0, 1) */
+
+static double rng_uniform(uint64_t *state)
+{
+	return rng_next(state) / 4294967296.0;
+}
+
+
+/*
+* Time in usec to send len bytes at the configured baud rate
+*/
+
+static uint64_t wire_time(int len)
+{
+	if(!conf_baud)
+		return 0;
+	return ((uint64_t) len * BITS_PER_BYTE * 1000000) / conf_baud;
+}
+
+
+/*
+* Save a configuration string option
+*/
+
+static int confSaveString(char *value, short handling, void *result){
+	char *dest = (char *) result;
+	strncpy(dest,value,MAX_CONFIG_STRING - 1);
+	dest[MAX_CONFIG_STRING - 1] = 0;
+	debug(DEBUG_STATUS,"set string: %s",dest);
+	return PASS;
+}
+
+
+/* Save a generic unsigned value */
+
+static int confSaveUnsigned(char *value, short handling, void *result){
+	unsigned *dest = (unsigned *) result;
+
+	if(sscanf(value,"%u",dest) != 1)
+		return FAIL;
+	debug(DEBUG_STATUS,"set unsigned: %u",*dest);
+	return PASS;
+}
+
+
+/* Save a probability */
+
+static int confSaveDouble(char *value, short handling, void *result){
+	double *dest = (double *) result;
+
+	if((sscanf(value,"%lf",dest) != 1) || (*dest < 0.0) || (*dest > 1.0))
+		return FAIL;
+	debug(DEBUG_STATUS,"set double: %f",*dest);
+	return PASS;
+}
+
+
+/*
+* Save fault probabilities from a spec of the form NAME=P[,NAME=P]...
+*/
+
+static int confSaveFaults(char *value, short handling, void *result)
+{
+	double *dest = (double *) result;
+	char spec[MAX_CONFIG_STRING], *p, *eq;
+	int i;
+
+	strncpy(spec, value, MAX_CONFIG_STRING - 1);
+	spec[MAX_CONFIG_STRING - 1] = 0;
+
+	for(p = strtok(spec, ","); p; p = strtok(NULL, ",")){
+		if((eq = strchr(p, '=')) == NULL)
+			return FAIL;
+		*eq++ = 0;
+		for(i = 0; fault_names[i].name; i++){
+			if(!strcmp(p, fault_names[i].name))
+				break;
+		}
+		if(!fault_names[i].name)
+			return FAIL;
+		if(confSaveDouble(eq, CONF_DOUBLE, &dest[fault_names[i].fault]))
+			return FAIL;
+	}
+	return PASS;
+}
+
+
+/*
+* Add one or more nodes from a spec of the form ADDR[-ADDR][:relay|:generic][:crc16]
+* Addresses are in hex.
+*/
+
+static int confAddNode(char *value, short handling, void *result)
+{
+	unsigned first, last, a;
+	uint16_t type = NODE_TYPE_RELAY;
+	uint8_t crc16 = FALSE;
+	char *p, spec[MAX_CONFIG_STRING];
+	Sim_Node *n;
+
+	strncpy(spec, value, MAX_CONFIG_STRING - 1);
+	spec[MAX_CONFIG_STRING - 1] = 0;
+
+	if(sscanf(spec, "%x-%x", &first, &last) != 2){
+		if(sscanf(spec, "%x", &first) != 1)
+			return FAIL;
+		last = first;
+	}
+	if((first > last) || (last > 0xFE))
+		return FAIL;
+
+	for(p = strchr(spec, ':'); p; p = strchr(p + 1, ':')){
+		if(!strncmp(p + 1, "relay", 5))
+			type = NODE_TYPE_RELAY;
+		else if(!strncmp(p + 1, "generic", 7))
+			type = NODE_TYPE_GENERIC;
+		else if(!strncmp(p + 1, "crc16", 5))
+			crc16 = TRUE;
+		else
+			return FAIL;
+	}
+
+	for(a = first; a <= last; a++){
+		if(node_by_addr[a])
+			continue;
+		if(num_nodes == MAX_SIM_NODES){
+			debug(DEBUG_UNEXPECTED, "Too many nodes, maximum is %d", MAX_SIM_NODES);
+			return FAIL;
+		}
+		n = &nodes[num_nodes++];
+		memset(n, 0, sizeof(Sim_Node));
+		n->addr = (uint8_t) a;
+		n->type = type;
+		n->fwlevel = NODE_FWLEVEL;
+		n->crc16 = crc16;
+		n->power_cycled = TRUE;
+		n->temp[0] = n->temp[1] = n->temp[2] = n->temp[3] = 20 * COUNTS_PER_C;
+		node_by_addr[a] = n;
+		debug(DEBUG_STATUS, "Node %02X type %04X crc16 %d", a, type, crc16);
+	}
+	return PASS;
+}
+
+
+/*
+* Roll the dice for one fault
+*/
+
+static int fault_hit(int fault)
+{
+	if(conf_faults[fault] <= 0.0)
+		return FALSE;
+	if(rng_uniform(&fault_rng_state) >= conf_faults[fault])
+		return FALSE;
+	stats.faults[fault]++;
+	return TRUE;
+}
+
+
+/*
+* Damage an encoded frame the way a noisy line would. The line faults can
+* come from the overall error rate, or be asked for one at a time.
+* Returns the extra delay in usec for a late frame.
+*/
+
+static uint64_t fault_frame(Tx_Entry *t)
+{
+	int i, n, pos;
+	uint64_t delay = 0;
+	int hit[NUM_FAULTS];
+
+	for(i = 0; i <= FAULT_LATE; i++)
+		hit[i] = fault_hit(i);
+
+	if((conf_error_rate > 0.0) && (rng_uniform(&fault_rng_state) < conf_error_rate)){
+		i = rng_next(&fault_rng_state) % (FAULT_GARBAGE + 1);
+		hit[i] = TRUE;
+		stats.faults[i]++;
+	}
+
+	/* Flip a bit somewhere between STX and ETX */
+
+	if(hit[FAULT_CORRUPT] && (t->len > 2)){
+		pos = 1 + rng_next(&fault_rng_state) % (t->len - 2);
+		t->buf[pos] ^= (uint8_t)(1 << (rng_next(&fault_rng_state) & 7));
+	}
+
+	/* Lose a byte */
+
+	if(hit[FAULT_DROP] && (t->len > 1)){
+		pos = rng_next(&fault_rng_state) % t->len;
+		memmove(t->buf + pos, t->buf + pos + 1, t->len - pos - 1);
+		t->len--;
+	}
+
+	/* Stop part way through, the ETX never arrives */
+
+	if(hit[FAULT_TRUNCATE] && (t->len > 1))
+		t->len = 1 + rng_next(&fault_rng_state) % (t->len - 1);
+
+	/* Line noise before the frame. Never an STX, that would be a real frame start. */
+
+	if(hit[FAULT_GARBAGE]){
+		n = 1 + rng_next(&fault_rng_state) % FAULT_GARBAGE_MAX;
+		memmove(t->buf + n, t->buf, t->len);
+		for(i = 0; i < n; i++){
+			t->buf[i] = (uint8_t) rng_next(&fault_rng_state);
+			if(t->buf[i] == STX)
+				t->buf[i] = 0xFF;
+		}
+		t->len += n;
+	}
+
+	if(hit[FAULT_LATE])
+		delay = conf_late_time;
+
+	return delay;
+}
+
+
+/*
+* Queue a packet to go out on the bus no earlier than due. Frames never
+* overlap on the wire, and each one is delivered when its last byte would
+* have arrived.
+*/
+
+static void queue_packet(uint8_t *packet, int len, uint64_t due)
+{
+	Tx_Entry *t;
+	int i;
+
+	if(tx_count == MAX_TX_QUEUE){
+		debug(DEBUG_UNEXPECTED, "TX queue full, dropping packet");
+		return;
+	}
+
+	t = &tx_queue[tx_count];
+	t->len = frame_encode(t->buf, FRAME_MAX_STUFFED_LEN, packet, len);
+	if(t->len < 0)
+		panic("TX frame too long");
+	due += fault_frame(t);
+
+	if(due < bus_free_at)
+		due = bus_free_at;
+	t->due = due + wire_time(t->len);
+	bus_free_at = t->due;
+
+	/* Keep the queue in due order */
+
+	for(i = tx_count++; (i > 0) && (tx_queue[i - 1].due > t->due); i--){
+		Tx_Entry tmp = tx_queue[i - 1];
+		tx_queue[i - 1] = tx_queue[i];
+		tx_queue[i] = tmp;
+	}
+}
+
+
+/*
+* Build a packet with the right CRC on the end and queue it
+*/
+
+static void send_packet(uint8_t hdc, uint8_t crc16mode, uint8_t *body, int bodylen, uint64_t due)
+{
+	uint8_t packet[FRAME_MAX_LEN];
+	uint16_t crc;
+	int len = 0;
+
+	packet[len++] = hdc;
+	memcpy(packet + len, body, bodylen);
+	len += bodylen;
+	if(crc16mode){
+		crc = crc16(packet, len);
+		packet[len++] = (uint8_t) crc;
+		packet[len++] = (uint8_t) (crc >> 8);
+	}
+	else{
+		packet[len] = crc8(packet, len);
+		len++;
+	}
+	queue_packet(packet, len, due);
+}
+
+
+/*
+* Have a node raise an interrupt request
+*/
+
+static void raise_interrupt(Sim_Node *n, uint8_t reason, uint64_t when)
+{
+	n->irq_pending = TRUE;
+	n->irq_reason = reason;
+	n->irq_due = when;
+}
+
+
+/*
+* Send any interrupt requests which are due. Nodes only start talking when
+* the bus is quiet.
+*/
+
+static void service_interrupts(uint64_t now)
+{
+	int i;
+	uint8_t body[1];
+	Sim_Node *n;
+
+	for(i = 0; i < num_nodes; i++){
+		n = &nodes[i];
+
+		/* Spontaneous sense line changes */
+
+		if(conf_irq_rate && (now >= n->next_event)){
+			if(n->next_event){
+				n->sense ^= (uint8_t)(1 << (rng_next(&rng_state) & 7));
+				raise_interrupt(n, IRQ_REASON_SENSE, now);
+			}
+			n->next_event = now + (uint64_t)((0.5 + rng_uniform(&rng_state)) * 60000000.0 / conf_irq_rate);
+		}
+
+		if(!n->irq_pending || (now < n->irq_due) || tx_count || (bus_free_at > now) || (bus_quiet_at > now))
+			continue;
+
+		body[0] = n->addr;
+		send_packet(n->crc16 ? HDCINTRQ16 : HDCINTRQ, n->crc16, body, 1, now);
+		n->irq_due = now + IRQ_RETRY_TIME;
+		stats.interrupts++;
+		debug(DEBUG_ACTION, "Node %02X interrupt request, reason %02X", n->addr, n->irq_reason);
+	}
+}
+
+
+/*
+* Work out what a node says in reply to a command. Fills in status and
+* returns TRUE to ACK or FALSE to NAK.
+*/
+
+static int node_command(Sim_Node *n, uint8_t cmd, uint8_t *params, int nparams, uint8_t *status)
+{
+	int ch;
+	int16_t t;
+
+	memset(status, 0, MAX_NODE_PARAMS);
+
+	switch(cmd){
+		case HAN_CMD_NOOP:
+			memcpy(status, params, nparams);
+			return TRUE;
+
+		case HAN_CMD_NODEID:
+			status[0] = (uint8_t) n->type;
+			status[1] = (uint8_t) (n->type >> 8);
+			status[2] = (uint8_t) n->fwlevel;
+			status[3] = (uint8_t) (n->fwlevel >> 8);
+			return TRUE;
+
+		case HAN_CMD_GCST:
+			status[0] = (uint8_t) n->rx_errors;
+			status[1] = (uint8_t) n->crc_errors;
+			return TRUE;
+
+		case HAN_CMD_GIST:
+			status[0] = n->irq_reason;
+			status[1] = n->sense;
+			n->irq_pending = FALSE;
+			n->irq_reason = 0;
+			return TRUE;
+	}
+
+	if(n->type != NODE_TYPE_RELAY)
+		return FALSE;
+
+	switch(cmd){
+		case HAN_CMD_RLYN_SRLY:
+			if(nparams < 2 || params[0] > 7)
+				return FALSE;
+			if(params[1])
+				n->relays |= (uint8_t)(1 << params[0]);
+			else
+				n->relays &= (uint8_t) ~(1 << params[0]);
+			status[0] = params[0];
+			status[1] = params[1];
+			return TRUE;
+
+		case HAN_CMD_RLYN_GSLS:
+			status[0] = n->sense;
+			status[1] = n->relays;
+			return TRUE;
+
+		case HAN_CMD_RLYN_GTMP:
+			ch = nparams ? params[0] & 3 : 0;
+
+			/* Let the temperature wander a little */
+
+			n->temp[ch] += (int16_t)(rng_next(&rng_state) % 3) - 1;
+			t = n->temp[ch];
+			status[0] = (uint8_t) ch;
+			status[1] = COUNTS_PER_C;
+			status[3] = (uint8_t) t;
+			status[4] = (uint8_t) (t >> 8);
+			return TRUE;
+
+		case HAN_CMD_RLYN_GPCY:
+			status[0] = n->power_cycled;
+			n->power_cycled = FALSE;
+			return TRUE;
+	}
+	return FALSE;
+}
+
+
+/*
+* Frame decoder callback. Check the packet and answer it if it is for one
+* of our nodes.
+*/
+
+static int frame_received(void *ctx, uint8_t *frame, int len)
+{
+	uint8_t use_crc16, addr, cmd, ok;
+	uint8_t status[MAX_NODE_PARAMS], body[2 + MAX_NODE_PARAMS];
+	int nparams, crclen, i;
+	Sim_Node *n;
+	uint64_t now = now_usec();
+
+	stats.frames_rx++;
+	debug_hexdump(DEBUG_ACTION, frame, len, "RX Packet: ");
+
+	/*
+	* Until a command is answered, the master is waiting on the bus.
+	* Keep interrupts off it for longer than the master's response timeout.
+	*/
+
+	bus_quiet_at = now + IRQ_QUIET_TIME;
+
+	if(len < 4){
+		stats.format_errors++;
+		return 0;
+	}
+
+	use_crc16 = (frame[0] == HDC16);
+	if(!use_crc16 && (frame[0] != HDC)){
+		stats.format_errors++;
+		return 0;
+	}
+	crclen = use_crc16 ? 2 : 1;
+	addr = frame[1];
+	cmd = frame[2];
+	nparams = len - 3 - crclen;
+	n = node_by_addr[addr];
+
+	if((nparams < 0) || (nparams > MAX_NODE_PARAMS)){
+		stats.format_errors++;
+		return 0;
+	}
+
+	if(use_crc16 ? (crc16(frame, len - 2) != (frame[len - 2] | (frame[len - 1] << 8))) : (crc8(frame, len) != 0)){
+		stats.crc_errors++;
+		if(n)
+			n->crc_errors++;
+		return 0;
+	}
+
+	/* Broadcasts get no answer. Enumeration makes the CRC16 nodes announce themselves. */
+
+	if(addr == 0xFF){
+		stats.broadcasts++;
+		if(cmd == BCP_ENUM){
+			bus_quiet_at = now;
+			for(i = 0; i < num_nodes; i++){
+				if(nodes[i].crc16)
+					raise_interrupt(&nodes[i], IRQ_REASON_ENUM, now + (uint64_t) nodes[i].addr * ENUM_SLOT_TIME);
+			}
+		}
+		return 0;
+	}
+
+	if(!n){
+		stats.not_ours++;
+		return 0;
+	}
+
+	/* A CRC8 only node can't make sense of a CRC16 packet */
+
+	if(use_crc16 && !n->crc16){
+		n->rx_errors++;
+		stats.format_errors++;
+		return 0;
+	}
+
+	/* A spurious interrupt request gets in ahead of the response */
+
+	if(fault_hit(FAULT_SPURIOUS)){
+		i = rng_next(&fault_rng_state) % num_nodes;
+		body[0] = nodes[i].addr;
+		send_packet(nodes[i].crc16 ? HDCINTRQ16 : HDCINTRQ, nodes[i].crc16, body, 1, now + conf_latency / 2);
+	}
+
+	ok = node_command(n, cmd, frame + 3, nparams, status);
+	if(!ok)
+		stats.naks++;
+
+	body[0] = addr;
+	body[1] = cmd;
+	memcpy(body + 2, status, nparams);
+	if(ok)
+		send_packet(use_crc16 ? HDC_ACK16 : HDC_ACK, use_crc16, body, 2 + nparams, now + conf_latency);
+	else
+		send_packet(use_crc16 ? HDC_NAK16 : HDC_NAK, use_crc16, body, 2 + nparams, now + conf_latency);
+	bus_quiet_at = bus_free_at + IRQ_GAP_TIME;
+	return 0;
+}
+
+
+/*
+* Write out every queued frame which is due. Returns the time the next one
+* is due, or 0 if the queue is empty.
+*/
+
+static uint64_t service_tx(uint64_t now)
+{
+	int i, n;
+
+	for(n = 0; (n < tx_count) && (tx_queue[n].due <= now); n++){
+		debug_hexdump(DEBUG_ACTION, tx_queue[n].buf, tx_queue[n].len, "TX Frame: ");
+		if(write(master_fd, tx_queue[n].buf, tx_queue[n].len) != tx_queue[n].len)
+			debug(DEBUG_UNEXPECTED, "Short write to pty: %s", strerror(errno));
+		stats.frames_tx++;
+	}
+	if(n){
+		for(i = n; i < tx_count; i++)
+			tx_queue[i - n] = tx_queue[i];
+		tx_count -= n;
+	}
+	return tx_count ? tx_queue[0].due : 0;
+}
+
+
+/*
+* Open the pty pair. The slave stays open here too so the master does not
+* see EIO whenever hand closes and re-opens it.
+*/
+
+static void open_pty(void)
+{
+	struct termios termios;
+	char *name;
+
+	if((master_fd = posix_openpt(O_RDWR | O_NOCTTY)) == -1)
+		fatal_with_reason(errno, "posix_openpt");
+	if(grantpt(master_fd) || unlockpt(master_fd))
+		fatal_with_reason(errno, "Could not unlock pty");
+	if((name = ptsname(master_fd)) == NULL)
+		fatal_with_reason(errno, "ptsname");
+	if((slave_fd = open(name, O_RDWR | O_NOCTTY)) == -1)
+		fatal_with_reason(errno, "Could not open pty slave %s", name);
+
+	/* Raw mode, so nothing is echoed or translated before hand sets the port up */
+
+	if(tcgetattr(slave_fd, &termios) == 0){
+		cfmakeraw(&termios);
+		tcsetattr(slave_fd, TCSANOW, &termios);
+	}
+	if(fcntl(master_fd, F_SETFL, O_NONBLOCK) == -1)
+		fatal_with_reason(errno, "Could not set pty to non-blocking");
+
+	if(conf_link[0]){
+		(void) unlink(conf_link);
+		if(symlink(name, conf_link))
+			fatal_with_reason(errno, "Could not create link %s", conf_link);
+		printf("%s: %s -> %s\n", progname, conf_link, name);
+	}
+	else
+		printf("%s: tty = %s\n", progname, name);
+	fflush(stdout);
+}
+
+
+/*
+* Print the statistics
+*/
+
+static void print_stats(void)
+{
+	int i;
+
+	fprintf(stderr, "%s: rx %u tx %u crc errors %u format errors %u not ours %u naks %u interrupts %u broadcasts %u\n",
+		progname, stats.frames_rx, stats.frames_tx, stats.crc_errors, stats.format_errors,
+		stats.not_ours, stats.naks, stats.interrupts, stats.broadcasts);
+	fprintf(stderr, "%s: faults", progname);
+	for(i = 0; fault_names[i].name; i++)
+		fprintf(stderr, " %s %u", fault_names[i].name, stats.faults[fault_names[i].fault]);
+	fprintf(stderr, "\n");
+}
+
+
+/* Show the help screen for hansim. */
+static void hansim_show_help(void) {
+	printf("'hansim' simulates a network of HAN nodes on a pseudo terminal\n");
+	printf("\n");
+	printf("Usage: %s [OPTION]...\n", progname);
+	printf("\n");
+	printf("  -b, --baud RATE           pace responses at this line speed, 0 is\n");
+	printf("                            unpaced, default %d\n", DEF_BAUD);
+	printf("  -c, --config-file PATH    read the [hansim] section of a config file\n");
+	printf("  -d, --debug LEVEL         set the debug level, 0 is off, the\n");
+	printf("                            max level allowed is %i\n", DEBUG_MAX);
+	printf("  -e, --error-rate P        chance each frame sent suffers a random\n");
+	printf("                            corrupt, drop, truncate or garbage fault\n");
+	printf("  -f, --faults SPEC         set individual fault chances, SPEC is\n");
+	printf("                            NAME=P[,NAME=P]... with NAME one of corrupt,\n");
+	printf("                            drop, truncate, garbage, late or spurious\n");
+	printf("  -h, --help                give help on usage\n");
+	printf("  -i, --interrupt-rate N    sense line interrupts per node per minute\n");
+	printf("  -l, --link PATH           make a symlink to the pty slave, for han.conf\n");
+	printf("  -L, --latency USEC        node turnaround time, default %d\n", DEF_LATENCY);
+	printf("  -N, --node SPEC           add nodes, SPEC is ADDR[-ADDR][:relay|:generic][:crc16]\n");
+	printf("                            with addresses in hex, may be repeated\n");
+	printf("  -s, --seed N              random number seed, a run with the same\n");
+	printf("                            seed injects the same faults\n");
+	printf("  -T, --late-time USEC      delay of a late response, default %d\n", DEF_LATE_TIME);
+	printf("  -v, --version             display program version\n");
+	printf("\n");
+	printf("SIGUSR1 prints the statistics.\n");
+	printf("\n");
+	printf("Report bugs to <%s>\n", EMAIL);
+}
+
+
+/* Show the version info for hansim. */
+static void hansim_show_version(void) {
+	printf("hansim (%s) %s\n", PACKAGE, VERSION);
+}
+
+
+int main(int argc, char *argv[])
+{
+	int longindex, optchar, i, n;
+	struct pollfd pfd;
+	struct timespec ts, *tsp;
+	uint64_t now, next, t;
+	uint8_t buf[4096];
+	static char *node_args[MAX_SIM_NODES];
+	int num_node_args = 0;
+
+	/* Save the name of the program. */
+	progname=argv[0];
+
+	/* Parse the arguments. */
+	while((optchar=getopt_long(argc, argv, SHORT_OPTIONS, long_options, &longindex)) != EOF) {
+		switch(optchar) {
+			case '?':
+				exit(1);
+
+			case 'b':
+				confSaveUnsigned(optarg, CONF_UNS, &conf_baud);
+				break;
+
+			case 'c':
+				confSaveString(optarg, CONF_STRING, conf_file);
+				break;
+
+			case 'd':
+				debuglvl = atoi(optarg);
+				if(debuglvl < 0 || debuglvl > DEBUG_MAX)
+					fatal("Invalid debug level");
+				break;
+
+			case 'e':
+				if(confSaveDouble(optarg, CONF_DOUBLE, &conf_error_rate))
+					fatal("Bad error rate '%s'", optarg);
+				break;
+
+			case 'f':
+				if(confSaveFaults(optarg, CONF_FAULTS, conf_faults))
+					fatal("Bad fault spec '%s'", optarg);
+				break;
+
+			case 'h':
+				hansim_show_help();
+				exit(0);
+
+			case 'i':
+				confSaveUnsigned(optarg, CONF_UNS, &conf_irq_rate);
+				break;
+
+			case 'l':
+				confSaveString(optarg, CONF_STRING, conf_link);
+				break;
+
+			case 'L':
+				confSaveUnsigned(optarg, CONF_UNS, &conf_latency);
+				break;
+
+			case 'N':
+				if(num_node_args == MAX_SIM_NODES)
+					fatal("Too many --node arguments");
+				node_args[num_node_args++] = optarg;
+				break;
+
+			case 's':
+				confSaveUnsigned(optarg, CONF_UNS, &conf_seed);
+				break;
+
+			case 'T':
+				confSaveUnsigned(optarg, CONF_UNS, &conf_late_time);
+				break;
+
+			case 'v':
+				hansim_show_version();
+				exit(0);
+
+			default:
+				panic("Unhandled getopt return value %d", optchar);
+		}
+	}
+
+	if(optind < argc)
+		fatal("Extra argument on commandline, '%s'", argv[optind]);
+
+	/* The config file comes first, the command line adds to it */
+
+	if(conf_file[0])
+		confscan(conf_file, conf_section);
+
+	for(i = 0; i < num_node_args; i++){
+		if(confAddNode(node_args[i], CONF_NODE, NULL))
+			fatal("Bad node spec '%s'", node_args[i]);
+	}
+	if(!num_nodes)
+		fatal("No nodes to simulate, use --node");
+
+	rng_state = ((uint64_t) conf_seed << 1) | 1;
+	fault_rng_state = ((uint64_t) conf_seed << 1) ^ 0x9E3779B97F4A7C15ULL;
+
+	signal(SIGINT, handle_exit_request);
+	signal(SIGTERM, handle_exit_request);
+	signal(SIGUSR1, handle_stats_request);
+
+	frame_decoder_init(&decoder, frame_received, NULL);
+	open_pty();
+
+	for(;;){
+		if(exitRequest)
+			break;
+		if(statsRequest){
+			statsRequest = 0;
+			print_stats();
+		}
+
+		now = now_usec();
+		service_interrupts(now);
+		next = service_tx(now);
+
+		/* Sleep until something is due, or input shows up */
+
+		for(i = 0; i < num_nodes; i++){
+			t = 0;
+			if(nodes[i].irq_pending){
+				t = nodes[i].irq_due;
+				if(t < bus_quiet_at)
+					t = bus_quiet_at;
+				if(t < bus_free_at)
+					t = bus_free_at;
+			}
+			if(conf_irq_rate && (!t || nodes[i].next_event < t))
+				t = nodes[i].next_event;
+			if(t && (!next || t < next))
+				next = t;
+		}
+		if(next){
+			t = (next > now) ? next - now : 0;
+			ts.tv_sec = t / 1000000;
+			ts.tv_nsec = (t % 1000000) * 1000;
+			tsp = &ts;
+		}
+		else
+			tsp = NULL;
+
+		pfd.fd = master_fd;
+		pfd.events = POLLIN;
+		if(ppoll(&pfd, 1, tsp, NULL) < 0){
+			if(errno == EINTR)
+				continue;
+			fatal_with_reason(errno, "ppoll");
+		}
+
+		if(pfd.revents & POLLIN){
+			n = read(master_fd, buf, sizeof(buf));
+			if(n > 0)
+				frame_decoder_feed(&decoder, buf, n);
+			else if((n < 0) && (errno != EAGAIN) && (errno != EIO))
+				fatal_with_reason(errno, "Error reading pty");
+		}
+	}
+
+	print_stats();
+	if(conf_link[0])
+		(void) unlink(conf_link);
+	close(slave_fd);
+	close(master_fd);
+	exit(0);
+}
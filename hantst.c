@@ -31,6 +31,7 @@
 #include <errno.h>
 #include <popt.h>
 #include <limits.h>
+#include <time.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -39,6 +40,7 @@
 #include "confscan.h"
 #include "han.h"
 #include "hanclient.h"
+#include "socket.h"
 #include "pid.h"
 
 /* Local Defines */
@@ -49,6 +51,16 @@
 #define HANTST_NETSCAN 'i' 
 #define HANTST_GETSTATS 'g'
 #define HANTST_PPOWER 'p'
+#define HANTST_BATCH 'b'
+#define HANTST_NODESTATS 't'
+#define HANTST_QUEUESTATS 'q'
+#define HANTST_CACHESTATS 'C'
+#define HANTST_SAMPLES 'S'
+#define HANTST_HISTORY 'H'
+#define HANTST_WATCH 'w'
+#define HANTST_TEXTSTATS 'T'
+
+#define BATCH_WINDOW	8	// Most batch commands outstanding on a session at once
 
 #define CONF_STRING	1
 #define CONF_FLAG	2
@@ -63,8 +75,16 @@ char *version_string = VERSION;
 /* Local prototypes. */
 
 static void getNetworkStats(int argc, char **argv);
+static void getNodeStats(int argc, char **argv);
+static void getQueueStats(int argc, char **argv);
+static void getCacheStats(int argc, char **argv);
+static void getTextStats(int argc, char **argv);
+static void getSamples(int argc, char **argv);
+static void getHistory(int argc, char **argv);
+static void watchNode(int argc, char **argv);
 static void scanNetwork(int argc, char **argv);
 static void buildCommand(int argc, char **argv);
+static void runBatch(int argc, char **argv);
 static void doPPower( int argc, char **argv);
 static int  confSaveString(char *value, short handling, void *result);
 static int  confOrFlag(char *value, short handling, void *result);
@@ -91,15 +111,23 @@ static char *commandLineParseErr = "Command line parse error: ";
 /* Command line option table */
 
 static struct poptOption hantstOptions[] = {
+	{"batch", 'b', POPT_ARG_NONE, NULL, HANTST_BATCH},
+	{"cache-stats", 'C', POPT_ARG_NONE, NULL, HANTST_CACHESTATS},
 	{"config-file", 'c', POPT_ARG_STRING, &newConfFile, 0},
 	{"debug", 'd', POPT_ARG_INT, &debuglvl, 0},
 	{"get-stats",'g',POPT_ARG_NONE, NULL, HANTST_GETSTATS},
 	{"help", 'h', POPT_ARG_NONE, NULL, HANTST_HELP },
+	{"history", 'H', POPT_ARG_NONE, NULL, HANTST_HISTORY},
 	{"interrogate",'i',POPT_ARG_NONE, NULL, HANTST_NETSCAN},
 	{"nocheck",'n',POPT_ARG_NONE, &conf_nocheck, 0},
 	{"ppower",'p',POPT_ARG_NONE, NULL, HANTST_PPOWER},
+	{"queue-stats",'q',POPT_ARG_NONE, NULL, HANTST_QUEUESTATS},
+	{"samples",'S',POPT_ARG_NONE, NULL, HANTST_SAMPLES},
 	{"send-packet",'s', POPT_ARG_NONE, NULL, HANTST_SENDPKT},
+	{"node-times",'t', POPT_ARG_NONE, NULL, HANTST_NODESTATS},
+	{"text-stats",'T', POPT_ARG_NONE, NULL, HANTST_TEXTSTATS},
 	{"version", 'v', POPT_ARG_NONE, NULL, HANTST_VERSION},
+	{"watch", 'w', POPT_ARG_NONE, NULL, HANTST_WATCH},
 
 	{NULL, '\0', 0, NULL, 0}
 };
@@ -168,7 +196,15 @@ int main(int argc, char *argv[])
 		case HANTST_SENDPKT:
 		case HANTST_NETSCAN:
 		case HANTST_GETSTATS:
+		case HANTST_NODESTATS:
+		case HANTST_QUEUESTATS:
+		case HANTST_CACHESTATS:
+		case HANTST_TEXTSTATS:
+		case HANTST_SAMPLES:
+		case HANTST_HISTORY:
+		case HANTST_WATCH:
 		case HANTST_PPOWER:
+		case HANTST_BATCH:
 		
 			/* Build an array of strings from leftover args */
 
@@ -239,10 +275,42 @@ void hantstExecuteCommand(int command, int argc,  char **argv){
 			getNetworkStats(argc, argv);
 			break;
 
+		case HANTST_NODESTATS:
+			getNodeStats(argc, argv);
+			break;
+
+		case HANTST_QUEUESTATS:
+			getQueueStats(argc, argv);
+			break;
+
+		case HANTST_CACHESTATS:
+			getCacheStats(argc, argv);
+			break;
+
+		case HANTST_TEXTSTATS:
+			getTextStats(argc, argv);
+			break;
+
+		case HANTST_SAMPLES:
+			getSamples(argc, argv);
+			break;
+
+		case HANTST_HISTORY:
+			getHistory(argc, argv);
+			break;
+
+		case HANTST_WATCH:
+			watchNode(argc, argv);
+			break;
+
     		case HANTST_PPOWER:
       			doPPower(argc, argv);
       			break;
 
+		case HANTST_BATCH:
+			runBatch(argc, argv);
+			break;
+
 		default:
 			panic("Unknown command %d",command);
 	}
@@ -330,12 +398,338 @@ static void getNetworkStats(int argc, char **argv){
 	printf("Spurious Packets:\t%010u\n", client_command.cmd.stats.spurious_packets);
 	printf("RX Timeouts:\t\t%010u\n", client_command.cmd.stats.rx_timeouts);
 	printf("TX Timeouts:\t\t%010u\n", client_command.cmd.stats.tx_timeouts);
-	printf("CRC Errors:\t\t%010u\n\n", client_command.cmd.stats.crc_errs);
+	printf("CRC Errors:\t\t%010u\n", client_command.cmd.stats.crc_errs);
+	printf("Serial Reads:\t\t%010u\n", client_command.cmd.stats.rx_syscalls);
+	printf("Serial Bytes In:\t%010u\n", client_command.cmd.stats.rx_bytes);
+	printf("Serial Writes:\t\t%010u\n", client_command.cmd.stats.tx_syscalls);
+	printf("Serial Bytes Out:\t%010u\n\n", client_command.cmd.stats.tx_bytes);
 
 }
+
+
+/*
+* List the response times and errors hand has recorded for each node
+*/
+
+static void getNodeStats(int argc, char **argv){
+
+	unsigned i, first = 0;
+	Client_Command client_command;
+	struct node_stats *ns;
+
+	if(argc)
+		fatal("%sNo arguments allowed for -t", commandLineParseErr);
+
+	printf("\nNode State  Samples Timeouts  SRTT ms RTTVAR ms Timeout ms  Downs    Ups  Refused  CRC  NAK  Fmt  Idle s\n");
+	do{
+		memset(&client_command, 0, sizeof(Client_Command));
+		client_command.request = HAN_CCMD_NODESTATS;
+		client_command.cmd.nodestats.first = (unsigned char) first;
+
+		hanclient_send_command(&client_command);
+
+		for(i = 0 ; i < client_command.cmd.nodestats.numnodes ; i++){
+			ns = &client_command.cmd.nodestats.nodelist[i];
+			printf("%02X   %-5s %8u %8u %8.2f %9.2f %10.2f %6u %6u %8u %4u %4u %4u ",
+				(unsigned) ns->addr, (ns->state == HAN_NODE_DOWN) ? "down" : "up",
+				ns->samples, ns->timeouts, ns->srtt / 1000.0, ns->rttvar / 1000.0,
+				ns->timeout / 1000.0, ns->downs, ns->ups, ns->refused,
+				ns->crc_errs, ns->naks, ns->format_errs);
+			if(ns->idle == HAN_NODE_NEVER_SEEN)
+				printf("%7s\n", "-");
+			else
+				printf("%7u\n", ns->idle);
+			first = ns->addr + 1;
+		}
+	} while(client_command.cmd.nodestats.more && (first < 256));
+	printf("\n");
+}
 			
 
 
+/*
+* List how long transactions have waited for the bus at each priority
+*/
+
+static void getQueueStats(int argc, char **argv){
+
+	static const char *names[HAN_PRIO_CLASSES] = {"interrupt", "interactive", "bulk"};
+	unsigned i;
+	Client_Command client_command;
+	struct queue_stats *qs;
+
+	if(argc)
+		fatal("%sNo arguments allowed for -q", commandLineParseErr);
+
+	memset(&client_command, 0, sizeof(Client_Command));
+	client_command.request = HAN_CCMD_QUEUESTATS;
+
+	hanclient_send_command(&client_command);
+
+	printf("\nPriority     Depth MaxDepth   Served Promoted   Shared  Avg wait ms  Max wait ms\n");
+	for(i = 0 ; i < HAN_PRIO_CLASSES ; i++){
+		qs = &client_command.cmd.queuestats.queue[i];
+		printf("%-11s %6u %8u %8u %8u %8u %12.1f %12u\n", names[i], qs->depth, qs->maxdepth,
+			qs->served, qs->promoted, qs->coalesced, qs->served ? (double) qs->waittotal / qs->served : 0.0, qs->waitmax);
+	}
+	printf("\n");
+}
+
+
+/*
+* Show how many node commands have been answered from the response cache
+*/
+
+static void getCacheStats(int argc, char **argv){
+
+	Client_Command client_command;
+	Han_Cachestats *cs = &client_command.cmd.cachestats;
+	unsigned lookups;
+
+	if(argc)
+		fatal("%sNo arguments allowed for -C", commandLineParseErr);
+
+	memset(&client_command, 0, sizeof(Client_Command));
+	client_command.request = HAN_CCMD_CACHESTATS;
+
+	hanclient_send_command(&client_command);
+
+	lookups = cs->hits + cs->misses;
+	printf("\n    Hits   Misses  Hit %%   Stores  Invalidated  Evicted  Entries\n");
+	printf("%8u %8u %6.1f %8u %12u %8u %8u\n\n", cs->hits, cs->misses,
+		lookups ? 100.0 * cs->hits / lookups : 0.0, cs->stores, cs->invalidations, cs->evictions, cs->entries);
+}
+
+
+/*
+* Show how the text sockets are keeping up with the events sent to them
+*/
+
+static void getTextStats(int argc, char **argv){
+
+	Client_Command client_command;
+	Han_Textstats *ts = &client_command.cmd.textstats;
+
+	if(argc)
+		fatal("%sNo arguments allowed for -T", commandLineParseErr);
+
+	memset(&client_command, 0, sizeof(Client_Command));
+	client_command.request = HAN_CCMD_TEXTSTATS;
+
+	hanclient_send_command(&client_command);
+
+	printf("\n Sockets   Queued  MaxQueued    Events  Dropped  Disconnected\n");
+	printf("%8u %8u %10u %9u %8u %13u\n\n", ts->sockets, ts->queued, ts->maxqueued,
+		ts->events, ts->dropped, ts->disconnects);
+}
+
+
+/*
+* Ask for the samples of a series numbered since or later
+*/
+
+static int askSamples(Client_Command *client_command, unsigned series, unsigned since){
+
+	memset(client_command, 0, sizeof(Client_Command));
+	client_command->request = HAN_CCMD_SAMPLES;
+	client_command->cmd.samples.series = (unsigned char) series;
+	client_command->cmd.samples.since = since;
+	return hanclient_send_command_return_res(client_command);
+}
+
+
+/*
+* Print one sample
+*/
+
+static void printSample(struct sample *sp, unsigned n){
+
+	printf("%8u %8u ", sp->seq, sp->age);
+	if(sp->status != HAN_CSTS_OK)
+		printf("Error %d\n", sp->status);
+	else
+		printByteSequence(sp->values, n);
+}
+
+
+/*
+* List the series the daemon samples with the newest sample of each, or
+* every sample kept of one series
+*/
+
+static void getSamples(int argc, char **argv){
+
+	Client_Command client_command;
+	Han_Samples *hs = &client_command.cmd.samples;
+	unsigned i, series, since = 0;
+
+	if(argc > 1)
+		fatal("%sOnly one argument allowed for -S", commandLineParseErr);
+
+	/* Every sample kept of one series */
+
+	if(argc){
+		series = (unsigned) strtoul(argv[0], NULL, 0);
+		if(askSamples(&client_command, series, since) != HAN_CSTS_OK)
+			fatal("No series %u, there are %u", series, (unsigned) hs->numseries);
+		printf("\n     Seq   Age ms Values\n");
+		for(;;){
+			for(i = 0; i < hs->numsamples; i++){
+				printSample(&hs->samples[i], hs->numparams);
+				since = hs->samples[i].seq + 1;
+			}
+			if(!hs->more || (askSamples(&client_command, series, since) != HAN_CSTS_OK))
+				break;
+		}
+		printf("\n");
+		return;
+	}
+
+	/* The newest sample of each series */
+
+	if((askSamples(&client_command, 0, UINT_MAX) != HAN_CSTS_OK) || !hs->numseries){
+		printf("No samples configured\n");
+		return;
+	}
+	printf("\nSeries Node Cmd Interval ms      Seq   Age ms Values\n");
+	for(series = 0; series < hs->numseries; series++){
+		if(askSamples(&client_command, series, UINT_MAX) != HAN_CSTS_OK)
+			break;
+		printf("%6u %02X   %02X  %11u ", series, (unsigned) hs->addr, (unsigned) hs->cmd, hs->interval);
+		if(!hs->last || (askSamples(&client_command, series, hs->last) != HAN_CSTS_OK) || !hs->numsamples)
+			printf("%8s\n", "-");
+		else
+			printSample(&hs->samples[0], hs->numparams);
+	}
+	printf("\n");
+}
+
+
+/*
+* List the values stored for a series over the last so many seconds, an
+* hour by default, step seconds to a line
+*/
+
+static void getHistory(int argc, char **argv){
+
+	Client_Command client_command;
+	Han_History *hh = &client_command.cmd.history;
+	unsigned i, series, secs = 3600, step = 0, from;
+	int shown = FALSE;
+	time_t now = time(NULL), t;
+	char when[32];
+
+	if((argc < 1) || (argc > 3))
+		fatal("%s-H takes a series, and optionally seconds back and seconds per line", commandLineParseErr);
+	series = (unsigned) strtoul(argv[0], NULL, 0);
+	if(argc > 1)
+		secs = (unsigned) strtoul(argv[1], NULL, 0);
+	if(argc > 2)
+		step = (unsigned) strtoul(argv[2], NULL, 0);
+	from = (secs < now) ? (unsigned)(now - secs) : 0;
+
+	do{
+		memset(&client_command, 0, sizeof(Client_Command));
+		client_command.request = HAN_CCMD_HISTORY;
+		hh->series = (unsigned char) series;
+		hh->from = from;
+		hh->to = (unsigned) now;
+		hh->step = step;
+		if(hanclient_send_command_return_res(&client_command) != HAN_CSTS_OK)
+			fatal("Series %u isn't stored", series);
+		if(!shown){
+			printf("\nTime                   Count      Min      Max      Avg\n");
+			shown = TRUE;
+		}
+		for(i = 0; i < hh->numpoints; i++){
+			t = (time_t) hh->points[i].time;
+			strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&t));
+			printf("%s %8u %8d %8d %8d\n", when, hh->points[i].count,
+				hh->points[i].min, hh->points[i].max, hh->points[i].avg);
+		}
+		from = hh->from;
+	} while(hh->more);
+	printf("\n");
+}
+
+
+/*
+* Have the daemon watch a node command, and print each change until
+* interrupted. The first argument is the interval in msec, optionally
+* followed by the offset and type of the value to watch and its deadband,
+* as in 1000:3I:4. The rest are the packet, as for -s.
+*/
+
+static void watchNode(int argc, char **argv){
+
+	Client_Command client_command;
+	Han_Watch_Entry *we = &client_command.cmd.watch;
+	int i, session;
+	unsigned j, type;
+	char *end, when[32];
+	time_t t;
+
+	if(argc < 3)
+		fatal("%s-w takes an interval, then a packet as for -s", commandLineParseErr);
+	if(argc - 3 > MAX_NODE_PARAMS)
+		fatal("Too many parameters specified, max is %d",MAX_NODE_PARAMS);
+
+	memset(&client_command, 0, sizeof(Client_Command));
+	client_command.request = HAN_CCMD_WATCH;
+	we->interval = (unsigned) strtoul(argv[0], &end, 10);
+	if(*end == ':'){
+		we->offset = (unsigned char) strtoul(end + 1, &end, 10);
+		if(!*end || !strchr("BIU", *end))
+			fatal("%sWatched value type must be B, I or U", commandLineParseErr);
+		we->type = (unsigned char) *end++;
+		if(*end == ':')
+			we->deadband = (unsigned) strtoul(end + 1, &end, 10);
+	}
+	if(*end)
+		fatal("%sBad watch interval %s", commandLineParseErr, argv[0]);
+
+	sscanf(argv[1],"%x",&j);
+	we->addr = (unsigned char) j;
+	sscanf(argv[2],"%x",&j);
+	we->cmd = (unsigned char) j;
+	we->numparams = (unsigned char)(argc - 3);
+	for(i = 3; i < argc; i++){
+		sscanf(argv[i],"%x",&j);
+		we->params[i - 3] = (unsigned char) j;
+	}
+
+	/* Changes come back as more responses on the session, for as long as it is open */
+
+	if((session = hanclient_session_open()) == -1)
+		fatal("Daemon doesn't support watches");
+	type = we->type;
+	hanclient_session_send(session, 1, &client_command);
+	hanclient_session_receive(session, &client_command);
+	if(client_command.commstatus == HAN_CSTS_INVPARM)
+		fatal("Daemon can't take the watch");
+	hanclient_error_check(&client_command);
+	printf("Watch %u started\n", we->id);
+
+	for(;;){
+		socket_wait_read(session, -1);
+		hanclient_session_receive(session, &client_command);
+		if(!we->event)
+			continue;
+		t = time(NULL);
+		strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&t));
+		if(we->status != HAN_CSTS_OK)
+			printf("%s Error %d\n", when, we->status);
+		else if(type)
+			printf("%s %d\n", when, we->value);
+		else{
+			printf("%s ", when);
+			printByteSequence(we->values, we->numparams);
+		}
+		fflush(stdout);
+	}
+}
+
+
 /*
 * Scan the network for attached nodes
 */
@@ -343,18 +737,47 @@ static void getNetworkStats(int argc, char **argv){
 static void scanNetwork(int argc, char **argv){
 
 	unsigned i;
+	int session, shown = FALSE;
 	Client_Command client_command;
 	
-	if(argc)
-		fatal("%sNo arguments allowed for -i",commandLineParseErr);
+	memset(&client_command, 0, sizeof(Client_Command));
+
+	if(argc > 1)
+		fatal("%sOnly one argument allowed for -i", commandLineParseErr);
+	if(argc == 1){
+		if(!strcmp(argv[0], "refresh"))
+			client_command.cmd.scan.flags = HAN_NETSCAN_REFRESH;
+		else if(!strcmp(argv[0], "cancel"))
+			client_command.cmd.scan.flags = HAN_NETSCAN_CANCEL;
+		else
+			fatal("%sInvalid argument for -i", commandLineParseErr);
+	}
 
 	/* Set the command */
 
 	client_command.request = HAN_CCMD_NETSCAN;
 
-	/* Send it to the daemon */
+	/* Send it to the daemon. Over a session, show how far the scan has got as it goes. */
 	
-	hanclient_send_command(&client_command);
+	if((session = hanclient_session_open()) != -1){
+		client_command.cmd.scan.flags |= HAN_NETSCAN_PROGRESS;
+		hanclient_session_send(session, 1, &client_command);
+		for(;;){
+			hanclient_session_receive(session, &client_command);
+			if(!(client_command.cmd.scan.flags & HAN_NETSCAN_PARTIAL))
+				break;
+			fprintf(stderr, "\rScanned to %02X, %u nodes found", 
+				(unsigned) client_command.cmd.scan.lastaddr, 
+				(unsigned) client_command.cmd.scan.numnodesfound);
+			shown = TRUE;
+		}
+		if(shown)
+			fprintf(stderr, "\n");
+		hanclient_session_close(session);
+		hanclient_error_check(&client_command);
+	}
+	else
+		hanclient_send_command(&client_command);
 	
 	/* If nodes found, list them else print no nodes found message */
 
@@ -455,6 +878,113 @@ static void buildCommand(int argc, char **argv){
 }
 
 
+/*
+* Parse one line of a batch into a send packet command block.
+* Returns PASS, or FAIL if the line is blank or bad.
+*/
+
+static int parseBatchLine(char *line, Client_Command *client_command)
+{
+	char *tok;
+	unsigned j;
+	int n;
+
+	memset(client_command, 0, sizeof(Client_Command));
+	client_command->request = HAN_CCMD_SENDPKT;
+
+	for(n = 0, tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n"), n++){
+		if(sscanf(tok, "%x", &j) != 1)
+			return FAIL;
+		if(n == 0)
+			client_command->cmd.pkt.nodeaddress = (unsigned char) j;
+		else if(n == 1)
+			client_command->cmd.pkt.nodecommand = (unsigned char) j;
+		else if(n - 2 < MAX_NODE_PARAMS)
+			client_command->cmd.pkt.nodeparams[n - 2] = (unsigned char) j;
+		else
+			return FAIL;
+	}
+	if(n < 2)
+		return FAIL;
+	client_command->cmd.pkt.numnodeparams = n - 2;
+	return PASS;
+}
+
+
+/* Print the outcome of one batch command */
+
+static void printBatchResult(unsigned line, Client_Command *client_command)
+{
+	printf("%u: ", line);
+	if(client_command->commstatus != HAN_CSTS_OK)
+		printf("Error %d\n", client_command->commstatus);
+	else if(client_command->cmd.pkt.numnodeparams){
+		printf("Received: ");
+		printByteSequence(client_command->cmd.pkt.nodestatus,
+			client_command->cmd.pkt.numnodeparams);
+	}
+	else
+		printf("Command acknowledged by node\n");
+}
+
+
+/*
+* Send packets read from stdin, one per line in the same form as -s. The
+* packets go over one session connection with several outstanding at once.
+* Each result line starts with the input line number it belongs to.
+*/
+
+static void runBatch(int argc, char **argv)
+{
+	char line[256];
+	unsigned lineno = 0, outstanding = 0, tag;
+	int session;
+	Client_Command client_command, response;
+
+	if(argc)
+		fatal("%sNo arguments allowed for -b", commandLineParseErr);
+
+	hanclient_use_bulk();
+	session = hanclient_session_open();
+	if(session == -1)
+		debug(DEBUG_EXPECTED, "Falling back to one connection per packet");
+
+	while(fgets(line, sizeof(line), stdin)){
+		lineno++;
+		if((line[0] == '#') || (strspn(line, " \t\r\n") == strlen(line)))
+			continue;
+		if(parseBatchLine(line, &client_command)){
+			printf("%u: Bad packet\n", lineno);
+			continue;
+		}
+
+		if(session == -1){
+			hanclient_send_command_return_res(&client_command);
+			printBatchResult(lineno, &client_command);
+			continue;
+		}
+
+		/* Keep a window of commands in flight */
+
+		if(outstanding == BATCH_WINDOW){
+			tag = hanclient_session_receive(session, &response);
+			printBatchResult(tag, &response);
+			outstanding--;
+		}
+		hanclient_session_send(session, lineno, &client_command);
+		outstanding++;
+	}
+
+	for(; outstanding; outstanding--){
+		tag = hanclient_session_receive(session, &response);
+		printBatchResult(tag, &response);
+	}
+
+	if(session != -1)
+		hanclient_session_close(session);
+}
+
+
 /* Print a byte sequence */
 
 static void printByteSequence(unsigned char *p, int len)
@@ -506,16 +1036,40 @@ static void hantstShowHelp(void) {
   printf("\n");
   printf("Usage: %s [OPTION]...\n", progname);
   printf("\n");
+  printf("  -b, --batch             send the packets read from stdin, one per line,\n");
+  printf("                          over a single connection, behind interactive\n");
+  printf("                          commands\n");
+  printf("  -C, --cache-stats       show how many node commands have been answered\n");
+  printf("                          from the response cache\n");
   printf("  -c, --config-file=path  set the path for the config file\n");
   printf("  -d, --debug=LEVEL       set the debug level, 0 is off, the\n");
   printf("                          compiled in default is %i and the max\n", DEBUGLVL);
   printf("                          level allowed is %i\n", DEBUG_MAX);
   printf("  -g  --get-stats [clr]   get network error statistics\n");
   printf("  -h, --help              give help on usage\n");
-  printf("  -i, --interrogate       interrogate network for attached nodes\n");
+  printf("  -H, --history series [secs [step]]\n");
+  printf("                          list the values stored for a series over the\n");
+  printf("                          last secs seconds, an hour by default, summed\n");
+  printf("                          up step seconds to a line\n");
+  printf("  -i, --interrogate [refresh|cancel]\n");
+  printf("                          list the nodes found by the last network scan,\n");
+  printf("                          scanning first if there hasn't been one. refresh\n");
+  printf("                          scans again, cancel stops a scan in progress\n");
   printf("  -p, --ppower            send a ppower command string\n");
+  printf("  -q, --queue-stats       show how long bus transactions have waited\n");
+  printf("                          at each priority\n");
+  printf("  -S, --samples [series]  list what the daemon samples and the newest\n");
+  printf("                          sample of each, or every sample kept of series\n");
   printf("  -s, --send-packet pkt   send a packet, and wait for a response\n"); 
+  printf("  -t, --node-times        list the response times measured for each node,\n");
+  printf("                          its errors, and whether it is answering\n");
+  printf("  -T, --text-stats        show how many events have been dropped for\n");
+  printf("                          text socket clients which aren't keeping up\n");
   printf("  -v, --version           display program version\n");
+  printf("  -w, --watch msec[:offset type[:deadband]] pkt\n");
+  printf("                          have the daemon send pkt every msec, and show\n");
+  printf("                          each change in the response, or in the B, I or\n");
+  printf("                          U value at offset by more than deadband\n");
   printf("\n");
   printf("Report bugs to <%s>\n",EMAIL);
   return;
@@ -0,0 +1,174 @@
+/*
+ * health.c.  Per node health tracking.
+ *
+ * A node which misses enough responses in a row is taken as down, and
+ * commands for it fail straight away with HAN_CSTS_NODE_DOWN instead of
+ * holding the bus for every retry. The bus thread checks on down nodes
+ * every so often, and they are back in service as soon as they answer
+ * anything, a check, a scan or an interrupt.
+ *
+ * A node's health is kept in its node registry record.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "tnd.h"
+#include "options.h"
+#include "error.h"
+#include "han.h"
+#include "evloop.h"
+#include "noderec.h"
+#include "health.h"
+
+/* Locals */
+
+static unsigned health_down_after = CONF_DOWN_AFTER;
+static unsigned health_probe_interval = CONF_PROBE_INTERVAL * 1000;
+
+
+/*
+* Set how many timeouts in a row take a node down, 0 to never, and how
+* many seconds apart down nodes are checked on. Only to be called while
+* the bus thread isn't running.
+*/
+
+void health_config(unsigned down_after, unsigned probe_interval)
+{
+	health_down_after = (down_after > 255) ? 255 : down_after;
+	health_probe_interval = (probe_interval ? probe_interval : 1) * 1000;
+}
+
+
+/*
+* Return TRUE if commands may be sent to a node. Counts the command as
+* refused if not.
+*/
+
+int health_admit(unsigned addr)
+{
+	Node_Rec *nr = noderec_get(addr);
+
+	if(nr->state == HAN_NODE_UP)
+		return TRUE;
+	noderec_begin(nr);
+	nr->refused++;
+	noderec_end(nr);
+	return FALSE;
+}
+
+
+/*
+* A node sent something back, so it's alive
+*/
+
+void health_answered(unsigned addr)
+{
+	Node_Rec *nr = noderec_get(addr);
+
+	if((nr->state == HAN_NODE_UP) && !nr->misses)
+		return;
+	noderec_begin(nr);
+	nr->misses = 0;
+	if(nr->state != HAN_NODE_UP){
+		nr->state = HAN_NODE_UP;
+		nr->ups++;
+		debug(DEBUG_UNEXPECTED, "Node 0x%02X is answering again", addr & 0xFF);
+	}
+	noderec_end(nr);
+}
+
+
+/*
+* A node didn't answer in time. Returns TRUE if it is now taken as down.
+*/
+
+int health_missed(unsigned addr)
+{
+	Node_Rec *nr = noderec_get(addr);
+	int down = FALSE;
+
+	if(nr->state != HAN_NODE_UP)
+		return TRUE;
+	if(!health_down_after)
+		return FALSE;
+
+	noderec_begin(nr);
+	if(++nr->misses >= health_down_after){
+		nr->probe_at = evloop_now() + health_probe_interval;
+		nr->state = HAN_NODE_DOWN;
+		nr->downs++;
+		down = TRUE;
+	}
+	noderec_end(nr);
+	if(down)
+		debug(DEBUG_UNEXPECTED, "Node 0x%02X missed %u responses, taking it as down", addr & 0xFF, nr->misses);
+	return down;
+}
+
+
+/*
+* Look for a down node which is due to be checked on. Returns 0 with its
+* address in addr if one is due now, else the milliseconds until the next
+* one is, or -1 if no node is down.
+*/
+
+int health_next_probe(uint64_t now, unsigned *addr)
+{
+	uint64_t soonest = 0;
+	unsigned i;
+	int found = FALSE;
+	Node_Rec *nr;
+
+	for(i = 0; i < 256; i++){
+		nr = noderec_get(i);
+		if(nr->state == HAN_NODE_UP)
+			continue;
+		if(nr->probe_at <= now){
+			*addr = i;
+			return 0;
+		}
+		if(!found || (nr->probe_at < soonest))
+			soonest = nr->probe_at;
+		found = TRUE;
+	}
+	return found ? (int)(soonest - now) : -1;
+}
+
+
+/*
+* Record the outcome of a check on a down node
+*/
+
+void health_probed(unsigned addr, int answered)
+{
+	Node_Rec *nr;
+
+	if(answered){
+		health_answered(addr);
+		return;
+	}
+	nr = noderec_get(addr);
+	noderec_begin(nr);
+	nr->probe_at = evloop_now() + health_probe_interval;
+	noderec_end(nr);
+}
@@ -0,0 +1,274 @@
+/*
+ * inventory.c.  Persistent node inventory.
+ *
+ * Keeps what the daemon has learned about each node, its type, firmware
+ * level, attribute bits, when it was last heard from and how quickly it
+ * answers, in a text file so a restart doesn't have to learn it all again.
+ * The file has one line per node:
+ *
+ *   addr type fwlevel attr lastseen srtt rttvar samples
+ *
+ * with the first four in hex, lastseen in seconds since the epoch, and the
+ * times in microseconds. Changes are written out a few seconds after they
+ * happen, to a temporary file which is then renamed over the old one.
+ *
+ * The inventory is kept in the node registry, and only the bus thread
+ * uses it.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include "tnd.h"
+#include "options.h"
+#include "error.h"
+#include "evloop.h"
+#include "noderec.h"
+#include "inventory.h"
+
+/* Local defines */
+
+#define INV_MAX_LINE	128
+
+/* Locals */
+
+static char inv_path[MAX_CONFIG_STRING] = "";
+static uint64_t inv_dirty_since = 0;	// When the first unsaved change was made, 0 if none
+
+
+/*
+* Note there is something to write
+*/
+
+static void inventory_dirty(void)
+{
+	if(inv_path[0] && !inv_dirty_since)
+		inv_dirty_since = evloop_now();
+}
+
+
+/*
+* Read the inventory file at path into the node registry. Nodes already in
+* the registry keep what it has for them. An empty path turns the inventory
+* file off. Returns the number of nodes read, or FAIL if the file exists but
+* couldn't be read.
+*/
+
+int inventory_open(const char *path)
+{
+	FILE *file;
+	char line[INV_MAX_LINE];
+	unsigned addr, type, fwlevel, attr, srtt, rttvar, samples;
+	unsigned long lastseen;
+	int lineno = 0, count = 0;
+	Node_Rec *nr;
+
+	strncpy(inv_path, path, MAX_CONFIG_STRING - 1);
+	inv_path[MAX_CONFIG_STRING - 1] = 0;
+	inv_dirty_since = 0;
+
+	if(!inv_path[0])
+		return 0;
+
+	if((file = fopen(inv_path, "r")) == NULL){
+		if(errno == ENOENT){
+			debug(DEBUG_STATUS, "No inventory file %s yet", inv_path);
+			return 0;
+		}
+		debug(DEBUG_UNEXPECTED, "Could not open inventory file %s: %s", inv_path, strerror(errno));
+		return FAIL;
+	}
+
+	while(fgets(line, INV_MAX_LINE, file) != NULL){
+		lineno++;
+		if((line[0] == '#') || (line[0] == '\n'))
+			continue;
+		if((sscanf(line, "%x %x %x %x %lu %u %u %u", &addr, &type, &fwlevel, &attr,
+			&lastseen, &srtt, &rttvar, &samples) != 8) || (addr > 0xFF)){
+			debug(DEBUG_UNEXPECTED, "Bad line %d in inventory file %s", lineno, inv_path);
+			continue;
+		}
+		count++;
+		nr = noderec_get(addr);
+		if(nr->flags & NR_KNOWN)
+			continue;
+		noderec_begin(nr);
+		nr->flags = NR_KNOWN;
+		if(type != 0xFFFF){
+			nr->flags |= NR_IDENTIFIED;
+			nr->type = (uint16_t) type;
+			nr->fwlevel = (uint16_t) fwlevel;
+		}
+		nr->attr = (uint8_t) attr;
+		nr->lastseen = (uint32_t) lastseen;
+		if(!nr->rtt.samples){
+			nr->rtt.srtt = srtt;
+			nr->rtt.rttvar = rttvar;
+			nr->rtt.samples = samples;
+		}
+		noderec_end(nr);
+	}
+	fclose(file);
+	debug(DEBUG_STATUS, "Read %d nodes from inventory file %s", count, inv_path);
+	return count;
+}
+
+
+/*
+* A node has been heard from
+*/
+
+void inventory_seen(unsigned addr)
+{
+	Node_Rec *nr = noderec_get(addr);
+	uint32_t now = (uint32_t) time(NULL);
+
+	if(!(nr->flags & NR_KNOWN) || (now - nr->lastseen >= INVENTORY_SEEN_STEP))
+		inventory_dirty();
+	noderec_begin(nr);
+	nr->flags |= NR_KNOWN;
+	nr->lastseen = now;
+	noderec_end(nr);
+}
+
+
+/*
+* A node has answered a NODEID command
+*/
+
+void inventory_identify(unsigned addr, unsigned type, unsigned fwlevel)
+{
+	Node_Rec *nr = noderec_get(addr);
+
+	if(!(nr->flags & NR_IDENTIFIED) || (nr->type != type) || (nr->fwlevel != fwlevel))
+		inventory_dirty();
+	noderec_begin(nr);
+	nr->flags |= NR_IDENTIFIED;
+	nr->type = (uint16_t) type;
+	nr->fwlevel = (uint16_t) fwlevel;
+	noderec_end(nr);
+	inventory_seen(addr);
+}
+
+
+/*
+* A node's attribute bits have changed
+*/
+
+void inventory_set_attr(unsigned addr, unsigned attr)
+{
+	Node_Rec *nr = noderec_get(addr);
+
+	if(nr->attr == (uint8_t) attr)
+		return;
+	inventory_dirty();
+	noderec_begin(nr);
+	nr->attr = (uint8_t) attr;
+	noderec_end(nr);
+}
+
+
+/*
+* A node has gone from the network. What was measured about it, and its
+* attribute bits, stay in the registry, but it is no longer listed. Should
+* it come back, it is still spoken to with the CRC it was using.
+*/
+
+void inventory_forget(unsigned addr)
+{
+	Node_Rec *nr = noderec_get(addr);
+
+	if(!(nr->flags & NR_KNOWN))
+		return;
+	inventory_dirty();
+	noderec_begin(nr);
+	nr->flags = 0;
+	nr->type = nr->fwlevel = 0;
+	noderec_end(nr);
+}
+
+
+/*
+* Write the inventory file
+*/
+
+static int inventory_write(void)
+{
+	FILE *file;
+	char tmp[MAX_CONFIG_STRING + 8];
+	unsigned i;
+	Node_Rec *nr;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", inv_path);
+	if((file = fopen(tmp, "w")) == NULL){
+		debug(DEBUG_UNEXPECTED, "Could not create %s: %s", tmp, strerror(errno));
+		return FAIL;
+	}
+
+	fprintf(file, "# hand node inventory, rewritten while hand runs\n");
+	fprintf(file, "# addr type fwlevel attr lastseen srtt rttvar samples\n");
+	for(i = 0; i < 256; i++){
+		nr = noderec_get(i);
+		if(!(nr->flags & NR_KNOWN))
+			continue;
+		fprintf(file, "%02X %04X %04X %02X %lu %u %u %u\n", i,
+			(nr->flags & NR_IDENTIFIED) ? nr->type : 0xFFFF, (nr->flags & NR_IDENTIFIED) ? nr->fwlevel : 0xFFFF,
+			nr->attr, (unsigned long) nr->lastseen, nr->rtt.srtt, nr->rtt.rttvar, nr->rtt.samples);
+	}
+
+	if(fclose(file) || rename(tmp, inv_path)){
+		debug(DEBUG_UNEXPECTED, "Could not write inventory file %s: %s", inv_path, strerror(errno));
+		unlink(tmp);
+		return FAIL;
+	}
+	debug(DEBUG_ACTION, "Wrote inventory file %s", inv_path);
+	return PASS;
+}
+
+
+/*
+* Write the inventory file if it has changes which have waited long enough,
+* or straight away if force is TRUE, so the latest response times are kept.
+* Returns the msec until a write will be due, or -1 if there is nothing to
+* write.
+*/
+
+int inventory_flush(int force)
+{
+	uint64_t now;
+
+	if(force && inv_path[0])
+		inventory_dirty();
+	if(!inv_dirty_since)
+		return -1;
+	now = evloop_now();
+	if(!force && (now - inv_dirty_since < INVENTORY_WRITE_DELAY))
+		return (int)(inv_dirty_since + INVENTORY_WRITE_DELAY - now);
+
+	/* If the write fails, try again after another delay */
+
+	inv_dirty_since = inventory_write() ? now : 0;
+	return inv_dirty_since ? INVENTORY_WRITE_DELAY : -1;
+}
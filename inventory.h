@@ -0,0 +1,45 @@
+/*
+ * inventory.h.  Persistent node inventory.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#ifndef INVENTORY_H
+#define INVENTORY_H
+
+/* Changes are gathered for this many msec before the file is written */
+
+#define INVENTORY_WRITE_DELAY	5000
+
+/* A node's last seen time may fall this many seconds behind before it's worth a write */
+
+#define INVENTORY_SEEN_STEP	60
+
+/* Prototypes */
+
+int inventory_open(const char *path);
+void inventory_seen(unsigned addr);
+void inventory_identify(unsigned addr, unsigned type, unsigned fwlevel);
+void inventory_set_attr(unsigned addr, unsigned attr);
+void inventory_forget(unsigned addr);
+int inventory_flush(int force);
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * isub.c.  Interrupt report subscriptions.
+ *
+ * A text port client can ask for the interrupt reports from every node, or
+ * only from some nodes, and of those only the ones whose reason code has
+ * some of the bits of a mask set. Each subscriber has a slot, and each node
+ * address a bitmap of the slots subscribed to it, kept up to date as
+ * filters are added, so handing out a report only visits the subscribers
+ * which want reports from its node. The reason masks are then checked for
+ * just those.
+ *
+ * Slots are added 64 at a time as clients subscribe, and reused once a
+ * client goes.
+ *
+ * Only the network loop uses the subscriptions.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "tnd.h"
+#include "options.h"
+#include "error.h"
+#include "isub.h"
+
+/* Typedefs */
+
+typedef struct isub_slot Isub_Slot;
+
+/* A subscriber */
+
+struct isub_slot {
+	void *owner;				// NULL if the slot is free
+	uint16_t mask[256];			// Reason mask by node address, 0 if not subscribed
+};
+
+/* Locals */
+
+static Isub_Slot *isub_slots = NULL;
+static unsigned isub_words = 0;			// 64 bit words in each node's bitmap
+static uint64_t *isub_bits = NULL;		// Node addr's bitmap at addr * isub_words
+
+
+/*
+* Return the slot of a subscriber, or -1 if it hasn't one
+*/
+
+static int isub_find(const void *owner)
+{
+	unsigned i;
+
+	for(i = 0; i < isub_words * 64; i++){
+		if(isub_slots[i].owner == owner)
+			return (int) i;
+	}
+	return -1;
+}
+
+
+/*
+* Give a subscriber a slot, adding 64 more if they're all in use. Returns
+* -1 if there isn't the memory for them.
+*/
+
+static int isub_alloc(void *owner)
+{
+	Isub_Slot *slots;
+	uint64_t *bits;
+	unsigned i, words = isub_words + 1;
+	int s;
+
+	if((s = isub_find(NULL)) < 0){
+		if((slots = realloc(isub_slots, words * 64 * sizeof(Isub_Slot))) == NULL)
+			return -1;
+		isub_slots = slots;
+		memset(slots + isub_words * 64, 0, 64 * sizeof(Isub_Slot));
+		if((bits = calloc(256 * words, sizeof(uint64_t))) == NULL)
+			return -1;
+		for(i = 0; i < 256; i++)
+			memcpy(bits + i * words, isub_bits + i * isub_words, isub_words * sizeof(uint64_t));
+		free(isub_bits);
+		isub_bits = bits;
+		s = (int)(isub_words * 64);
+		isub_words = words;
+		debug(DEBUG_EXPECTED, "Room for %u interrupt report subscribers", words * 64);
+	}
+	isub_slots[s].owner = owner;
+	return s;
+}
+
+
+/*
+* Subscribe owner to the interrupt reports from nodes lo to hi whose reason
+* code has a bit of mask set, or all of them if mask is ISUB_ANY_REASON.
+* Adds to what it is already subscribed to. Returns FAIL if there isn't the
+* memory.
+*/
+
+int isub_add(void *owner, unsigned lo, unsigned hi, unsigned mask)
+{
+	Isub_Slot *sp;
+	unsigned a;
+	int s;
+
+	if(((s = isub_find(owner)) < 0) && ((s = isub_alloc(owner)) < 0)){
+		debug(DEBUG_UNEXPECTED, "Out of memory for an interrupt report subscriber");
+		return FAIL;
+	}
+	sp = &isub_slots[s];
+	for(a = lo; (a <= hi) && (a < 256); a++){
+		sp->mask[a] |= (uint16_t) mask;
+		if(sp->mask[a])
+			isub_bits[a * isub_words + s / 64] |= (uint64_t) 1 << (s % 64);
+	}
+	return PASS;
+}
+
+
+/*
+* Unsubscribe owner from everything
+*/
+
+void isub_drop(void *owner)
+{
+	unsigned a;
+	int s;
+
+	if(!owner || ((s = isub_find(owner)) < 0))
+		return;
+	for(a = 0; a < 256; a++)
+		isub_bits[a * isub_words + s / 64] &= ~((uint64_t) 1 << (s % 64));
+	memset(&isub_slots[s], 0, sizeof(Isub_Slot));
+}
+
+
+/*
+* Call deliver for each subscriber to an interrupt report from a node with
+* a reason code. deliver may drop the subscriber it is called with.
+*/
+
+void isub_fanout(unsigned addr, unsigned reason, Isub_Deliver deliver, void *ctx)
+{
+	const uint64_t *row;
+	uint64_t w;
+	unsigned i, s;
+
+	if(!isub_words)
+		return;
+	row = isub_bits + (addr & 0xFF) * isub_words;
+	for(i = 0; i < isub_words; i++){
+		for(w = row[i]; w; w &= w - 1){
+			s = i * 64 + (unsigned) __builtin_ctzll(w);
+			if(isub_slots[s].mask[addr & 0xFF] & (reason | ISUB_ANY_REASON))
+				(*deliver)(isub_slots[s].owner, ctx);
+		}
+	}
+}
@@ -0,0 +1,42 @@
+/*
+ * isub.h.  Interrupt report subscriptions.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#ifndef ISUB_H
+#define ISUB_H
+
+/* Reason mask matching every reason code, even 0 */
+
+#define ISUB_ANY_REASON		0x100
+
+/* Called with each subscriber to an interrupt report */
+
+typedef void (*Isub_Deliver)(void *owner, void *ctx);
+
+/* Prototypes */
+
+int isub_add(void *owner, unsigned lo, unsigned hi, unsigned mask);
+void isub_drop(void *owner);
+void isub_fanout(unsigned addr, unsigned reason, Isub_Deliver deliver, void *ctx);
+
+#endif
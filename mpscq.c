@@ -0,0 +1,98 @@
+/*
+ * mpscq.c.  Lock free multiple producer, single consumer queue.
+ *
+ * An intrusive linked list after Dmitry Vyukov's MPSC queue. A push is one
+ * atomic exchange and a store, whatever the number of producers, and never
+ * waits. A pop may return NULL for an instant while a push is half way
+ * done. The producer wakes the consumer after the push completes, so the
+ * consumer picks up the item on its next pass.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include <stddef.h>
+#include "mpscq.h"
+
+
+/*
+* Set up an empty queue
+*/
+
+void mpscq_init(Mpscq *q)
+{
+	q->stub.next = NULL;
+	q->head = &q->stub;
+	q->tail = &q->stub;
+}
+
+
+/*
+* Add an item. Safe to call from any number of threads at once.
+*/
+
+void mpscq_push(Mpscq *q, Mpscq_Node *n)
+{
+	Mpscq_Node *prev;
+
+	__atomic_store_n(&n->next, NULL, __ATOMIC_RELAXED);
+	prev = __atomic_exchange_n(&q->head, n, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+}
+
+
+/*
+* Take the oldest item off the queue, or return NULL if there isn't one
+* ready. Only one thread may pop from a queue.
+*/
+
+Mpscq_Node *mpscq_pop(Mpscq *q)
+{
+	Mpscq_Node *tail = q->tail;
+	Mpscq_Node *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+	/* Step over the stub */
+
+	if(tail == &q->stub){
+		if(!next)
+			return NULL;
+		q->tail = tail = next;
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	}
+	if(next){
+		q->tail = next;
+		return tail;
+	}
+
+	/* tail is the last item. If a push is under way, come back for it later. */
+
+	if(tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	/* Put the stub back behind the last item so it can be taken */
+
+	mpscq_push(q, &q->stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if(next){
+		q->tail = next;
+		return tail;
+	}
+	return NULL;
+}
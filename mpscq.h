@@ -0,0 +1,56 @@
+/*
+ * mpscq.h.  Lock free multiple producer, single consumer queue.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#ifndef MPSCQ_H
+#define MPSCQ_H
+
+/* Typedefs */
+
+typedef struct mpscq_node Mpscq_Node;
+typedef struct mpscq Mpscq;
+
+/* Link for a queued item. Embed it in whatever is being queued. */
+
+struct mpscq_node {
+	Mpscq_Node *next;
+};
+
+/*
+* Queue state. head is swapped by the producers, tail is only touched by
+* the consumer, so they are kept on separate cache lines.
+*/
+
+struct mpscq {
+	Mpscq_Node *head __attribute__((aligned(64)));
+	Mpscq_Node *tail __attribute__((aligned(64)));
+	Mpscq_Node stub;
+};
+
+/* Prototypes */
+
+void mpscq_init(Mpscq *q);
+void mpscq_push(Mpscq *q, Mpscq_Node *n);
+Mpscq_Node *mpscq_pop(Mpscq *q);
+
+#endif
@@ -0,0 +1,96 @@
+/*
+ * noderec.c.  Node registry.
+ *
+ * One fixed size record per node address holds everything the daemon keeps
+ * about the node: what it can do, its response times, error counts, health
+ * and when it was last heard from. The bus thread finds a node's record by
+ * indexing on its address, and each record sits on a cache line of its own.
+ *
+ * Only the bus thread changes the records, so it reads them directly. The
+ * network loop reads them for statistics. Each record carries a sequence
+ * count which is odd while a change is under way, and a reader copies the
+ * record again if the count moved while it was copying.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "tnd.h"
+#include "noderec.h"
+
+_Static_assert(sizeof(Node_Rec) == NODEREC_SIZE, "Node_Rec has outgrown its cache line");
+
+/* Locals */
+
+static Node_Rec noderecs[256];
+
+
+/*
+* Return a node's record, for the bus thread
+*/
+
+Node_Rec *noderec_get(unsigned addr)
+{
+	return &noderecs[addr & 0xFF];
+}
+
+
+/*
+* Start changing a record
+*/
+
+void noderec_begin(Node_Rec *nr)
+{
+	__atomic_store_n(&nr->seq, nr->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+/*
+* Finish changing a record
+*/
+
+void noderec_end(Node_Rec *nr)
+{
+	__atomic_store_n(&nr->seq, nr->seq + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+* Copy out a node's record. Safe from any thread.
+*/
+
+void noderec_read(unsigned addr, Node_Rec *copy)
+{
+	Node_Rec *nr = &noderecs[addr & 0xFF];
+	uint32_t seq;
+
+	for(;;){
+		seq = __atomic_load_n(&nr->seq, __ATOMIC_ACQUIRE);
+		if(seq & 1)
+			continue;
+		memcpy(copy, nr, sizeof(Node_Rec));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&nr->seq, __ATOMIC_RELAXED) == seq)
+			return;
+	}
+}
@@ -0,0 +1,81 @@
+/*
+ * noderec.h.  Node registry.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#ifndef NODEREC_H
+#define NODEREC_H
+
+#include <stdint.h>
+#include "rtt.h"
+
+/* Records are this size, and start on a cache line of their own */
+
+#define NODEREC_SIZE		64
+
+/* Attribute bits */
+
+#define NR_INTRX		0x01	// Node has sent an interrupt
+#define NR_CRC16		0x02	// Node uses CRC16 on the bus
+
+/* Flag bits */
+
+#define NR_KNOWN		0x01	// Something has been heard from it
+#define NR_IDENTIFIED		0x02	// type and fwlevel are from a NODEID response
+
+/* Typedefs */
+
+typedef struct node_rec Node_Rec;
+
+/*
+* Everything known about one node address. Only the bus thread changes a
+* record, between noderec_begin() and noderec_end(). Other threads take a
+* copy with noderec_read().
+*/
+
+struct node_rec {
+	uint32_t seq;			// Odd while the record is being changed
+	uint8_t attr;			// NR_INTRX, NR_CRC16
+	uint8_t flags;			// NR_KNOWN, NR_IDENTIFIED
+	uint8_t state;			// HAN_NODE_xxx
+	uint8_t misses;			// Timeouts in a row
+	uint16_t type;			// From NODEID
+	uint16_t fwlevel;
+	uint32_t lastseen;		// When it last answered, secs since the epoch
+	Rtt_Est rtt;			// Response times for the node as a whole
+	uint32_t downs;			// Times taken as down
+	uint32_t ups;			// Times it answered again afterwards
+	uint32_t refused;		// Commands failed while it was down
+	uint32_t crc_errs;		// Responses with a bad CRC
+	uint32_t naks;			// Commands it refused
+	uint32_t format_errs;		// Responses which made no sense
+	uint64_t probe_at;		// When to check on it next if it's down, msec
+} __attribute__((aligned(NODEREC_SIZE)));
+
+/* Prototypes */
+
+Node_Rec *noderec_get(unsigned addr);
+void noderec_begin(Node_Rec *nr);
+void noderec_end(Node_Rec *nr);
+void noderec_read(unsigned addr, Node_Rec *copy);
+
+#endif
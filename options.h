@@ -46,6 +46,12 @@
 #define DAEMON_SOCKET_FILE "hand.socket"// Unix domain socket name
 #define MAX_NODE_ADDR 0x1F		// Default maxmum node address
 #define CONF_MAX_RETRIES 3		// Maximum number of retries
+#define CONF_DOWN_AFTER 3		// Timeouts in a row before a node is taken as down
+#define CONF_PROBE_INTERVAL 10		// Seconds between checks on a down node
+
+// crc configs
+
+#define CRC_SLICE4 0			// Use the slice-by-4 routines for whole packet CRC's
 
 
 
@@ -54,11 +60,11 @@
 */
 
 
-#define	POLL_MAX_COUNT 20		// Maximum number of fd's to POLL
 #define MAX_CONFIG_STRING 128		// Maximum length of a config string
 #define MAX_NODE_PARAMS 16              // Maximum number of parameter bytes in a packet
 #define USER_READ_TIMEOUT 30000000      // Time to wait for socket reads
 #define USER_WRITE_TIMEOUT 30000000     // Time to wait for socket writes
+#define SESSION_MAX_BACKLOG 16		// Responses queued on a session before its reads are paused
 
 
 
@@ -0,0 +1,219 @@
+/*
+ * rtt.c.  Per node response time estimator.
+ *
+ * Every round trip measured on the bus updates three estimates: one for the
+ * node and command, one for the node, and one for the command whichever node
+ * it went to. A response timeout is taken from the most specific of these
+ * which has been measured, so a fast node isn't waited on for as long as a
+ * slow one, and a scan of empty addresses only waits as long as a NODEID
+ * command usually takes to answer.
+ *
+ * Only the bus thread uses the estimates. The node estimates live in the
+ * node registry, where the network loop can read them for statistics.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "tnd.h"
+#include "error.h"
+#include "rtt.h"
+#include "noderec.h"
+
+/* Local defines */
+
+#define RTT_ANY_NODE	256		// Node address for the per command estimates
+#define RTT_MAX_PROBE	8		// Slots looked at before giving up on a pair
+
+/* Typedefs */
+
+typedef struct rtt_slot Rtt_Slot;
+
+/* A node and command pair in the hash table */
+
+struct rtt_slot {
+	unsigned key;			// (addr << 8 | cmd) + 1, 0 when the slot is free
+	Rtt_Est est;
+};
+
+/* Locals */
+
+static unsigned rtt_floor = RTT_DEF_FLOOR;
+static unsigned rtt_ceiling = RTT_DEF_CEILING;
+static Rtt_Slot rtt_slots[RTT_CMD_SLOTS];
+
+
+/*
+* Set the limits on the timeouts handed out. Only to be called while the
+* bus thread isn't running.
+*/
+
+void rtt_limits(unsigned floor, unsigned ceiling)
+{
+	if(ceiling < floor)
+		ceiling = floor;
+	rtt_floor = floor;
+	rtt_ceiling = ceiling;
+	debug(DEBUG_STATUS, "Response timeouts between %u and %u usec", floor, ceiling);
+}
+
+
+/*
+* Find the estimate for a node and command pair. If create is TRUE, a free
+* slot is claimed for a pair which isn't in the table yet. Returns NULL if
+* there's no estimate, or no room for one.
+*/
+
+static Rtt_Est *rtt_slot(unsigned addr, unsigned cmd, int create)
+{
+	unsigned key = ((addr << 8) | cmd) + 1;
+	unsigned h = (key * 2654435761U) >> 22;
+	unsigned i;
+	Rtt_Slot *s;
+
+	for(i = 0; i < RTT_MAX_PROBE; i++){
+		s = &rtt_slots[(h + i) & (RTT_CMD_SLOTS - 1)];
+		if(s->key == key)
+			return &s->est;
+		if(!s->key){
+			if(!create)
+				return NULL;
+			s->key = key;
+			return &s->est;
+		}
+	}
+	return NULL;
+}
+
+
+/*
+* Fold a round trip time into an estimate
+*/
+
+static void rtt_update(Rtt_Est *e, unsigned usec)
+{
+	unsigned delta;
+
+	if(!e->samples){
+		e->srtt = usec;
+		e->rttvar = usec / 2;
+	}
+	else{
+		delta = (usec > e->srtt) ? usec - e->srtt : e->srtt - usec;
+		e->rttvar = e->rttvar - e->rttvar / 4 + delta / 4;
+		e->srtt = e->srtt - e->srtt / 8 + usec / 8;
+	}
+	e->samples++;
+}
+
+
+/*
+* Return the timeout an estimate gives, within the configured limits
+*/
+
+unsigned rtt_rto(const Rtt_Est *e)
+{
+	unsigned rto;
+
+	rto = e->srtt + 4 * e->rttvar;
+	if(rto < rtt_floor)
+		return rtt_floor;
+	if(rto > rtt_ceiling)
+		return rtt_ceiling;
+	return rto;
+}
+
+
+/*
+* Record the round trip time of a command which was answered first time.
+* Commands which had to be sent again aren't measured, as there's no telling
+* which transmission the response was to.
+*/
+
+void rtt_sample(unsigned addr, unsigned cmd, unsigned usec)
+{
+	Rtt_Est *e;
+	Node_Rec *nr;
+
+	addr &= 0xFF;
+	cmd &= 0xFF;
+
+	if((e = rtt_slot(addr, cmd, TRUE)))
+		rtt_update(e, usec);
+	if((e = rtt_slot(RTT_ANY_NODE, cmd, TRUE)))
+		rtt_update(e, usec);
+
+	nr = noderec_get(addr);
+	noderec_begin(nr);
+	rtt_update(&nr->rtt, usec);
+	noderec_end(nr);
+}
+
+
+/*
+* Count a response which didn't arrive in time
+*/
+
+void rtt_missed(unsigned addr)
+{
+	Node_Rec *nr = noderec_get(addr);
+
+	noderec_begin(nr);
+	nr->rtt.timeouts++;
+	noderec_end(nr);
+}
+
+
+/*
+* Return how long to wait for a response to cmd from addr, in microseconds.
+* dflt is used if nothing like it has been measured yet.
+*/
+
+unsigned rtt_timeout(unsigned addr, unsigned cmd, unsigned dflt)
+{
+	Rtt_Est *e;
+
+	addr &= 0xFF;
+	cmd &= 0xFF;
+
+	if((e = rtt_slot(addr, cmd, FALSE)) && e->samples)
+		return rtt_rto(e);
+	if((e = &noderec_get(addr)->rtt)->samples)
+		return rtt_rto(e);
+	if((e = rtt_slot(RTT_ANY_NODE, cmd, FALSE)) && e->samples)
+		return rtt_rto(e);
+	if(dflt < rtt_floor)
+		return rtt_floor;
+	if(dflt > rtt_ceiling)
+		return rtt_ceiling;
+	return dflt;
+}
+
+
+/*
+* Return the timeout to use for the next try after one has timed out
+*/
+
+unsigned rtt_backoff(unsigned timeout)
+{
+	return (timeout >= rtt_ceiling / 2) ? rtt_ceiling : timeout * 2;
+}
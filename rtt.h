@@ -0,0 +1,62 @@
+/*
+ * rtt.h.  Per node response time estimator.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#ifndef RTT_H
+#define RTT_H
+
+/* Node and command pairs with an estimate of their own. Must be a power of 2. */
+
+#define RTT_CMD_SLOTS		1024
+
+/* Default limits on the timeouts handed out, in microseconds */
+
+#define RTT_DEF_FLOOR		25000
+#define RTT_DEF_CEILING		250000
+
+/* Typedefs */
+
+typedef struct rtt_est Rtt_Est;
+
+/*
+* Round trip time estimate, kept the way TCP keeps its retransmission
+* timer (RFC 6298). Times are in microseconds.
+*/
+
+struct rtt_est {
+	unsigned srtt;			// Smoothed round trip time
+	unsigned rttvar;		// Smoothed mean deviation from srtt
+	unsigned samples;		// Round trips measured
+	unsigned timeouts;		// Responses which never came
+};
+
+/* Prototypes */
+
+void rtt_limits(unsigned floor, unsigned ceiling);
+void rtt_sample(unsigned addr, unsigned cmd, unsigned usec);
+void rtt_missed(unsigned addr);
+unsigned rtt_timeout(unsigned addr, unsigned cmd, unsigned dflt);
+unsigned rtt_backoff(unsigned timeout);
+unsigned rtt_rto(const Rtt_Est *e);
+
+#endif
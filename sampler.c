@@ -0,0 +1,327 @@
+/*
+ * sampler.c.  Periodic node sampler.
+ *
+ * Sends node commands listed in the [poll] section of the config file at
+ * regular intervals, and keeps the last so many responses to each in a
+ * ring, so clients which want a temperature or the sense lines every few
+ * seconds can read them from the daemon instead of each asking the node.
+ *
+ * Series with the same interval are started at evenly spaced times across
+ * it, so their samples don't all go out on the bus at once. A sample is
+ * only sent when the last one for the series has come back, and is queued
+ * as bulk work behind anything a client is waiting for.
+ *
+ * A series can also have a value from its responses stored on disk, in a
+ * ring file of its own in the store directory, for history going back
+ * further than the samples kept in memory.
+ *
+ * Only the network loop uses the sampler.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "tnd.h"
+#include "options.h"
+#include "error.h"
+#include "han.h"
+#include "evloop.h"
+#include "tsdb.h"
+#include "sampler.h"
+
+/* Typedefs */
+
+typedef struct sampler_sample Sampler_Sample;
+typedef struct sampler_series Sampler_Series;
+
+/* One sample as kept in a ring */
+
+struct sampler_sample {
+	uint64_t taken;				// msec
+	uint32_t seq;
+	int8_t status;				// HAN_CSTS_xxx
+	uint8_t values[MAX_NODE_PARAMS];
+};
+
+/* A series being sampled */
+
+struct sampler_series {
+	Sampler_Def def;
+	Ev_Timer timer;
+	uint64_t due;				// When the next sample is to go out, msec
+	uint32_t seq;				// Number of the last sample taken, 0 if none yet
+	uint8_t busy;				// A sample is on its way
+	Sampler_Sample *ring;			// history samples, seq n at (n - 1) % history
+	Tsdb *db;				// Where the values are stored, NULL if they aren't
+};
+
+/* Locals */
+
+static Sampler_Series sampler_series[SAMPLER_MAX_SERIES];
+static unsigned sampler_count = 0;
+static unsigned sampler_keep = SAMPLER_DEF_HISTORY;
+static Sampler_Sample *sampler_rings = NULL;
+static Sampler_Take sampler_take = NULL;
+static char sampler_dir[MAX_CONFIG_STRING] = "";
+static unsigned sampler_slot = TSDB_DEF_SLOT;
+static unsigned sampler_days = TSDB_DEF_DAYS;
+
+
+/*
+* A series is due a sample
+*/
+
+static void sampler_tick(Ev_Timer *t)
+{
+	Sampler_Series *ss = t->ctx;
+	Han_Packet pkt;
+	uint64_t now = evloop_now();
+
+	/* Don't let samples for a slow node pile up on the bus */
+
+	if(ss->busy)
+		debug(DEBUG_EXPECTED, "Skipping a sample of node %02X command %02X, the last is still out", ss->def.addr, ss->def.cmd);
+	else{
+		memset(&pkt, 0, sizeof(Han_Packet));
+		pkt.nodeaddress = ss->def.addr;
+		pkt.nodecommand = ss->def.cmd;
+		pkt.numnodeparams = ss->def.nparams;
+		memcpy(pkt.nodeparams, ss->def.params, ss->def.nparams);
+		if((*sampler_take)((unsigned)(ss - sampler_series), &pkt) == PASS)
+			ss->busy = TRUE;
+	}
+
+	/* Keep to the schedule, unless it has fallen a whole interval behind */
+
+	ss->due += ss->def.interval;
+	if(ss->due <= now)
+		ss->due = now + ss->def.interval;
+	evloop_timer_start(&ss->timer, (unsigned)(ss->due - now), sampler_tick, ss);
+}
+
+
+/*
+* Set where values are stored, and how: the seconds per stored value and
+* the days of them to keep. An empty dir stores nothing. Takes effect at
+* the next sampler_config().
+*/
+
+void sampler_store(const char *dir, unsigned slot, unsigned days)
+{
+	strncpy(sampler_dir, dir, MAX_CONFIG_STRING - 1);
+	sampler_dir[MAX_CONFIG_STRING - 1] = 0;
+	sampler_slot = slot;
+	sampler_days = days;
+}
+
+
+/*
+* Open the ring file for a series. It is named for what is sampled, so it
+* is picked up again whatever order the series are listed in.
+*/
+
+static Tsdb *sampler_open_store(const Sampler_Def *sd)
+{
+	char path[MAX_CONFIG_STRING + 64];
+	int n;
+	unsigned i;
+
+	n = snprintf(path, sizeof(path), "%s/%02X%02X-", sampler_dir, sd->addr, sd->cmd);
+	for(i = 0; i < sd->nparams; i++)
+		n += snprintf(path + n, sizeof(path) - n, "%02X", sd->params[i]);
+	snprintf(path + n, sizeof(path) - n, "-%u%c.ring", sd->offset, sd->type);
+	return tsdb_open(path, sd->type, sampler_slot, sampler_days);
+}
+
+
+/*
+* Start sampling count series from defs, keeping history samples of each.
+* take is called with the command for each sample, which is to be handed
+* back to sampler_record() once it has been carried out. Whatever was
+* being sampled before is forgotten. Returns FAIL if there isn't the memory
+* for the samples.
+*/
+
+int sampler_config(const Sampler_Def *defs, unsigned count, unsigned history, Sampler_Take take)
+{
+	Sampler_Series *ss;
+	uint64_t now = evloop_now();
+	unsigned i, j, n, m;
+
+	for(i = 0; i < sampler_count; i++){
+		evloop_timer_stop(&sampler_series[i].timer);
+		tsdb_close(sampler_series[i].db);
+	}
+	free(sampler_rings);
+	sampler_rings = NULL;
+	sampler_count = 0;
+
+	if(count > SAMPLER_MAX_SERIES)
+		count = SAMPLER_MAX_SERIES;
+	if(!count)
+		return PASS;
+	if(!history)
+		history = 1;
+	if(history > SAMPLER_MAX_HISTORY)
+		history = SAMPLER_MAX_HISTORY;
+
+	if((sampler_rings = calloc(count * history, sizeof(Sampler_Sample))) == NULL){
+		debug(DEBUG_UNEXPECTED, "Out of memory for %u samples", count * history);
+		return FAIL;
+	}
+	sampler_keep = history;
+	sampler_take = take;
+	sampler_count = count;
+
+	for(i = 0; i < count; i++){
+		ss = &sampler_series[i];
+		memset(ss, 0, sizeof(Sampler_Series));
+		ss->def = defs[i];
+		if(ss->def.interval < SAMPLER_MIN_INTERVAL)
+			ss->def.interval = SAMPLER_MIN_INTERVAL;
+		ss->ring = sampler_rings + i * history;
+		if(ss->def.type && sampler_dir[0])
+			ss->db = sampler_open_store(&ss->def);
+
+		/* Spread the series with this interval evenly across it */
+
+		for(j = 0, n = 0, m = 0; j < count; j++){
+			if(defs[j].interval == defs[i].interval){
+				if(j < i)
+					n++;
+				m++;
+			}
+		}
+		ss->due = now + (uint64_t) ss->def.interval * n / m;
+		evloop_timer_start(&ss->timer, (unsigned)(ss->due - now), sampler_tick, ss);
+		debug(DEBUG_STATUS, "Sampling node %02X command %02X every %u msec", ss->def.addr, ss->def.cmd, ss->def.interval);
+	}
+	return PASS;
+}
+
+
+/*
+* A sample has come back from the bus
+*/
+
+void sampler_record(unsigned series, const Client_Command *cc, uint64_t now)
+{
+	Sampler_Series *ss;
+	Sampler_Sample *sp;
+
+	if(series >= sampler_count)
+		return;
+	ss = &sampler_series[series];
+
+	/*
+	* The config may have been read again while the sample was out, and the
+	* series now be for something else, or have a sample of its own out
+	*/
+
+	if(!ss->busy || (ss->def.addr != cc->cmd.pkt.nodeaddress) || (ss->def.cmd != cc->cmd.pkt.nodecommand) ||
+		(ss->def.nparams != cc->cmd.pkt.numnodeparams) || memcmp(ss->def.params, cc->cmd.pkt.nodeparams, ss->def.nparams))
+		return;
+	ss->busy = FALSE;
+	ss->seq++;
+	sp = &ss->ring[(ss->seq - 1) % sampler_keep];
+	sp->taken = now;
+	sp->seq = ss->seq;
+	sp->status = (int8_t) cc->commstatus;
+	memcpy(sp->values, cc->cmd.pkt.nodestatus, ss->def.nparams);
+
+	if(ss->db && (cc->commstatus == HAN_CSTS_OK) &&
+		(ss->def.offset + ((ss->def.type == TSDB_BYTE) ? 1 : 2) <= ss->def.nparams))
+		tsdb_put(ss->db, (uint32_t) time(NULL), cc->cmd.pkt.nodestatus + ss->def.offset);
+}
+
+
+/*
+* Fill in the samples asked for by a samples request. Returns FAIL if
+* there is no such series.
+*/
+
+int sampler_get(Han_Samples *hs, uint64_t now)
+{
+	Sampler_Series *ss;
+	Sampler_Sample *sp;
+	struct sample *out;
+	uint32_t seq, oldest;
+
+	hs->numseries = (unsigned char) sampler_count;
+	hs->numsamples = 0;
+	hs->more = FALSE;
+	if(hs->series >= sampler_count)
+		return FAIL;
+
+	ss = &sampler_series[hs->series];
+	hs->addr = ss->def.addr;
+	hs->cmd = ss->def.cmd;
+	hs->numparams = ss->def.nparams;
+	memcpy(hs->params, ss->def.params, ss->def.nparams);
+	hs->interval = ss->def.interval;
+	hs->last = ss->seq;
+
+	/* Older samples than the ring holds are gone */
+
+	oldest = (ss->seq > sampler_keep) ? ss->seq - sampler_keep + 1 : 1;
+	seq = (hs->since > oldest) ? hs->since : oldest;
+	for(; seq <= ss->seq; seq++){
+		if(hs->numsamples == HAN_SAMPLES_MAX){
+			hs->more = TRUE;
+			break;
+		}
+		sp = &ss->ring[(seq - 1) % sampler_keep];
+		out = &hs->samples[hs->numsamples++];
+		out->seq = sp->seq;
+		out->age = (unsigned)(now - sp->taken);
+		out->status = sp->status;
+		memcpy(out->values, sp->values, ss->def.nparams);
+	}
+	return PASS;
+}
+
+
+/*
+* Fill in the points asked for by a history request. Returns FAIL if there
+* is no such series, or it isn't stored.
+*/
+
+int sampler_history(Han_History *hh)
+{
+	Sampler_Series *ss;
+	uint32_t from = hh->from;
+	int more;
+
+	hh->numpoints = 0;
+	hh->more = FALSE;
+	if((hh->series >= sampler_count) || !(ss = &sampler_series[hh->series])->db)
+		return FAIL;
+
+	hh->slot = tsdb_slot(ss->db);
+	hh->numpoints = (unsigned char) tsdb_query(ss->db, &from, hh->to, &hh->step, hh->points, HAN_HISTORY_MAX, &more);
+	hh->from = from;
+	hh->more = (unsigned char) more;
+	return PASS;
+}
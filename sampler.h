@@ -0,0 +1,74 @@
+/*
+ * sampler.h.  Periodic node sampler.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdint.h>
+
+/* Most series which can be sampled */
+
+#define SAMPLER_MAX_SERIES	32
+
+/* Samples kept for each series by default, and at most */
+
+#define SAMPLER_DEF_HISTORY	256
+#define SAMPLER_MAX_HISTORY	65536
+
+/* Shortest interval between samples, msec */
+
+#define SAMPLER_MIN_INTERVAL	100
+
+/* Typedefs */
+
+typedef struct sampler_def Sampler_Def;
+
+/*
+* Called to send the command for a sample out on the bus. Returns FAIL if
+* it couldn't be sent, in which case the sample is skipped.
+*/
+
+typedef int (*Sampler_Take)(unsigned series, const Han_Packet *pkt);
+
+/* A series to sample, from the config file */
+
+struct sampler_def {
+	unsigned interval;			// msec between samples
+	uint8_t addr;
+	uint8_t cmd;
+	uint8_t nparams;
+	uint8_t params[MAX_NODE_PARAMS];
+	uint8_t type;				// TSDB_xxx to store a value from the response, 0 not to
+	uint8_t offset;				// Where the value is in the response
+};
+
+/* Prototypes */
+
+void sampler_store(const char *dir, unsigned slot, unsigned days);
+int sampler_config(const Sampler_Def *defs, unsigned count, unsigned history, Sampler_Take take);
+void sampler_record(unsigned series, const Client_Command *cc, uint64_t now);
+int sampler_get(Han_Samples *hs, uint64_t now);
+int sampler_history(Han_History *hh);
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * sched.c.  Bus transaction scheduler.
+ *
+ * Transactions waiting for the bus are queued by priority, and the bus
+ * thread takes the oldest of the highest priority each time the bus is
+ * free. Interrupt acknowledgements aren't queued here, the bus thread sees
+ * to them between transactions before anything else, but they are counted
+ * with the rest. So that a steady stream of higher priority work can't hold
+ * up the rest forever, a transaction which has waited longer than the
+ * configured limit goes ahead of everything.
+ *
+ * Only the bus thread queues and takes transactions. The statistics are
+ * read by the network loop, so they are accessed atomically.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "tnd.h"
+#include "options.h"
+#include "han.h"
+#include "sched.h"
+
+/* Locals */
+
+static unsigned sched_max_wait = SCHED_DEF_MAX_WAIT;
+static Sched_Item *sched_head[HAN_PRIO_CLASSES];
+static Sched_Item *sched_tail[HAN_PRIO_CLASSES];
+static struct queue_stats sched_stats[HAN_PRIO_CLASSES];
+
+
+/*
+* Set how many msec a transaction may wait before it goes ahead of
+* everything else, 0 for no limit. Only to be called while the bus thread
+* isn't running.
+*/
+
+void sched_config(unsigned max_wait)
+{
+	sched_max_wait = max_wait;
+}
+
+
+/*
+* Queue a transaction
+*/
+
+void sched_add(Sched_Item *it, unsigned prio, uint64_t now)
+{
+	struct queue_stats *st;
+	unsigned depth;
+
+	if(prio >= HAN_PRIO_CLASSES)
+		prio = HAN_PRIO_BULK;
+	it->next = NULL;
+	it->queued = now;
+	it->prio = prio;
+	if(sched_tail[prio])
+		sched_tail[prio]->next = it;
+	else
+		sched_head[prio] = it;
+	sched_tail[prio] = it;
+
+	st = &sched_stats[prio];
+	depth = __atomic_add_fetch(&st->depth, 1, __ATOMIC_RELAXED);
+	if(depth > st->maxdepth)
+		__atomic_store_n(&st->maxdepth, depth, __ATOMIC_RELAXED);
+}
+
+
+/*
+* Take the first transaction off a queue
+*/
+
+static Sched_Item *sched_remove(unsigned prio, uint64_t now, int promoted)
+{
+	Sched_Item *it = sched_head[prio];
+
+	if(!(sched_head[prio] = it->next))
+		sched_tail[prio] = NULL;
+	it->next = NULL;
+	__atomic_fetch_sub(&sched_stats[prio].depth, 1, __ATOMIC_RELAXED);
+	sched_served(prio, (unsigned)(now - it->queued), promoted);
+	return it;
+}
+
+
+/*
+* Take the transaction which has waited longest, if it has waited too long.
+* Returns NULL if none has.
+*/
+
+Sched_Item *sched_overdue(uint64_t now)
+{
+	unsigned i, oldest = HAN_PRIO_CLASSES;
+
+	if(!sched_max_wait)
+		return NULL;
+	for(i = 0; i < HAN_PRIO_CLASSES; i++){
+		if(sched_head[i] && ((oldest == HAN_PRIO_CLASSES) || (sched_head[i]->queued < sched_head[oldest]->queued)))
+			oldest = i;
+	}
+	if((oldest == HAN_PRIO_CLASSES) || (now - sched_head[oldest]->queued <= sched_max_wait))
+		return NULL;
+
+	/* It only counts as promoted if something of higher priority was waiting */
+
+	for(i = 0; (i < oldest) && !sched_head[i]; i++);
+	return sched_remove(oldest, now, i < oldest);
+}
+
+
+/*
+* Take the next transaction in priority order. Returns NULL if there are
+* none waiting.
+*/
+
+Sched_Item *sched_take(uint64_t now)
+{
+	unsigned i;
+
+	for(i = 0; i < HAN_PRIO_CLASSES; i++){
+		if(sched_head[i])
+			return sched_remove(i, now, FALSE);
+	}
+	return NULL;
+}
+
+
+/*
+* Count a transaction which has had its turn on the bus, after waiting
+* waited msec
+*/
+
+void sched_served(unsigned prio, unsigned waited, int promoted)
+{
+	struct queue_stats *st = &sched_stats[prio];
+
+	__atomic_fetch_add(&st->served, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&st->waittotal, waited, __ATOMIC_RELAXED);
+	if(promoted)
+		__atomic_fetch_add(&st->promoted, 1, __ATOMIC_RELAXED);
+	if(waited > st->waitmax)
+		__atomic_store_n(&st->waitmax, waited, __ATOMIC_RELAXED);
+}
+
+
+/*
+* Count a transaction which shared another's turn on the bus instead of
+* waiting for its own
+*/
+
+void sched_coalesced(unsigned prio)
+{
+	__atomic_fetch_add(&sched_stats[prio].coalesced, 1, __ATOMIC_RELAXED);
+}
+
+
+/*
+* Copy out the queue statistics. Safe from any thread.
+*/
+
+void sched_get(Han_Queuestats *qs)
+{
+	unsigned *src = (unsigned *) sched_stats;
+	unsigned *dst = (unsigned *) qs->queue;
+	unsigned i;
+
+	for(i = 0; i < sizeof(sched_stats) / (sizeof(unsigned)); i++)
+		dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
@@ -0,0 +1,56 @@
+/*
+ * sched.h.  Bus transaction scheduler.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+/* Default msec a request may wait before it goes ahead of everything else */
+
+#define SCHED_DEF_MAX_WAIT	1000
+
+/* Typedefs */
+
+typedef struct sched_item Sched_Item;
+
+/* Link for a waiting transaction. Embed it in whatever is being scheduled. */
+
+struct sched_item {
+	Sched_Item *next;
+	uint64_t queued;		// When it was queued, msec
+	unsigned prio;			// HAN_PRIO_xxx
+};
+
+/* Prototypes */
+
+void sched_config(unsigned max_wait);
+void sched_add(Sched_Item *it, unsigned prio, uint64_t now);
+Sched_Item *sched_overdue(uint64_t now);
+Sched_Item *sched_take(uint64_t now);
+void sched_served(unsigned prio, unsigned waited, int promoted);
+void sched_coalesced(unsigned prio);
+void sched_get(Han_Queuestats *qs);
+
+#endif
@@ -0,0 +1,211 @@
+/*
+ * textq.c.  Text socket output queues.
+ *
+ * Each text socket has a ring of lines waiting to be written to it, which
+ * is written out as the socket will take it, so a client which is slow to
+ * read only holds up itself. An event for every text socket is formatted
+ * once, and the one copy is put on each of their queues, freed when the
+ * last of them has written it. The lines waiting are written with one
+ * writev() call for as many as there are.
+ *
+ * Only the network loop uses the queues.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "tnd.h"
+#include "options.h"
+#include "error.h"
+#include "textq.h"
+
+/* Local defines */
+
+#define TEXTQ_IOV		64	// Most lines written with one call
+
+
+/*
+* Make a line from a printf style format. Returns NULL if there isn't the
+* memory for it. The caller holds the one reference to it.
+*/
+
+Textq_Msg *textq_vmsg(int droppable, const char *fmt, va_list ap)
+{
+	Textq_Msg *m;
+	va_list aq;
+	int len;
+
+	va_copy(aq, ap);
+	len = vsnprintf(NULL, 0, fmt, aq);
+	va_end(aq);
+	if((len < 0) || ((m = malloc(sizeof(Textq_Msg) + len + 1)) == NULL)){
+		debug(DEBUG_UNEXPECTED, "Out of memory for a text socket line");
+		return NULL;
+	}
+	vsnprintf(m->data, len + 1, fmt, ap);
+	m->refs = 1;
+	m->len = len;
+	m->droppable = droppable ? TRUE : FALSE;
+	return m;
+}
+
+
+Textq_Msg *textq_msg(int droppable, const char *fmt, ...)
+{
+	Textq_Msg *m;
+	va_list ap;
+
+	va_start(ap, fmt);
+	m = textq_vmsg(droppable, fmt, ap);
+	va_end(ap);
+	return m;
+}
+
+
+/*
+* Let go of a reference to a line, freeing it if it was the last
+*/
+
+void textq_release(Textq_Msg *m)
+{
+	if(m && !--m->refs)
+		free(m);
+}
+
+
+/*
+* Set up an empty queue with room for size lines. Returns FAIL if there
+* isn't the memory.
+*/
+
+int textq_init(Textq *q, unsigned size)
+{
+	memset(q, 0, sizeof(Textq));
+	if((q->ring = calloc(size, sizeof(Textq_Msg *))) == NULL){
+		debug(DEBUG_UNEXPECTED, "Out of memory for a text socket queue");
+		return FAIL;
+	}
+	q->size = size;
+	return PASS;
+}
+
+
+/*
+* Throw away what is waiting, and free the queue
+*/
+
+void textq_free(Textq *q)
+{
+	for(; q->count; q->count--, q->head = (q->head + 1) % q->size)
+		textq_release(q->ring[q->head]);
+	free(q->ring);
+	q->ring = NULL;
+}
+
+
+/*
+* Put a line at the end of a queue. The queue takes a reference of its own.
+* Returns FAIL if it is full.
+*/
+
+int textq_push(Textq *q, Textq_Msg *m)
+{
+	if(q->count == q->size)
+		return FAIL;
+	q->ring[(q->head + q->count++) % q->size] = m;
+	m->refs++;
+	return PASS;
+}
+
+
+/*
+* Drop the oldest event on a queue which hasn't started to be written, to
+* make room for a newer one. Returns FAIL if there isn't one to drop.
+*/
+
+int textq_drop_oldest(Textq *q)
+{
+	unsigned i, j;
+
+	for(i = q->done ? 1 : 0; i < q->count; i++){
+		if(q->ring[(q->head + i) % q->size]->droppable)
+			break;
+	}
+	if(i == q->count)
+		return FAIL;
+
+	textq_release(q->ring[(q->head + i) % q->size]);
+	for(j = i; j > 0; j--)
+		q->ring[(q->head + j) % q->size] = q->ring[(q->head + j - 1) % q->size];
+	q->head = (q->head + 1) % q->size;
+	q->count--;
+	return PASS;
+}
+
+
+/*
+* Write out as much of the queue as the socket will take. Returns FAIL if
+* the socket should be closed.
+*/
+
+int textq_flush(Textq *q, int fd)
+{
+	struct iovec iov[TEXTQ_IOV];
+	Textq_Msg *m;
+	ssize_t n;
+	unsigned i;
+
+	while(q->count){
+		for(i = 0; (i < q->count) && (i < TEXTQ_IOV); i++){
+			m = q->ring[(q->head + i) % q->size];
+			iov[i].iov_base = m->data + (i ? 0 : q->done);
+			iov[i].iov_len = m->len - (i ? 0 : q->done);
+		}
+		n = writev(fd, iov, i);
+		if(n < 0){
+			if(errno == EINTR)
+				continue;
+			if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return PASS;
+			debug(DEBUG_UNEXPECTED, "Text socket write error: %s", strerror(errno));
+			return FAIL;
+		}
+
+		/* Let go of the lines written in full */
+
+		n += q->done;
+		while(q->count && (n >= (ssize_t) q->ring[q->head]->len)){
+			n -= q->ring[q->head]->len;
+			textq_release(q->ring[q->head]);
+			q->head = (q->head + 1) % q->size;
+			q->count--;
+		}
+		q->done = (unsigned) n;
+	}
+	return PASS;
+}
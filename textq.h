@@ -0,0 +1,75 @@
+/*
+ * textq.h.  Text socket output queues.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#ifndef TEXTQ_H
+#define TEXTQ_H
+
+#include <stdint.h>
+#include <stdarg.h>
+
+/* Lines queued for a text socket by default, and at most */
+
+#define TEXTQ_DEF_LEN		64
+#define TEXTQ_MAX_LEN		4096
+
+/* Room kept beyond the limit for replies, which are never dropped */
+
+#define TEXTQ_REPLY_ROOM	2
+
+/* Typedefs */
+
+typedef struct textq_msg Textq_Msg;
+typedef struct textq Textq;
+
+/* A line of output, shared by every queue it is on */
+
+struct textq_msg {
+	unsigned refs;
+	unsigned len;
+	uint8_t droppable;			// An event which may be dropped for a slow reader
+	char data[];
+};
+
+/* Lines waiting to be written to one socket */
+
+struct textq {
+	Textq_Msg **ring;
+	unsigned size;				// Entries in ring
+	unsigned head;				// Oldest line
+	unsigned count;				// Lines waiting
+	unsigned done;				// Bytes of the oldest line written
+};
+
+/* Prototypes */
+
+Textq_Msg *textq_msg(int droppable, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+Textq_Msg *textq_vmsg(int droppable, const char *fmt, va_list ap);
+void textq_release(Textq_Msg *m);
+int textq_init(Textq *q, unsigned size);
+void textq_free(Textq *q);
+int textq_push(Textq *q, Textq_Msg *m);
+int textq_drop_oldest(Textq *q);
+int textq_flush(Textq *q, int fd);
+
+#endif
@@ -0,0 +1,292 @@
+/*
+ * tsdb.c.  On disk rings of sampled values.
+ *
+ * Each stored series has a file of its own holding a header and a ring of
+ * fixed size records, one for each slot seconds of wall clock time, going
+ * back days days. A record is one 16 bit value, and its time is given by
+ * where it is in the ring, so a year of one minute records takes about a
+ * megabyte. A slot with more than one sample keeps the last, and a slot
+ * with none holds a value which stands for no sample.
+ *
+ * The file is mapped into memory. Values are written into the mapping as
+ * they are sampled, and queries are answered from it, so neither makes a
+ * system call. The header records the newest slot written, so the ring
+ * carries on where it left off after a restart.
+ *
+ * Only the network loop uses the rings.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tnd.h"
+#include "options.h"
+#include "error.h"
+#include "han.h"
+#include "tsdb.h"
+
+/* Local defines */
+
+#define TSDB_MAGIC		"HANRING1"
+#define TSDB_HDR_LEN		64
+
+/* Typedefs */
+
+typedef struct tsdb_header Tsdb_Header;
+
+/* Start of a ring file. Slot numbers count slot seconds from the epoch. */
+
+struct tsdb_header {
+	char magic[8];
+	uint32_t slot;				// Seconds per record
+	uint32_t slots;				// Records in the ring
+	uint32_t type;				// TSDB_xxx
+	uint32_t reserved;
+	uint64_t first;				// Slot of the first record ever written
+	uint64_t head;				// Slot of the newest record, 0 if none
+};
+
+_Static_assert(sizeof(Tsdb_Header) <= TSDB_HDR_LEN, "Tsdb_Header is too big");
+
+/* An open ring */
+
+struct tsdb {
+	void *map;
+	size_t len;
+	Tsdb_Header *hdr;
+	uint16_t *recs;
+	uint16_t none;				// Record value for no sample
+};
+
+
+/*
+* Open the ring file at path, making it if it doesn't exist. If it was made
+* with a different type or size, it is started again. Returns NULL if it
+* can't be opened.
+*/
+
+Tsdb *tsdb_open(const char *path, unsigned type, unsigned slot, unsigned days)
+{
+	Tsdb *db;
+	Tsdb_Header *hdr;
+	struct stat st;
+	unsigned slots;
+	size_t len;
+	int fd, fresh;
+
+	if(!slot)
+		slot = TSDB_DEF_SLOT;
+	if(!days)
+		days = TSDB_DEF_DAYS;
+	slots = (unsigned)(((uint64_t) days * 86400 + slot - 1) / slot);
+	len = TSDB_HDR_LEN + (size_t) slots * sizeof(uint16_t);
+
+	if((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1){
+		debug(DEBUG_UNEXPECTED, "Could not open ring file %s: %s", path, strerror(errno));
+		return NULL;
+	}
+	if(fstat(fd, &st) || ((st.st_size != len) && ftruncate(fd, len))){
+		debug(DEBUG_UNEXPECTED, "Could not size ring file %s: %s", path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	fresh = (st.st_size != len);
+
+	if((db = calloc(1, sizeof(Tsdb))) == NULL){
+		close(fd);
+		return NULL;
+	}
+	db->map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(db->map == MAP_FAILED){
+		debug(DEBUG_UNEXPECTED, "Could not map ring file %s: %s", path, strerror(errno));
+		free(db);
+		return NULL;
+	}
+	db->len = len;
+	db->hdr = hdr = db->map;
+	db->recs = (uint16_t *)((uint8_t *) db->map + TSDB_HDR_LEN);
+	db->none = (type == TSDB_INT) ? 0x8000 : 0xFFFF;
+
+	if(!fresh && (memcmp(hdr->magic, TSDB_MAGIC, 8) || (hdr->slot != slot) || (hdr->slots != slots) || (hdr->type != type))){
+		debug(DEBUG_UNEXPECTED, "Ring file %s was made for something else, starting it again", path);
+		fresh = TRUE;
+	}
+	if(fresh){
+		memset(hdr, 0, TSDB_HDR_LEN);
+		memcpy(hdr->magic, TSDB_MAGIC, 8);
+		hdr->slot = slot;
+		hdr->slots = slots;
+		hdr->type = type;
+	}
+	debug(DEBUG_STATUS, "Opened ring file %s, %u records of %u secs", path, slots, slot);
+	return db;
+}
+
+
+/*
+* Close a ring. What has been written stays in the file.
+*/
+
+void tsdb_close(Tsdb *db)
+{
+	if(!db)
+		return;
+	munmap(db->map, db->len);
+	free(db);
+}
+
+
+/*
+* Return the seconds per record
+*/
+
+unsigned tsdb_slot(const Tsdb *db)
+{
+	return db->hdr->slot;
+}
+
+
+/*
+* Put a sample taken at when, in secs since the epoch, into the ring. field
+* points to the value in the node's response.
+*/
+
+void tsdb_put(Tsdb *db, uint32_t when, const uint8_t *field)
+{
+	Tsdb_Header *hdr = db->hdr;
+	uint64_t at = when / hdr->slot, s;
+	uint16_t v;
+
+	switch(hdr->type){
+		case TSDB_BYTE:
+			v = field[0];
+			break;
+
+		default:
+			v = (uint16_t)(field[0] | (field[1] << 8));
+			break;
+	}
+
+	/* A value which happens to be the one meaning no sample is moved next to it */
+
+	if(v == db->none)
+		v = (hdr->type == TSDB_INT) ? 0x8001 : 0xFFFE;
+
+	if(!hdr->head)
+		hdr->first = at;
+	else if(at + hdr->slots <= hdr->head || at < hdr->first)
+		return;			// Clock went back further than the ring reaches
+	else if(at > hdr->head){
+
+		/* Mark the slots nothing was sampled in */
+
+		s = (at - hdr->head > hdr->slots) ? at - hdr->slots : hdr->head;
+		for(s++; s < at; s++)
+			db->recs[s % hdr->slots] = db->none;
+	}
+	db->recs[at % hdr->slots] = v;
+	if(at > hdr->head)
+		hdr->head = at;
+}
+
+
+/*
+* Summarize the records from from to to, in secs since the epoch, step
+* seconds to a point, into at most max points. step is rounded up to a
+* whole number of records, so 0 gives a point for each. Points are lined up
+* on multiples of step, and those with no samples are left out. Returns the
+* number of points filled in. If there were more than max, more is set TRUE
+* and from to where to carry on.
+*/
+
+unsigned tsdb_query(const Tsdb *db, uint32_t *from, uint32_t to, unsigned *stepp,
+	struct history_point *points, unsigned max, int *more)
+{
+	const Tsdb_Header *hdr = db->hdr;
+	uint64_t lo, hi, s, end, b;
+	struct history_point *pt;
+	int64_t sum;
+	int v;
+	unsigned step, n = 0;
+
+	if(*stepp < hdr->slot)
+		*stepp = hdr->slot;
+	step = *stepp = (*stepp + hdr->slot - 1) / hdr->slot * hdr->slot;
+
+	/* Only the records the ring still holds */
+
+	*more = FALSE;
+	if(!hdr->head)
+		return 0;
+	hi = hdr->head;
+	lo = (hi >= hdr->slots) ? hi - hdr->slots + 1 : 0;
+	if(lo < hdr->first)
+		lo = hdr->first;
+	if((uint64_t) to / hdr->slot < hi)
+		hi = (uint64_t) to / hdr->slot;
+
+	b = (uint64_t) *from / step * step;
+	if(b / hdr->slot < lo)
+		b = lo * hdr->slot / step * step;
+
+	for(; (b <= to) && (b / hdr->slot <= hi); b += step){
+		if(n == max){
+			*from = (uint32_t) b;
+			*more = TRUE;
+			return n;
+		}
+		s = b / hdr->slot;
+		if(s < lo)
+			s = lo;
+		end = (b + step) / hdr->slot;
+		if(end > hi + 1)
+			end = hi + 1;
+
+		pt = &points[n];
+		memset(pt, 0, sizeof(struct history_point));
+		for(sum = 0; s < end; s++){
+			if(db->recs[s % hdr->slots] == db->none)
+				continue;
+			v = (hdr->type == TSDB_INT) ? (int16_t) db->recs[s % hdr->slots] : db->recs[s % hdr->slots];
+			if(!pt->count || (v < pt->min))
+				pt->min = v;
+			if(!pt->count || (v > pt->max))
+				pt->max = v;
+			sum += v;
+			pt->count++;
+		}
+		if(pt->count){
+			pt->time = (unsigned) b;
+			pt->avg = (int)((sum >= 0) ? (sum + pt->count / 2) / pt->count : (sum - (int64_t)(pt->count / 2)) / pt->count);
+			n++;
+		}
+	}
+	return n;
+}
@@ -0,0 +1,54 @@
+/*
+ * tsdb.h.  On disk rings of sampled values.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#ifndef TSDB_H
+#define TSDB_H
+
+#include <stdint.h>
+
+/* Default seconds per record, and days of records kept */
+
+#define TSDB_DEF_SLOT		60
+#define TSDB_DEF_DAYS		366
+
+/* Value types, as in the han.php format strings */
+
+#define TSDB_BYTE		'B'	// 8 bit unsigned
+#define TSDB_INT		'I'	// 16 bit signed, low byte first
+#define TSDB_UNS		'U'	// 16 bit unsigned, low byte first
+
+/* Typedefs */
+
+typedef struct tsdb Tsdb;
+
+/* Prototypes */
+
+Tsdb *tsdb_open(const char *path, unsigned type, unsigned slot, unsigned days);
+void tsdb_close(Tsdb *db);
+void tsdb_put(Tsdb *db, uint32_t when, const uint8_t *field);
+unsigned tsdb_slot(const Tsdb *db);
+unsigned tsdb_query(const Tsdb *db, uint32_t *from, uint32_t to, unsigned *step,
+	struct history_point *points, unsigned max, int *more);
+
+#endif
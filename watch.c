@@ -0,0 +1,428 @@
+/*
+ * watch.c.  Value change watches.
+ *
+ * A client can ask to be told when a node's response to a command changes,
+ * rather than sending the command over and over itself. The daemon sends
+ * the command at the interval asked for, compares each response with the
+ * last one reported to the client, and only sends it on if it differs, or
+ * if the value watched has moved by more than the deadband.
+ *
+ * Watches of the same node command share a target, which is sent on the
+ * bus at the shortest interval any of them asked for, so ten clients
+ * watching a temperature cost the bus no more than one. Every target is on
+ * one timeline, a heap ordered by when each is next due, driven by a single
+ * timer. Commands go out as bulk work behind anything a client is waiting
+ * for, and a target isn't sent again until its last command has come back.
+ *
+ * Only the network loop uses the watches.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "tnd.h"
+#include "options.h"
+#include "error.h"
+#include "han.h"
+#include "evloop.h"
+#include "watch.h"
+
+/* Typedefs */
+
+typedef struct watch Watch;
+typedef struct watch_target Watch_Target;
+
+/* A node command sent for one or more watches */
+
+struct watch_target {
+	Han_Packet pkt;				// Node command
+	uint8_t used;				// FALSE if the entry is free
+	uint8_t busy;				// The command is on its way
+	unsigned interval;			// Shortest interval of its watches, msec
+	uint64_t due;				// When the command is next to go out, msec
+	int index;				// Position in the heap
+	Watch *watches;				// Watches sharing it
+};
+
+/* A client's watch */
+
+struct watch {
+	Han_Watch_Entry def;
+	void *owner;				// NULL if the entry is free
+	uint32_t tag;
+	Watch_Target *target;
+	Watch *next;				// Next watch of the target
+	uint8_t known;				// Something has been reported
+	int status;				// Last reported
+	int value;
+	uint8_t values[MAX_NODE_PARAMS];
+};
+
+/* Locals */
+
+static Watch watch_table[WATCH_MAX];		// id n at n - 1
+static Watch_Target watch_targets[WATCH_MAX];
+static Watch_Target *watch_heap[WATCH_MAX];	// Targets, soonest due first
+static unsigned watch_heap_len = 0;
+static Ev_Timer watch_timer;
+static Watch_Poll watch_poll = NULL;
+static Watch_Notify watch_notify = NULL;
+
+/* Local prototypes */
+
+static void watch_tick(Ev_Timer *timer);
+
+
+/*
+* Set the functions which send commands and pass on changes
+*/
+
+void watch_init(Watch_Poll poll, Watch_Notify notify)
+{
+	watch_poll = poll;
+	watch_notify = notify;
+}
+
+
+/*
+* Put a target at position i in the heap
+*/
+
+static void watch_place(Watch_Target *t, unsigned i)
+{
+	watch_heap[i] = t;
+	t->index = i;
+}
+
+
+/*
+* Move the target at position i up or down the heap to where it belongs
+*/
+
+static void watch_sift(unsigned i)
+{
+	Watch_Target *t = watch_heap[i];
+	unsigned c;
+
+	while(i && (watch_heap[(i - 1) / 2]->due > t->due)){
+		watch_place(watch_heap[(i - 1) / 2], i);
+		i = (i - 1) / 2;
+	}
+	for(;;){
+		c = 2 * i + 1;
+		if(c >= watch_heap_len)
+			break;
+		if((c + 1 < watch_heap_len) && (watch_heap[c + 1]->due < watch_heap[c]->due))
+			c++;
+		if(watch_heap[c]->due >= t->due)
+			break;
+		watch_place(watch_heap[c], i);
+		i = c;
+	}
+	watch_place(t, i);
+}
+
+
+/*
+* Set the timer for the target due first, or stop it if there are none
+*/
+
+static void watch_rearm(void)
+{
+	uint64_t now = evloop_now();
+
+	if(!watch_heap_len)
+		evloop_timer_stop(&watch_timer);
+	else
+		evloop_timer_start(&watch_timer, (watch_heap[0]->due > now) ? (unsigned)(watch_heap[0]->due - now) : 0, watch_tick, NULL);
+}
+
+
+/*
+* Send the commands of the targets which are due
+*/
+
+static void watch_tick(Ev_Timer *timer)
+{
+	Watch_Target *t;
+	uint64_t now = evloop_now();
+
+	while(watch_heap_len && ((t = watch_heap[0])->due <= now)){
+
+		/* Don't let commands for a slow node pile up on the bus */
+
+		if(!t->busy && ((*watch_poll)((unsigned)(t - watch_targets), &t->pkt) == PASS))
+			t->busy = TRUE;
+
+		/* Keep to the schedule, unless it has fallen a whole interval behind */
+
+		t->due += t->interval;
+		if(t->due <= now)
+			t->due = now + t->interval;
+		watch_sift(0);
+	}
+	watch_rearm();
+}
+
+
+/*
+* Return the target for a node command, making it if there isn't one.
+* Returns NULL if there is no room for another.
+*/
+
+static Watch_Target *watch_target(const Han_Watch_Entry *we)
+{
+	Watch_Target *t, *free_t = NULL;
+	unsigned i;
+
+	for(i = 0; i < WATCH_MAX; i++){
+		t = &watch_targets[i];
+		if(!t->used){
+			if(!free_t)
+				free_t = t;
+			continue;
+		}
+		if((t->pkt.nodeaddress == we->addr) && (t->pkt.nodecommand == we->cmd) &&
+			(t->pkt.numnodeparams == we->numparams) && !memcmp(t->pkt.nodeparams, we->params, we->numparams))
+			return t;
+	}
+	if((t = free_t) == NULL)
+		return NULL;
+
+	memset(t, 0, sizeof(Watch_Target));
+	t->used = TRUE;
+	t->pkt.nodeaddress = we->addr;
+	t->pkt.nodecommand = we->cmd;
+	t->pkt.numnodeparams = we->numparams;
+	memcpy(t->pkt.nodeparams, we->params, we->numparams);
+	t->interval = we->interval;
+	watch_heap_len++;
+	watch_place(t, watch_heap_len - 1);
+	debug(DEBUG_STATUS, "Watching node %02X command %02X", we->addr, we->cmd);
+	return t;
+}
+
+
+/*
+* Return the width in the response of a watched value
+*/
+
+static unsigned watch_width(unsigned type)
+{
+	return (type == 'B') ? 1 : 2;
+}
+
+
+/*
+* Start a watch for owner, whose changes are to be sent with tag. Fills in
+* the id. Returns FAIL if the watch makes no sense, or there is no room
+* for it.
+*/
+
+int watch_add(Han_Watch_Entry *we, void *owner, uint32_t tag)
+{
+	Watch_Target *t;
+	Watch *w = NULL;
+	unsigned i;
+
+	if((we->addr == 0xFF) || (we->numparams > MAX_NODE_PARAMS))
+		return FAIL;
+	if(we->type && (!strchr("BIU", we->type) || (we->offset + watch_width(we->type) > we->numparams)))
+		return FAIL;
+	for(i = 0; i < WATCH_MAX; i++){
+		if(!watch_table[i].owner){
+			w = &watch_table[i];
+			break;
+		}
+	}
+	if(!w){
+		debug(DEBUG_UNEXPECTED, "Too many watches, only %d allowed", WATCH_MAX);
+		return FAIL;
+	}
+	if(we->interval < WATCH_MIN_INTERVAL)
+		we->interval = WATCH_MIN_INTERVAL;
+	if((t = watch_target(we)) == NULL)
+		return FAIL;
+
+	we->id = i + 1;
+	memset(w, 0, sizeof(Watch));
+	w->def = *we;
+	w->owner = owner;
+	w->tag = tag;
+	w->target = t;
+	w->next = t->watches;
+	t->watches = w;
+
+	/* Send the command straight away, so the new watch hears how things stand */
+
+	if(we->interval < t->interval)
+		t->interval = we->interval;
+	t->due = evloop_now();
+	watch_sift(t->index);
+	watch_rearm();
+	return PASS;
+}
+
+
+/*
+* Take a watch off its target, and free the target if it was the last one
+*/
+
+static void watch_remove(Watch *w)
+{
+	Watch_Target *t = w->target;
+	Watch **pp, *o;
+	unsigned i;
+
+	for(pp = &t->watches; *pp != w; pp = &(*pp)->next);
+	*pp = w->next;
+	w->owner = NULL;
+
+	if(t->watches){
+
+		/* What is left may not need the target as often */
+
+		t->interval = t->watches->def.interval;
+		for(o = t->watches->next; o; o = o->next){
+			if(o->def.interval < t->interval)
+				t->interval = o->def.interval;
+		}
+		return;
+	}
+
+	i = t->index;
+	t->used = FALSE;
+	if(i != --watch_heap_len){
+		watch_place(watch_heap[watch_heap_len], i);
+		watch_sift(i);
+	}
+	watch_rearm();
+}
+
+
+/*
+* Stop a watch owner has. Returns FAIL if owner has no such watch.
+*/
+
+int watch_cancel(unsigned id, void *owner)
+{
+	Watch *w;
+
+	if(!id || (id > WATCH_MAX) || ((w = &watch_table[id - 1])->owner != owner) || !owner)
+		return FAIL;
+	watch_remove(w);
+	return PASS;
+}
+
+
+/*
+* Stop every watch owner has
+*/
+
+void watch_drop(void *owner)
+{
+	unsigned i;
+
+	for(i = 0; i < WATCH_MAX; i++){
+		if(watch_table[i].owner == owner)
+			watch_remove(&watch_table[i]);
+	}
+}
+
+
+/*
+* Look at a response for one watch, and report it if it's a change
+*/
+
+static void watch_check(Watch *w, const Client_Command *cc)
+{
+	const Han_Packet *pkt = &cc->cmd.pkt;
+	Han_Watch_Entry ev;
+	int value = 0, change;
+
+	if(w->def.type == 'B')
+		value = pkt->nodestatus[w->def.offset];
+	else if(w->def.type == 'I')
+		value = (int16_t)(pkt->nodestatus[w->def.offset] | (pkt->nodestatus[w->def.offset + 1] << 8));
+	else if(w->def.type == 'U')
+		value = pkt->nodestatus[w->def.offset] | (pkt->nodestatus[w->def.offset + 1] << 8);
+
+	if(!w->known || (cc->commstatus != w->status))
+		change = TRUE;
+	else if(cc->commstatus != HAN_CSTS_OK)
+		change = FALSE;
+	else if(w->def.type)
+		change = (unsigned) abs(value - w->value) > w->def.deadband;
+	else
+		change = memcmp(pkt->nodestatus, w->values, pkt->numnodeparams) != 0;
+	if(!change)
+		return;
+
+	ev = w->def;
+	ev.event = TRUE;
+	ev.status = cc->commstatus;
+	ev.value = value;
+	memcpy(ev.values, pkt->nodestatus, pkt->numnodeparams);
+	if((*watch_notify)(w->owner, w->tag, &ev))
+		return;
+
+	/* Later values are compared with the one reported, so a slow drift is reported too */
+
+	w->known = TRUE;
+	w->status = cc->commstatus;
+	w->value = value;
+	memcpy(w->values, pkt->nodestatus, pkt->numnodeparams);
+}
+
+
+/*
+* The command for a target has come back from the bus
+*/
+
+void watch_result(unsigned target, const Client_Command *cc)
+{
+	Watch_Target *t;
+	Watch *w, *list[WATCH_MAX];
+	unsigned i, n;
+
+	if(target >= WATCH_MAX)
+		return;
+	t = &watch_targets[target];
+
+	/* The target may have gone, and even been used again, while the command was out */
+
+	if(!t->used || (t->pkt.nodeaddress != cc->cmd.pkt.nodeaddress) || (t->pkt.nodecommand != cc->cmd.pkt.nodecommand) ||
+		(t->pkt.numnodeparams != cc->cmd.pkt.numnodeparams) || memcmp(t->pkt.nodeparams, cc->cmd.pkt.nodeparams, t->pkt.numnodeparams))
+		return;
+	t->busy = FALSE;
+
+	/* Passing on a change can close a connection, and with it some of the watches */
+
+	for(w = t->watches, n = 0; w; w = w->next)
+		list[n++] = w;
+	for(i = 0; i < n; i++){
+		if(list[i]->owner && (list[i]->target == t))
+			watch_check(list[i], cc);
+	}
+}
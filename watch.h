@@ -0,0 +1,62 @@
+/*
+ * watch.h.  Value change watches.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdint.h>
+
+/* Most watches at once, across every connection */
+
+#define WATCH_MAX		256
+
+/* Shortest interval between looks at a node, msec */
+
+#define WATCH_MIN_INTERVAL	100
+
+/*
+* Called to send the command for a watched target out on the bus. Returns
+* FAIL if it couldn't be sent, in which case it is tried again at the next
+* interval.
+*/
+
+typedef int (*Watch_Poll)(unsigned target, const Han_Packet *pkt);
+
+/*
+* Called with a change for the owner of a watch. Returns FAIL if it
+* couldn't be passed on, in which case it is tried again after the next
+* look at the node.
+*/
+
+typedef int (*Watch_Notify)(void *owner, uint32_t tag, const Han_Watch_Entry *ev);
+
+/* Prototypes */
+
+void watch_init(Watch_Poll poll, Watch_Notify notify);
+int watch_add(Han_Watch_Entry *we, void *owner, uint32_t tag);
+int watch_cancel(unsigned id, void *owner);
+void watch_drop(void *owner);
+void watch_result(unsigned target, const Client_Command *cc);
+
+#endif
@@ -0,0 +1,651 @@
+/*
+ * wire.c.  Version 2 client command wire format.
+ *
+ * The legacy format sends the whole of a Client_Command in host byte order
+ * each way, about 3K whatever the request. These routines pack just the
+ * fields a request or response uses, in little endian order, behind a
+ * short header. See wire.h for the layout.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "tnd.h"
+#include "options.h"
+#include "error.h"
+#include "han.h"
+#include "wire.h"
+
+/* Local defines */
+
+#define WIRE_NODESTATS_LEN	50		// Bytes for each node in a NODESTATS response
+
+/* The largest payload of each request and response has to fit in a message */
+
+_Static_assert(3 + MAX_NODE_PARAMS <= WIRE_MAX_PAYLOAD, "SENDPKT is too big");
+_Static_assert(3 + sizeof(((Han_Netscan *) 0)->nodelist) / sizeof(struct node_info) * 5 <= WIRE_MAX_PAYLOAD,
+	"NETSCAN is too big");
+_Static_assert(2 + sizeof(((struct hand_info *) 0)->version) <= WIRE_MAX_PAYLOAD, "DAEMON_INFO is too big");
+_Static_assert(10 + sizeof(((struct han_raw *) 0)->txbuffer) <= WIRE_MAX_PAYLOAD, "RAW_PACKET is too big");
+_Static_assert(3 + HAN_NODESTATS_MAX * WIRE_NODESTATS_LEN <= WIRE_MAX_PAYLOAD, "NODESTATS is too big");
+_Static_assert(HAN_PRIO_CLASSES * 28 <= WIRE_MAX_PAYLOAD, "QUEUESTATS is too big");
+_Static_assert(15 + MAX_NODE_PARAMS + HAN_SAMPLES_MAX * (9 + MAX_NODE_PARAMS) <= WIRE_MAX_PAYLOAD, "SAMPLES is too big");
+_Static_assert(18 + HAN_HISTORY_MAX * 20 <= WIRE_MAX_PAYLOAD, "HISTORY is too big");
+_Static_assert(14 + MAX_NODE_PARAMS <= WIRE_MAX_PAYLOAD, "WATCH is too big");
+_Static_assert(sizeof(((struct ppower_client_command *) 0)->command_string) <= WIRE_MAX_PAYLOAD, "PPOWER is too big");
+
+
+/*
+* Little endian field access
+*/
+
+static uint8_t *put16(uint8_t *p, unsigned v)
+{
+	p[0] = (uint8_t) v;
+	p[1] = (uint8_t)(v >> 8);
+	return p + 2;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t) v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+	return p + 4;
+}
+
+static unsigned get16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+/*
+* Decode and check a message header. Returns FAIL if it isn't a v2 header,
+* or the payload is too big.
+*/
+
+int wire_header(const uint8_t *buf, Wire_Header *hdr)
+{
+	if((buf[0] != WIRE_MAGIC0) || (buf[1] != WIRE_MAGIC1))
+		return FAIL;
+
+	hdr->request = get16(buf + 2);
+	hdr->length = get16(buf + 4);
+	hdr->flags = buf[6];
+	hdr->tag = get32(buf + 8);
+	hdr->status = (int32_t) get32(buf + 12);
+
+	if(hdr->length > WIRE_MAX_PAYLOAD){
+		debug(DEBUG_UNEXPECTED, "Wire payload too long: %u", hdr->length);
+		return FAIL;
+	}
+	return PASS;
+}
+
+
+/*
+* Pack a request, or the response to one if flags has WIRE_FLAG_RESPONSE,
+* into msg. msg must have room for WIRE_MAX_MSG bytes. Returns the length of
+* the message.
+*/
+
+unsigned wire_encode(uint8_t *msg, const Client_Command *cc, uint32_t tag, unsigned flags)
+{
+	uint8_t *p = msg + WIRE_HDR_LEN;
+	const Err_Stats *st;
+	const struct node_stats *ns;
+	const struct queue_stats *qs;
+	const Han_Samples *hs;
+	const Han_History *hh;
+	const Han_Watch_Entry *we;
+	unsigned i, n;
+	int response = (flags & WIRE_FLAG_RESPONSE) ? TRUE : FALSE;
+
+	switch(cc->request){
+		case HAN_CCMD_SENDPKT:
+			n = cc->cmd.pkt.numnodeparams;
+			if(n > MAX_NODE_PARAMS)
+				n = MAX_NODE_PARAMS;
+			*p++ = cc->cmd.pkt.nodeaddress;
+			*p++ = cc->cmd.pkt.nodecommand;
+			*p++ = (uint8_t) n;
+			memcpy(p, response ? cc->cmd.pkt.nodestatus : cc->cmd.pkt.nodeparams, n);
+			p += n;
+			break;
+
+		case HAN_CCMD_NETSCAN:
+			*p++ = cc->cmd.scan.flags;
+			if(!response)
+				break;
+			*p++ = cc->cmd.scan.lastaddr;
+			*p++ = cc->cmd.scan.numnodesfound;
+			for(i = 0; i < cc->cmd.scan.numnodesfound; i++){
+				*p++ = cc->cmd.scan.nodelist[i].addr;
+				p = put16(p, cc->cmd.scan.nodelist[i].type);
+				p = put16(p, cc->cmd.scan.nodelist[i].fwlevel);
+			}
+			break;
+
+		case HAN_CCMD_NETSTATS:
+		case HAN_CCMD_NETSTATSCLR:
+			if(!response)
+				break;
+			st = &cc->cmd.stats;
+			p = put32(p, st->round_trips);
+			p = put32(p, st->spurious_packets);
+			p = put32(p, st->rx_timeouts);
+			p = put32(p, st->tx_timeouts);
+			p = put32(p, st->crc_errs);
+			p = put32(p, st->rx_syscalls);
+			p = put32(p, st->rx_bytes);
+			p = put32(p, st->tx_syscalls);
+			p = put32(p, st->tx_bytes);
+			break;
+
+		case HAN_CCMD_DAEMON_INFO:
+			if(!response)
+				break;
+			p = put16(p, cc->cmd.info.wireversion);
+			n = strnlen(cc->cmd.info.version, sizeof(cc->cmd.info.version) - 1);
+			memcpy(p, cc->cmd.info.version, n);
+			p += n;
+			break;
+
+		case HAN_CCMD_RAW_PACKET:
+			if(response){
+				*p++ = cc->cmd.raw.rxexpectlen;
+				memcpy(p, cc->cmd.raw.rxbuffer, cc->cmd.raw.rxexpectlen);
+				p += cc->cmd.raw.rxexpectlen;
+			}
+			else{
+				p = put32(p, cc->cmd.raw.txtimeout);
+				p = put32(p, cc->cmd.raw.rxtimeout);
+				*p++ = cc->cmd.raw.rxexpectlen;
+				*p++ = cc->cmd.raw.txlen;
+				memcpy(p, cc->cmd.raw.txbuffer, cc->cmd.raw.txlen);
+				p += cc->cmd.raw.txlen;
+			}
+			break;
+
+		case HAN_CCMD_NODESTATS:
+			*p++ = cc->cmd.nodestats.first;
+			if(!response)
+				break;
+			n = cc->cmd.nodestats.numnodes;
+			if(n > HAN_NODESTATS_MAX)
+				n = HAN_NODESTATS_MAX;
+			*p++ = (uint8_t) n;
+			*p++ = cc->cmd.nodestats.more;
+			for(i = 0; i < n; i++){
+				ns = &cc->cmd.nodestats.nodelist[i];
+				*p++ = ns->addr;
+				*p++ = ns->state;
+				p = put32(p, ns->samples);
+				p = put32(p, ns->timeouts);
+				p = put32(p, ns->srtt);
+				p = put32(p, ns->rttvar);
+				p = put32(p, ns->timeout);
+				p = put32(p, ns->downs);
+				p = put32(p, ns->ups);
+				p = put32(p, ns->refused);
+				p = put32(p, ns->crc_errs);
+				p = put32(p, ns->naks);
+				p = put32(p, ns->format_errs);
+				p = put32(p, ns->idle);
+			}
+			break;
+
+		case HAN_CCMD_QUEUESTATS:
+			if(!response)
+				break;
+			for(i = 0; i < HAN_PRIO_CLASSES; i++){
+				qs = &cc->cmd.queuestats.queue[i];
+				p = put32(p, qs->depth);
+				p = put32(p, qs->maxdepth);
+				p = put32(p, qs->served);
+				p = put32(p, qs->promoted);
+				p = put32(p, qs->waittotal);
+				p = put32(p, qs->waitmax);
+				p = put32(p, qs->coalesced);
+			}
+			break;
+
+		case HAN_CCMD_CACHESTATS:
+			if(!response)
+				break;
+			p = put32(p, cc->cmd.cachestats.hits);
+			p = put32(p, cc->cmd.cachestats.misses);
+			p = put32(p, cc->cmd.cachestats.stores);
+			p = put32(p, cc->cmd.cachestats.invalidations);
+			p = put32(p, cc->cmd.cachestats.evictions);
+			p = put32(p, cc->cmd.cachestats.entries);
+			break;
+
+		case HAN_CCMD_TEXTSTATS:
+			if(!response)
+				break;
+			p = put32(p, cc->cmd.textstats.sockets);
+			p = put32(p, cc->cmd.textstats.queued);
+			p = put32(p, cc->cmd.textstats.maxqueued);
+			p = put32(p, cc->cmd.textstats.events);
+			p = put32(p, cc->cmd.textstats.dropped);
+			p = put32(p, cc->cmd.textstats.disconnects);
+			break;
+
+		case HAN_CCMD_SAMPLES:
+			hs = &cc->cmd.samples;
+			*p++ = hs->series;
+			if(!response){
+				p = put32(p, hs->since);
+				break;
+			}
+			n = (hs->numparams > MAX_NODE_PARAMS) ? MAX_NODE_PARAMS : hs->numparams;
+			*p++ = hs->numseries;
+			*p++ = hs->more;
+			*p++ = hs->addr;
+			*p++ = hs->cmd;
+			*p++ = (uint8_t) n;
+			memcpy(p, hs->params, n);
+			p += n;
+			p = put32(p, hs->interval);
+			p = put32(p, hs->last);
+			*p++ = (hs->numsamples > HAN_SAMPLES_MAX) ? HAN_SAMPLES_MAX : hs->numsamples;
+			for(i = 0; (i < hs->numsamples) && (i < HAN_SAMPLES_MAX); i++){
+				p = put32(p, hs->samples[i].seq);
+				p = put32(p, hs->samples[i].age);
+				*p++ = (uint8_t) -hs->samples[i].status;
+				memcpy(p, hs->samples[i].values, n);
+				p += n;
+			}
+			break;
+
+		case HAN_CCMD_HISTORY:
+			hh = &cc->cmd.history;
+			*p++ = hh->series;
+			if(!response){
+				p = put32(p, hh->from);
+				p = put32(p, hh->to);
+				p = put32(p, hh->step);
+				break;
+			}
+			n = (hh->numpoints > HAN_HISTORY_MAX) ? HAN_HISTORY_MAX : hh->numpoints;
+			*p++ = (uint8_t) n;
+			*p++ = hh->more;
+			p = put32(p, hh->from);
+			p = put32(p, hh->to);
+			p = put32(p, hh->step);
+			p = put32(p, hh->slot);
+			for(i = 0; i < n; i++){
+				p = put32(p, hh->points[i].time);
+				p = put32(p, hh->points[i].count);
+				p = put32(p, (uint32_t) hh->points[i].min);
+				p = put32(p, (uint32_t) hh->points[i].max);
+				p = put32(p, (uint32_t) hh->points[i].avg);
+			}
+			break;
+
+		case HAN_CCMD_WATCH:
+			we = &cc->cmd.watch;
+			n = (we->numparams > MAX_NODE_PARAMS) ? MAX_NODE_PARAMS : we->numparams;
+			if(response){
+				p = put32(p, we->id);
+				*p++ = we->event;
+				*p++ = (uint8_t) -we->status;
+			}
+			*p++ = we->addr;
+			*p++ = we->cmd;
+			*p++ = (uint8_t) n;
+			memcpy(p, response ? we->values : we->params, n);
+			p += n;
+			if(response){
+				p = put32(p, (uint32_t) we->value);
+				break;
+			}
+			*p++ = we->type;
+			*p++ = we->offset;
+			p = put32(p, we->interval);
+			p = put32(p, we->deadband);
+			break;
+
+		case HAN_CCMD_UNWATCH:
+			p = put32(p, cc->cmd.watch.id);
+			break;
+
+		case HAN_CCMD_PPOWER_COMMAND:
+			if(response)
+				break;
+			n = strnlen(cc->cmd.ppower_cmd.command_string, sizeof(cc->cmd.ppower_cmd.command_string) - 1);
+			memcpy(p, cc->cmd.ppower_cmd.command_string, n);
+			p += n;
+			break;
+
+		default:	// SESSION and unknown requests have no payload
+			break;
+	}
+
+	msg[0] = WIRE_MAGIC0;
+	msg[1] = WIRE_MAGIC1;
+	put16(msg + 2, cc->request);
+	put16(msg + 4, p - (msg + WIRE_HDR_LEN));
+	msg[6] = (uint8_t) flags;
+	msg[7] = 0;
+	put32(msg + 8, tag);
+	put32(msg + 12, response ? (uint32_t) cc->commstatus : 0);
+
+	return p - msg;
+}
+
+
+/*
+* Unpack a request, or the response to one, into cc. cc should be zeroed
+* first. Returns FAIL if the payload doesn't match the request.
+*/
+
+int wire_decode(Client_Command *cc, const Wire_Header *hdr, const uint8_t *payload, int response)
+{
+	const uint8_t *p = payload;
+	unsigned len = hdr->length;
+	Err_Stats *st;
+	struct node_stats *ns;
+	struct queue_stats *qs;
+	Han_Samples *hs;
+	Han_History *hh;
+	Han_Watch_Entry *we;
+	unsigned i, n;
+
+	cc->request = hdr->request;
+	cc->commstatus = hdr->status;
+
+	switch(hdr->request){
+		case HAN_CCMD_SENDPKT:
+			if((len < 3) || ((n = p[2]) > MAX_NODE_PARAMS) || (len != 3 + n))
+				return FAIL;
+			cc->cmd.pkt.nodeaddress = p[0];
+			cc->cmd.pkt.nodecommand = p[1];
+			cc->cmd.pkt.numnodeparams = (uint8_t) n;
+			memcpy(response ? cc->cmd.pkt.nodestatus : cc->cmd.pkt.nodeparams, p + 3, n);
+			break;
+
+		case HAN_CCMD_NETSCAN:
+			if(!response){
+				if(len > 1)
+					return FAIL;
+				cc->cmd.scan.flags = len ? p[0] : 0;
+				break;
+			}
+			if((len < 3) || (len != 3 + p[2] * 5))
+				return FAIL;
+			cc->cmd.scan.flags = *p++;
+			cc->cmd.scan.lastaddr = *p++;
+			cc->cmd.scan.numnodesfound = *p++;
+			for(i = 0; i < cc->cmd.scan.numnodesfound; i++, p += 5){
+				cc->cmd.scan.nodelist[i].addr = p[0];
+				cc->cmd.scan.nodelist[i].type = get16(p + 1);
+				cc->cmd.scan.nodelist[i].fwlevel = get16(p + 3);
+			}
+			break;
+
+		case HAN_CCMD_NETSTATS:
+		case HAN_CCMD_NETSTATSCLR:
+			if(!response)
+				return len ? FAIL : PASS;
+			if(len != 36)
+				return FAIL;
+			st = &cc->cmd.stats;
+			st->round_trips = get32(p);
+			st->spurious_packets = get32(p + 4);
+			st->rx_timeouts = get32(p + 8);
+			st->tx_timeouts = get32(p + 12);
+			st->crc_errs = get32(p + 16);
+			st->rx_syscalls = get32(p + 20);
+			st->rx_bytes = get32(p + 24);
+			st->tx_syscalls = get32(p + 28);
+			st->tx_bytes = get32(p + 32);
+			break;
+
+		case HAN_CCMD_DAEMON_INFO:
+			if(!response)
+				return len ? FAIL : PASS;
+			if((len < 2) || (len - 2 >= sizeof(cc->cmd.info.version)))
+				return FAIL;
+
+			/* The sizes are those of this side, as the wire format doesn't depend on them */
+
+			cc->cmd.info.handinfosize = sizeof(struct hand_info);
+			cc->cmd.info.cmdpktsize = sizeof(struct han_packet);
+			cc->cmd.info.netscanpktsize = sizeof(struct han_netscan);
+			cc->cmd.info.errstatssize = sizeof(struct err_stats);
+			cc->cmd.info.ppowersize = sizeof(struct ppower_client_command);
+			cc->cmd.info.rawsize = sizeof(struct han_raw);
+			cc->cmd.info.wireversion = get16(p);
+			memcpy(cc->cmd.info.version, p + 2, len - 2);
+			cc->cmd.info.version[len - 2] = 0;
+			break;
+
+		case HAN_CCMD_RAW_PACKET:
+			if(response){
+				if((len < 1) || (len != 1 + p[0]))
+					return FAIL;
+				cc->cmd.raw.rxexpectlen = p[0];
+				memcpy(cc->cmd.raw.rxbuffer, p + 1, p[0]);
+			}
+			else{
+				if((len < 10) || (len != 10 + p[9]))
+					return FAIL;
+				cc->cmd.raw.txtimeout = get32(p);
+				cc->cmd.raw.rxtimeout = get32(p + 4);
+				cc->cmd.raw.rxexpectlen = p[8];
+				cc->cmd.raw.txlen = p[9];
+				memcpy(cc->cmd.raw.txbuffer, p + 10, p[9]);
+			}
+			break;
+
+		case HAN_CCMD_NODESTATS:
+			if(!response){
+				if(len != 1)
+					return FAIL;
+				cc->cmd.nodestats.first = p[0];
+				break;
+			}
+			if((len < 3) || (p[1] > HAN_NODESTATS_MAX) || (len != 3 + p[1] * WIRE_NODESTATS_LEN))
+				return FAIL;
+			cc->cmd.nodestats.first = p[0];
+			cc->cmd.nodestats.numnodes = p[1];
+			cc->cmd.nodestats.more = p[2];
+			for(i = 0, p += 3; i < cc->cmd.nodestats.numnodes; i++, p += WIRE_NODESTATS_LEN){
+				ns = &cc->cmd.nodestats.nodelist[i];
+				ns->addr = p[0];
+				ns->state = p[1];
+				ns->samples = get32(p + 2);
+				ns->timeouts = get32(p + 6);
+				ns->srtt = get32(p + 10);
+				ns->rttvar = get32(p + 14);
+				ns->timeout = get32(p + 18);
+				ns->downs = get32(p + 22);
+				ns->ups = get32(p + 26);
+				ns->refused = get32(p + 30);
+				ns->crc_errs = get32(p + 34);
+				ns->naks = get32(p + 38);
+				ns->format_errs = get32(p + 42);
+				ns->idle = get32(p + 46);
+			}
+			break;
+
+		case HAN_CCMD_QUEUESTATS:
+			if(!response)
+				return len ? FAIL : PASS;
+			if(len != HAN_PRIO_CLASSES * 28)
+				return FAIL;
+			for(i = 0; i < HAN_PRIO_CLASSES; i++, p += 28){
+				qs = &cc->cmd.queuestats.queue[i];
+				qs->depth = get32(p);
+				qs->maxdepth = get32(p + 4);
+				qs->served = get32(p + 8);
+				qs->promoted = get32(p + 12);
+				qs->waittotal = get32(p + 16);
+				qs->waitmax = get32(p + 20);
+				qs->coalesced = get32(p + 24);
+			}
+			break;
+
+		case HAN_CCMD_CACHESTATS:
+			if(!response)
+				return len ? FAIL : PASS;
+			if(len != 24)
+				return FAIL;
+			cc->cmd.cachestats.hits = get32(p);
+			cc->cmd.cachestats.misses = get32(p + 4);
+			cc->cmd.cachestats.stores = get32(p + 8);
+			cc->cmd.cachestats.invalidations = get32(p + 12);
+			cc->cmd.cachestats.evictions = get32(p + 16);
+			cc->cmd.cachestats.entries = get32(p + 20);
+			break;
+
+		case HAN_CCMD_TEXTSTATS:
+			if(!response)
+				return len ? FAIL : PASS;
+			if(len != 24)
+				return FAIL;
+			cc->cmd.textstats.sockets = get32(p);
+			cc->cmd.textstats.queued = get32(p + 4);
+			cc->cmd.textstats.maxqueued = get32(p + 8);
+			cc->cmd.textstats.events = get32(p + 12);
+			cc->cmd.textstats.dropped = get32(p + 16);
+			cc->cmd.textstats.disconnects = get32(p + 20);
+			break;
+
+		case HAN_CCMD_SAMPLES:
+			hs = &cc->cmd.samples;
+			if(!response){
+				if(len != 5)
+					return FAIL;
+				hs->series = p[0];
+				hs->since = get32(p + 1);
+				break;
+			}
+			if((len < 15) || ((n = p[5]) > MAX_NODE_PARAMS) || (len < 15 + n))
+				return FAIL;
+			hs->series = p[0];
+			hs->numseries = p[1];
+			hs->more = p[2];
+			hs->addr = p[3];
+			hs->cmd = p[4];
+			hs->numparams = (unsigned char) n;
+			memcpy(hs->params, p + 6, n);
+			p += 6 + n;
+			hs->interval = get32(p);
+			hs->last = get32(p + 4);
+			hs->numsamples = p[8];
+			p += 9;
+			if((hs->numsamples > HAN_SAMPLES_MAX) || (len != 15 + n + hs->numsamples * (9 + n)))
+				return FAIL;
+			for(i = 0; i < hs->numsamples; i++, p += 9 + n){
+				hs->samples[i].seq = get32(p);
+				hs->samples[i].age = get32(p + 4);
+				hs->samples[i].status = -(int) p[8];
+				memcpy(hs->samples[i].values, p + 9, n);
+			}
+			break;
+
+		case HAN_CCMD_HISTORY:
+			hh = &cc->cmd.history;
+			if(!response){
+				if(len != 13)
+					return FAIL;
+				hh->series = p[0];
+				hh->from = get32(p + 1);
+				hh->to = get32(p + 5);
+				hh->step = get32(p + 9);
+				break;
+			}
+			if((len < 19) || ((n = p[1]) > HAN_HISTORY_MAX) || (len != 19 + n * 20))
+				return FAIL;
+			hh->series = p[0];
+			hh->numpoints = (unsigned char) n;
+			hh->more = p[2];
+			hh->from = get32(p + 3);
+			hh->to = get32(p + 7);
+			hh->step = get32(p + 11);
+			hh->slot = get32(p + 15);
+			for(i = 0, p += 19; i < n; i++, p += 20){
+				hh->points[i].time = get32(p);
+				hh->points[i].count = get32(p + 4);
+				hh->points[i].min = (int32_t) get32(p + 8);
+				hh->points[i].max = (int32_t) get32(p + 12);
+				hh->points[i].avg = (int32_t) get32(p + 16);
+			}
+			break;
+
+		case HAN_CCMD_WATCH:
+			we = &cc->cmd.watch;
+			if(response){
+				if((len < 13) || ((n = p[8]) > MAX_NODE_PARAMS) || (len != 13 + n))
+					return FAIL;
+				we->id = get32(p);
+				we->event = p[4];
+				we->status = -(int) p[5];
+				p += 6;
+			}
+			else if((len < 13) || ((n = p[2]) > MAX_NODE_PARAMS) || (len != 13 + n))
+				return FAIL;
+			we->addr = p[0];
+			we->cmd = p[1];
+			we->numparams = (unsigned char) n;
+			memcpy(response ? we->values : we->params, p + 3, n);
+			p += 3 + n;
+			if(response){
+				we->value = (int32_t) get32(p);
+				break;
+			}
+			we->type = p[0];
+			we->offset = p[1];
+			we->interval = get32(p + 2);
+			we->deadband = get32(p + 6);
+			break;
+
+		case HAN_CCMD_UNWATCH:
+			if(len != 4)
+				return FAIL;
+			cc->cmd.watch.id = get32(p);
+			break;
+
+		case HAN_CCMD_PPOWER_COMMAND:
+			if(response)
+				return len ? FAIL : PASS;
+			if(len >= sizeof(cc->cmd.ppower_cmd.command_string))
+				return FAIL;
+			memcpy(cc->cmd.ppower_cmd.command_string, p, len);
+			cc->cmd.ppower_cmd.command_string[len] = 0;
+			break;
+
+		default:	// Unknown requests are answered with HAN_CSTS_CMD_UNKNOWN
+			break;
+	}
+	return PASS;
+}
@@ -0,0 +1,113 @@
+/*
+ * wire.h.  Version 2 client command wire format.
+ *
+ * Copyright (C) 2026 Stephen Rodgers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * Stephen "Steve" Rodgers <hwstar@rodgers.sdcoxmail.com>
+ *
+ * $Id$
+ */
+
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stdint.h>
+
+/*
+* Every v2 message is a 16 byte header followed by a payload whose size
+* depends on the request. All fields are little endian.
+*
+*  0  'H' '2'	magic
+*  2  u16	request, HAN_CCMD_xxx
+*  4  u16	payload length
+*  6  u8	flags, WIRE_FLAG_xxx
+*  7  u8	reserved, send as 0
+*  8  u32	tag, returned unchanged with the response
+* 12  i32	status, HAN_CSTS_xxx. 0 in requests.
+*
+* A request flagged WIRE_FLAG_BULK waits for the bus behind interactive
+* requests.
+*
+* Payloads, request / response:
+*
+* SENDPKT	addr, cmd, n, params[n] / addr, cmd, n, status[n]
+* NETSCAN	flags / flags, lastaddr, count, count * (addr, u16 type, u16 fwlevel)
+*		A request with no payload is taken as flags 0.
+* NETSTATS	empty / 9 * u32 in struct err_stats order
+* NETSTATSCLR	as NETSTATS
+* DAEMON_INFO	empty / u16 wire version, version string without the NUL
+* RAW_PACKET	u32 txtimeout, u32 rxtimeout, rxexpectlen, txlen, tx[txlen] / rxlen, rx[rxlen]
+* NODESTATS	first / first, count, more, count * (addr, state, u32 samples,
+*		u32 timeouts, u32 srtt, u32 rttvar, u32 timeout, u32 downs, u32 ups,
+*		u32 refused, u32 crc_errs, u32 naks, u32 format_errs, u32 idle)
+* QUEUESTATS	empty / 3 * (u32 depth, u32 maxdepth, u32 served, u32 promoted,
+*		u32 waittotal, u32 waitmax, u32 coalesced) in HAN_PRIO_xxx order
+* CACHESTATS	empty / u32 hits, u32 misses, u32 stores, u32 invalidations,
+*		u32 evictions, u32 entries
+* TEXTSTATS	empty / u32 sockets, u32 queued, u32 maxqueued, u32 events,
+*		u32 dropped, u32 disconnects
+* SAMPLES	series, u32 since / series, numseries, more, addr, cmd, n, params[n],
+*		u32 interval, u32 last, count, count * (u32 seq, u32 age, -status,
+*		values[n])
+* HISTORY	series, u32 from, u32 to, u32 step / series, count, more, u32 from,
+*		u32 to, u32 step, u32 slot, count * (u32 time, u32 count, i32 min,
+*		i32 max, i32 avg)
+* WATCH		addr, cmd, n, params[n], type, offset, u32 interval, u32 deadband /
+*		u32 id, event, -status, addr, cmd, n, values[n], i32 value
+* UNWATCH	u32 id / u32 id
+* PPOWER	command string without the NUL / empty
+* SESSION	empty / empty
+*
+* A v2 connection stays open and may have any number of requests in flight.
+* A NETSCAN request with HAN_NETSCAN_PROGRESS set gets any number of
+* responses flagged HAN_NETSCAN_PARTIAL before the final one. A WATCH
+* request gets a response for each change after the first, with event set.
+*/
+
+#define WIRE_VERSION		2
+#define WIRE_MAGIC0		'H'
+#define WIRE_MAGIC1		'2'
+#define WIRE_HDR_LEN		16
+#define WIRE_MAX_PAYLOAD	1536		// Big enough for a full netscan response
+#define WIRE_MAX_MSG		(WIRE_HDR_LEN + WIRE_MAX_PAYLOAD)
+
+/* Header flags */
+
+#define WIRE_FLAG_RESPONSE	0x01
+#define WIRE_FLAG_BULK		0x02		// Request: bulk priority
+
+/* Typedefs */
+
+typedef struct wire_header Wire_Header;
+
+/* Decoded message header */
+
+struct wire_header {
+	unsigned request;
+	unsigned length;
+	unsigned flags;
+	uint32_t tag;
+	int status;
+};
+
+/* Prototypes */
+
+int wire_header(const uint8_t *buf, Wire_Header *hdr);
+unsigned wire_encode(uint8_t *msg, const Client_Command *cc, uint32_t tag, unsigned flags);
+int wire_decode(Client_Command *cc, const Wire_Header *hdr, const uint8_t *payload, int response);
+
+#endif